@@ -14,18 +14,28 @@ LDFLAGS   ?=
 LIBRARIES = inih
 
 # Object files
-OBJECTS = src/feature.o      \
+OBJECTS = src/builtin_encodings.o \
+          src/convert.o      \
+          src/event_io.o     \
+          src/feature.o      \
           src/main-helpers.o \
           src/markdown.o     \
           src/parse_value.o  \
           src/parse_vars.o   \
+          src/passthrough.o  \
           src/socket_io.o    \
+          src/spool.o        \
           src/stream_io.o    \
+          src/streaming.o    \
+          src/ratelimit.o    \
           src/recode.o       \
+          src/resolver.o     \
+          src/scan.o         \
           src/utf8.o         \
+          src/workers.o      \
           src/writer.o       \
           src/main.o
 
 # Additional compiler and linker library flags
-CFLAGS  += $(shell pkg-config --cflags $(LIBRARIES)) -DVERSION=\"$(VERSION)\"
-LDFLAGS += $(shell pkg-config --libs $(LIBRARIES))
+CFLAGS  += $(shell pkg-config --cflags $(LIBRARIES)) -DVERSION=\"$(VERSION)\" -pthread
+LDFLAGS += $(shell pkg-config --libs $(LIBRARIES)) -pthread
@@ -31,7 +31,7 @@ It doesn't. It simply outputs the converted text to a specified file (or standar
 
 ## What can be specified as the output?
 
-The last command line argument, output destination, can either be a character device (e.g. `/dev/usb/lp0`) or a normal text file. COPRIS by default writes to it every time it receives and processes data, overwriting any previous contents (this can be configured to append instead). If no destination is specified, data will be echoed to the terminal with corresponding `Begin-` and `End-Stream-Transcript` markers (`;BST` and `;EST`).
+The last command line argument, output destination, can either be a character device (e.g. `/dev/usb/lp0`) or a normal text file. COPRIS by default writes to it every time it receives and processes data, appending to any previous contents (a regular file is never truncated). If no destination is specified, data will be echoed to the terminal with corresponding `Begin-` and `End-Stream-Transcript` markers (`;BST` and `;EST`).
 
 
 # Usage and examples
@@ -10,7 +10,7 @@ m4_changequote(`[[[', `]]]')m4_dnl
 
 # SYNOPSIS
 
-| **copris** \[*options*\] \[*printer device* or *output file*\]
+| **copris** \[*options*\] \[*printer device* or *output file* ...\]
 | **copris** **\--dump-commands** > new_feature_file.ini
 
 
@@ -44,6 +44,19 @@ m4_include(common05-variables.md)m4_dnl
 **-p**, **\--port** *NUMBER*
 : Run COPRIS as a network server on port *NUMBER*. Superuser
   privileges are required if *NUMBER* is less than 1024.
+  By default, both IPv6 and IPv4 clients are accepted.
+
+**-4**, **\--ipv4**
+: Only accept network connections over IPv4.
+
+**-6**, **\--ipv6**
+: Only accept network connections over IPv6.
+
+**\--unix-socket** *PATH*
+: Run COPRIS as a local server on a Unix domain socket, created at *PATH*,
+  instead of a network port. Local clients thus bypass the network stack.
+  A socket file, left behind by a previous run, is replaced, unless another
+  server is still listening on it.
 
 **-e**, **\--encoding** *FILE*
 : Recode characters in received text according to definitions from encoding
@@ -51,11 +64,44 @@ m4_include(common05-variables.md)m4_dnl
   Consult the **FILE FORMAT** and **THE ENCODING FILE** chapters above for
   details.
 
+  Encoding files, shipped with COPRIS, are also built into it, and are used by
+  their name without **.ini**, prefixed with **builtin:** (e.g. **-e builtin:cp852**),
+  without reading any file. **\--version** lists them. Built-in encodings may be
+  combined with encoding files.
+
 **\--ignore-missing**
 : If recoding characters, do not terminate the program if received text
   contains any possibly unwanted multi-byte characters that were
   not handled by specified *FILE*s.
 
+**\--recode-threads** *NUMBER*
+: Split a text, bigger than 1 MiB, into up to *NUMBER* parts at character
+  boundaries (each at least 1 MiB long), and recode them in as many threads at
+  once. Recoded text is the same as if it was recoded as a whole. Text, printed
+  with **\--stream**, is always recoded in a single thread.
+
+**\--recode-stats** *FILE*
+: While texts are recoded, write statistics of recoding all texts so far to
+  *FILE* at most every 10 seconds, and once more when COPRIS stops: bytes before
+  and after recoding, the number of characters, replaced by their definitions,
+  and the multi-byte characters without a definition, the most frequent first.
+  These are written as commented-out definitions, ready to be filled in and added
+  to an encoding file. Text, printed with **\--stream**, is counted, but doesn't
+  cause *FILE* to be written before COPRIS stops. With **\--listeners**, each
+  process keeps its own statistics, and *FILE* holds those of the process that
+  wrote it last.
+
+  Even without this option, **-vv** shows the same statistics of each text, and
+  of all texts once COPRIS stops, with the 10 most frequent characters without a
+  definition.
+
+**\--encoding-cache** *DIR*
+: Store the encoding *FILE*s, compiled into COPRIS' lookup table, in a file in
+  directory *DIR*, named after the *FILE*s' contents and modification times. Later
+  runs with the same *FILE*s map the table from that file, instead of parsing them
+  again, and processes using it at the same time share its memory. Changing any
+  of the *FILE*s makes a new cache file; old ones are not removed.
+
 **-f**, **\--feature** *FILE*
 : Process Markdown markup and variables in received text and apply session
   commands according to printer feature *FILE*. This option can be specified
@@ -70,6 +116,92 @@ m4_include(common05-variables.md)m4_dnl
 
 **-d**, **\--daemon**
 : If running as a network server, do not exit after the first connection.
+  Multiple clients may send their text at the same time; each one is
+  printed once its client closes the connection.
+
+**\--backlog** *NUMBER*
+: If running as a network server, let the system queue up to *NUMBER*
+  connections that have not been accepted yet.
+
+**\--listeners** *NUMBER*
+: If running as a daemon, accept connections in *NUMBER* processes, each with its
+  own socket on the same port (using **SO_REUSEPORT**), so the kernel spreads
+  clients among them. Only the original process prints session commands.
+  Each job is written to the output file as a whole, but jobs from different
+  processes may be written in any order.
+
+**\--workers** *NUMBER*
+: If running as a daemon, convert up to *NUMBER* received texts at once,
+  each in its own thread. Texts are still printed one after another, in the
+  order they were received. By default, texts are converted in the main thread.
+
+**\--spool-jobs** *NUMBER*
+: If running as a daemon, print texts in a separate writer thread, while next
+  ones are still being received, and let up to *NUMBER* converted texts wait
+  for it. Once that many are waiting, COPRIS stops serving clients until the
+  printer catches up, and new clients wait to be accepted. By default (or with
+  *NUMBER* 0), texts are printed in the main thread, one after another, and the
+  options below that apply to the writer thread are ignored.
+
+**\--spool-size** *SIZE*
+: Also stop serving clients once texts, waiting for the writer thread, take up
+  *SIZE* bytes (16 MiB by default, 0 for no limit). A single text, bigger than
+  *SIZE*, is still printed.
+
+**\--spool-dir** *DIR*
+: Keep texts, waiting for the writer thread, in files in directory *DIR*
+  instead of in memory, so more of them may wait than would fit into memory.
+  Texts are synced to disk in batches, whenever COPRIS has served all clients
+  that have finished sending. Texts, not yet printed when COPRIS stops or
+  crashes, are queued again with their priority on its next start (a text,
+  being printed at that moment, is printed again). Only one COPRIS process
+  may use *DIR* at a time, thus **\--listeners** can't be used with it.
+
+**\--priority** *CLASS*
+: Print texts, waiting for the writer thread, with *high*, *normal* (the
+  default) or *low* priority, unless their modeline sets it otherwise. Waiting
+  texts of higher priority are always printed first. Among texts of the same
+  priority, clients (by address) take turns, each having up to 16 KiB printed
+  in its turn, so a client with many big texts doesn't hold up others' short
+  ones. With **-vv**, COPRIS reports how long texts of each priority have waited,
+  whenever all waiting texts have been printed.
+
+**\--balance** *MODE*
+: If more than one printer device (a pool of identical printers) is given,
+  let each device's writer thread take the next waiting text as soon as the
+  device is free (*free*, the default), so texts go to the device with the
+  least queued text, or let the devices take texts in turn (*round-robin*).
+  A device whose writing fails is taken out of the pool for 60 seconds, and
+  its text is printed again, as a whole, by another device. With **-vv**,
+  COPRIS reports each device's printed texts, bytes and throughput, whenever
+  all waiting texts have been printed. Without a writer thread, only the first
+  device is used.
+
+**\--output-timeout** *SECONDS*
+: Fail writing a text to a printer device (not a regular file) that accepts no
+  text for *SECONDS*, so that the device is taken out of the pool. By default,
+  devices are waited for indefinitely.
+
+**\--resolve** *MODE*
+: Look up host names of connecting clients, used for reporting, in a separate
+  thread (*async*, the default), while the client waits (*sync*), or not at all
+  (*off*). Names are cached for a while, and until a name is known, the client is
+  reported only by its address.
+
+**\--timeout-first** *SECONDS*
+: Drop a network client which sends no text in *SECONDS* after connecting.
+
+**\--timeout-idle** *SECONDS*
+: Drop a network client which sends no more text for *SECONDS*.
+
+**\--timeout-job** *SECONDS*
+: Drop a network client which doesn't finish sending its text in *SECONDS*
+  after connecting.
+
+  A dropped client is told so, and its text is discarded (except for any part,
+  already printed with **\--stream** or **\--passthrough**). By default, clients
+  are waited for indefinitely, so a single stalled client may hold up others
+  that aren't served at once.
 
 **-l**, **\--limit** *NUMBER*
 : If running as a network server, limit number of received bytes to *NUMBER*.
@@ -78,6 +210,48 @@ m4_include(common05-variables.md)m4_dnl
 : If limit is active, cut text on *NUMBER* count instead of
   discarding the whole chunk.
 
+  Text is never read more than a byte past the limit. If the limit is active,
+  a client may also announce the length of its text with a first line of
+  **COPRIS LENGTH** *BYTES*, which isn't printed. If the announced length is
+  over the limit, the text is refused before any of it is read. Text, sent past
+  the announced length, is cut off or discarded just like text over the limit.
+  Without a limit, or with **\--passthrough**, this line isn't looked for.
+
+**\--rate** *RATE*
+: Receive at most *RATE* bytes per second from each network client address,
+  with connections from the same address sharing the rate. Clients over it
+  are read from only as fast as the rate allows, and the rest of their text
+  waits on their side, instead of in COPRIS' memory. With **\--listeners**,
+  each process keeps its own rates.
+
+**\--buffer-size** *SIZE*
+: Read up to *SIZE* bytes of text at once, either from the network or from
+  standard input. Text is read directly into its buffer, which grows as needed.
+  Default size is 65536 bytes.
+
+**\--rcvbuf** *SIZE*
+: Set the receive buffer of the network socket to *SIZE* bytes, instead of the
+  system default. The kernel may adjust the actual value.
+
+**\--stream**
+: Convert and print text while it's still being received, instead of waiting
+  for the whole text first. Only an unfinished line is held back, and a line,
+  longer than 64 KiB, is printed in parts. If running as a daemon, clients are
+  served one after another, and worker threads are not used. A limit always
+  cuts text off, since printed text can't be discarded.
+
+**\--flush** *POLICY*
+: If streaming text, flush output after each received chunk (*chunk*, the
+  default), after each line (*line*), or only once the whole text has been
+  printed (*end*).
+
+**\--passthrough**
+: If neither encoding nor printer feature files are used, move text received
+  from the network straight to the output file with **splice**(2), without
+  copying it through COPRIS. Meant for jobs, already prepared for the printer.
+  An output file is required. As with **\--stream**, clients are served one
+  after another, and a limit always cuts text off.
+
 **-v**, **\--verbose**
 : Show informative status messages. If specified twice, show even more messages.
 
@@ -92,10 +266,23 @@ m4_include(common05-variables.md)m4_dnl
 **-V**, **\--version**
 : Show program version, author and build-time options.
 
-Do not specify a port number if you want to read from standard input. Likewise,
+If COPRIS is started by a service manager with a listening socket already
+passed to it (following the **LISTEN_FDS** convention, as used by
+**systemd.socket**(5)), it accepts connections on that socket, and any port
+number or socket path is ignored. COPRIS may thus be started only once the first
+client connects.
+
+Do not specify a port number or socket path if you want to read from standard input. Likewise,
 omit the output file to have text echoed out to standard output (or piped
 elsewhere).
 
+The output file is opened once and kept open for all following texts, since
+opening and closing a printer device may be slow, or even reset the printer.
+Regular files are appended to, instead of being overwritten. If writing fails,
+the file is reopened for the next text. Send COPRIS the **SIGHUP** signal to
+have it reopen the file before the next text, e.g. after a log rotation or
+after the printer has been reconnected.
+
 
 # EXAMPLES OF INVOKING COPRIS
 
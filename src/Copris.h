@@ -9,19 +9,78 @@
 #define HAS_FEATURES     (1 << 2)
 #define MUST_CUTOFF      (1 << 3)
 #define ENCODING_NO_STOP (1 << 4)
+#define STREAM_TEXT      (1 << 5)
+#define PASSTHROUGH      (1 << 6)
+
+typedef enum flush {
+	FLUSH_CHUNK, /* Flush streamed text after each received chunk */
+	FLUSH_LINE,  /* Flush streamed text after each line           */
+	FLUSH_END    /* Flush streamed text only when it ends         */
+} flush_t;
+
+typedef enum resolve {
+	RESOLVE_ASYNC, /* Look up client host names in a separate thread */
+	RESOLVE_SYNC,  /* Look up client host names while clients wait   */
+	RESOLVE_OFF    /* Don't look up client host names                */
+} resolve_t;
+
+typedef enum timeout {
+	TIMEOUT_NONE,  /* Client met all deadlines                             */
+	TIMEOUT_FIRST, /* No text arrived in time after connecting             */
+	TIMEOUT_IDLE,  /* No text arrived in time after the previous chunk     */
+	TIMEOUT_TOTAL  /* Whole text didn't arrive in time after connecting    */
+} timeout_t;
+
+typedef enum balance {
+	BALANCE_FREE,       /* Next job goes to the first printer that is free */
+	BALANCE_ROUND_ROBIN /* Printers take jobs in turn                      */
+} balance_t;
+
+typedef enum priority {
+	PRIORITY_HIGH,   /* Printed before any other waiting texts   */
+	PRIORITY_NORMAL, /* Printed in turn                          */
+	PRIORITY_LOW,    /* Printed once no other texts are waiting  */
+	PRIORITY_COUNT
+} priority_t;
 
 struct Attribs {
 	unsigned int portno; /* Listening port of this server                        */
+	int backlog;         /* Maximum number of pending connections                */
+	int address_family;  /* AF_INET, AF_INET6 or AF_UNSPEC (both, dual-stack)    */
+	int listeners;       /* Number of listener processes, sharing the port       */
+	char *socket_path;   /* Path of a Unix domain socket (NULL - use the port)   */
+	int inherited_fd;    /* Socket, passed by the service manager (-1 - none)    */
 	bool daemon;         /* True if COPRIS runs continuously                     */
+	int workers;         /* Number of conversion threads (0 - convert in main)   */
+	int recode_threads;  /* Threads, recoding a single text (1 - don't split it) */
+	int spool_jobs;      /* Jobs, waiting for the writer thread (0 - no thread)  */
+	size_t spool_size;   /* Bytes, waiting for the writer thread (0 - no limit)  */
+	char *spool_dir;     /* Directory for spooled texts (NULL - keep in memory)  */
+	priority_t priority; /* Priority of texts without one in their modeline      */
 	size_t limitnum;     /* Maximum allowed number of received bytes             */
+	size_t rate;         /* Bytes per second, allowed to a client (0 - no limit) */
+	size_t bufsize;      /* Number of bytes to read from input at once           */
+	int rcvbuf;          /* Socket receive buffer size (0 - system default)      */
+	resolve_t resolve;   /* How to look up host names of clients                 */
+	int timeout_first;   /* Seconds to wait for the first chunk (0 - forever)    */
+	int timeout_idle;    /* Seconds to wait for each next chunk (0 - forever)    */
+	int timeout_total;   /* Seconds to wait for the whole text (0 - forever)     */
 
 	char *encoding_files[NUM_OF_INPUT_FILES]; /* Names of encoding files         */
 	int encoding_file_count;                  /* Number of encoding file names   */
+	char *encoding_cache;                     /* Directory for compiled encodings */
+	char *recode_stats;                       /* File for recoding statistics    */
 	char *feature_files[NUM_OF_INPUT_FILES];  /* Names of printer feature files  */
 	int feature_file_count;                   /* Number of feature file names    */
 
 	int copris_flags;    /* Flags regarding user-specified arguments             */
+	flush_t flush;       /* When to flush output, if streaming text              */
 	char *output_file;   /* Name of output file/device                           */
+
+	char *output_files[MAX_OUTPUTS]; /* Names of all output files (printer pool) */
+	int output_count;                /* Number of output files                   */
+	balance_t balance;   /* How jobs are spread among the printer pool           */
+	int output_timeout;  /* Seconds a printer may accept no text (0 - forever)   */
 };
 
 struct Stats {
@@ -29,10 +88,12 @@ struct Stats {
 	size_t sum;             // Sum of all read (received) bytes
 	bool size_limit_active;
 	size_t discarded;       // Discarded number of bytes, if limit is set
+	timeout_t timed_out;    // Deadline, missed by the client
+	size_t announced;       // Bytes announced by a length header (with it), 0 if none
 };
 
 static const struct Stats STATS_INIT = {
-	0, 0, false, 0
+	0, 0, false, 0, TIMEOUT_NONE, 0
 };
 
 struct Inifile {
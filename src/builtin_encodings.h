@@ -0,0 +1,18 @@
+/*
+ * Encoding files, shipped in 'encodings/', are compiled into COPRIS at build time by
+ * 'compile_encodings' (see 'compile_encodings.c'), which generates 'builtin_encodings.c'.
+ * They are selected by name with a prefix, e.g. '-e builtin:cp852'.
+ */
+
+#define BUILTIN_PREFIX "builtin:"
+
+#define IS_BUILTIN(name) (strncmp(name, BUILTIN_PREFIX, strlen(BUILTIN_PREFIX)) == 0)
+
+struct Builtin_encoding {
+	const char *name;           /* Encoding file name without '.ini' */
+	const unsigned char *image; /* Compiled table                     */
+	size_t size;                /* Size of the table in bytes         */
+};
+
+extern const struct Builtin_encoding builtin_encodings[];
+extern const int builtin_encoding_count;
@@ -0,0 +1,141 @@
+/*
+ * Compiling encoding files into COPRIS at build time
+ *
+ * This is a build tool, not part of COPRIS itself. Usage:
+ *   compile_encodings OUTPUT FILE...
+ * It loads each encoding FILE, compiles it into the table recode.c uses, and writes the
+ * tables as C source to OUTPUT, which is built into COPRIS as 'builtin_encodings.c'.
+ * Each FILE is compiled on its own, and named after its file name without '.ini'.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "recode.h"
+#include "builtin_encodings.h"
+
+static int print_encoding(FILE *output, int number, const char *filename);
+
+// Only errors are shown
+int verbosity = 1;
+
+// COPRIS is linked with the generated tables instead
+const struct Builtin_encoding builtin_encodings[] = { { NULL, NULL, 0 } };
+const int builtin_encoding_count = 0;
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		PRINT_ERROR_MSG("Usage: %s OUTPUT [FILE]...", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *output = fopen(argv[1], "w");
+	if (output == NULL) {
+		PRINT_SYSTEM_ERROR("fopen", "Failed to create '%s'.", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(output, "/*\n"
+	        " * Encodings, built into COPRIS. Generated by 'compile_encodings' from encoding\n"
+	        " * files in 'encodings/'; don't edit.\n"
+	        " */\n"
+	        "\n"
+	        "#include <stddef.h>\n"
+	        "#include <string.h>\n"
+	        "\n"
+	        "#include \"builtin_encodings.h\"\n");
+
+	for (int i = 2; i < argc; i++) {
+		if (print_encoding(output, i - 2, argv[i]) != 0) {
+			fclose(output);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fprintf(output, "\nconst struct Builtin_encoding builtin_encodings[] = {\n");
+
+	for (int i = 2; i < argc; i++) {
+		char *path = strdup(argv[i]);
+		CHECK_MALLOC(path);
+
+		char *name = basename(path);
+		char *extension = strrchr(name, '.');
+		if (extension != NULL && strcmp(extension, ".ini") == 0)
+			*extension = '\0';
+
+		fprintf(output, "\t{ \"%s\", encoding_%d, sizeof encoding_%d },\n",
+		        name, i - 2, i - 2);
+		free(path);
+	}
+
+	// An empty list still needs an element
+	if (argc == 2)
+		fprintf(output, "\t{ NULL, NULL, 0 }\n");
+
+	fprintf(output, "};\n\nconst int builtin_encoding_count = %d;\n", argc - 2);
+
+	if (fclose(output) != 0) {
+		PRINT_SYSTEM_ERROR("fclose", "Failed to write '%s'.", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Compile encoding file 'filename' and print its table to 'output' as array
+// 'encoding_<number>'.
+// Return 0 on success.
+static int print_encoding(FILE *output, int number, const char *filename)
+{
+	struct Inifile *encoding = NULL;
+	int error = load_encoding_file(filename, &encoding);
+	if (error)
+		return error;
+
+	char *image = NULL;
+	size_t size = 0;
+
+	FILE *memory = open_memstream(&image, &size);
+	if (memory == NULL) {
+		PRINT_SYSTEM_ERROR("open_memstream", "Failed to compile encoding file '%s'.",
+		                   filename);
+		unload_encoding_definitions(&encoding);
+		return -1;
+	}
+
+	error = save_encoding_image(memory, 0);
+	error |= fclose(memory);
+	unload_encoding_definitions(&encoding);
+
+	if (error) {
+		PRINT_ERROR_MSG("Failed to compile encoding file '%s'.", filename);
+		free(image);
+		return -1;
+	}
+
+	// The table is read in place, so it's aligned like its 64-bit header fields
+	fprintf(output, "\n// %s\n"
+	        "static _Alignas(8) const unsigned char encoding_%d[] = {", filename, number);
+
+	for (size_t i = 0; i < size; i++)
+		fprintf(output, "%s0x%02X,", (i % 12 == 0) ? "\n\t" : " ", (unsigned char)image[i]);
+
+	fprintf(output, "\n};\n");
+	free(image);
+
+	return 0;
+}
@@ -9,9 +9,119 @@
 // To enable this feature, comment-out or remove the following line:
 #define DISABLE_WHITESPACE_CODE_BLOCK
 
-// Inbound text buffer size
+// Default number of bytes, read from input at once
+// (can be overridden with '--buffer-size')
 #ifndef BUFSIZE
-#   define BUFSIZE 128
+#   define BUFSIZE 65536
+#endif
+
+// Maximum number of bytes, read from input at once
+#ifndef MAX_BUFSIZE
+#   define MAX_BUFSIZE (64 * 1024 * 1024)
+#endif
+
+// Maximum number of seconds for any of the client deadlines
+// (set with '--timeout-first', '--timeout-idle' and '--timeout-job')
+#ifndef MAX_TIMEOUT
+#   define MAX_TIMEOUT 86400
+#endif
+
+// Default number of pending connections the server will queue
+// (can be overridden with '--backlog')
+#ifndef BACKLOG
+#   define BACKLOG 16
+#endif
+
+// Maximum number of events, handled in one iteration of the daemon's event loop
+#ifndef MAX_EVENTS
+#   define MAX_EVENTS 32
+#endif
+
+// Maximum number of listener processes, sharing the same port
+// (their number is set with '--listeners')
+#ifndef MAX_LISTENERS
+#   define MAX_LISTENERS 64
+#endif
+
+// Maximum number of worker threads for converting received text
+// (their number is set with '--workers')
+#ifndef MAX_WORKERS
+#   define MAX_WORKERS 64
+#endif
+
+// Default number of bytes, waiting in a daemon's spool for the writer thread
+// (can be overridden with '--spool-size'; the spool itself is enabled with '--spool-jobs')
+#ifndef SPOOL_SIZE
+#   define SPOOL_SIZE (16 * 1024 * 1024)
+#endif
+
+// Maximum number of jobs, waiting in the spool
+#ifndef MAX_SPOOL_JOBS
+#   define MAX_SPOOL_JOBS 4096
+#endif
+
+// Maximum number of output files (a pool of printers), written at once
+#ifndef MAX_OUTPUTS
+#   define MAX_OUTPUTS 8
+#endif
+
+// Number of seconds a printer of the pool sits out after failing, before it's tried again
+#ifndef POOL_RETRY
+#   define POOL_RETRY 60
+#endif
+
+// Number of bytes each client may have printed in its turn, when several clients'
+// jobs of the same priority are waiting in the spool
+#ifndef SPOOL_QUANTUM
+#   define SPOOL_QUANTUM (16 * 1024)
+#endif
+
+// Number of seconds a client's host name is cached, before it is looked up again
+#ifndef RESOLVE_TTL
+#   define RESOLVE_TTL 300
+#endif
+
+// Maximum number of cached client host names
+#ifndef RESOLVE_CACHE_SIZE
+#   define RESOLVE_CACHE_SIZE 256
+#endif
+
+// Maximum number of client addresses, tracked for '--rate'
+#ifndef RATELIMIT_TABLE_SIZE
+#   define RATELIMIT_TABLE_SIZE 256
+#endif
+
+// Maximum number of threads, recoding parts of a single text
+// (their number is set with '--recode-threads')
+#ifndef MAX_RECODE_THREADS
+#   define MAX_RECODE_THREADS 64
+#endif
+
+// Smallest part of a text, worth recoding in a thread of its own
+#ifndef RECODE_PART_MIN
+#   define RECODE_PART_MIN (1024 * 1024)
+#endif
+
+// Number of most frequent characters without a definition, reported with '-vv'
+#ifndef RECODE_TOP_UNMAPPED
+#   define RECODE_TOP_UNMAPPED 10
+#endif
+
+// Seconds to keep counting recoded texts before writing '--recode-stats' file again
+#ifndef RECODE_STATS_INTERVAL
+#   define RECODE_STATS_INTERVAL 10
+#endif
+
+// Maximum number of bytes of an unfinished line, held back while streaming text; a longer
+// line is converted and printed in parts
+#ifndef MAX_STREAM_LINE
+#   define MAX_STREAM_LINE (64 * 1024)
+#endif
+
+// Number of bytes of received text, converted at once by all stages, so that text
+// between them stays in the CPU cache (blocks are extended to a whole line)
+#ifndef CONVERT_BLOCK
+#   define CONVERT_BLOCK (64 * 1024)
 #endif
 
 // Maximum lengths of name and value strings in .ini files
@@ -28,3 +138,8 @@
 // Symbols for variable detection
 #define VAR_SYMBOL     '$'
 #define VAR_COMMENT    '#'
+
+// Optional first line of received text, announcing its length in bytes, so that
+// a text over the limit can be refused before it is read
+#define LENGTH_HEADER     "COPRIS LENGTH "
+#define LENGTH_HEADER_MAX 64
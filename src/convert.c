@@ -0,0 +1,255 @@
+/*
+ * Conversion stages, applied to each received text
+ *
+ * With a printer feature file, text passes through several stages (the modeline,
+ * variables, Markdown, session commands and recoding). Instead of having each stage
+ * produce the whole text anew for the next one, text is converted in blocks, each
+ * passing through all stages while it's still in the CPU cache.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'memrchr'
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "convert.h"
+#include "socket_io.h"
+#include "recode.h"
+#include "feature.h"
+#include "markdown.h"
+#include "parse_vars.h"
+#include "utstring_cut.h"
+
+static int convert_blocks(UT_string *copris_text, struct Inifile **encoding,
+                          struct Inifile **features);
+
+int convert_text(UT_string *copris_text, struct Attribs *attrib,
+                 struct Inifile **encoding, struct Inifile **features)
+{
+	// Text without a printer feature file is only recoded, which is a single pass already
+	if (!(attrib->copris_flags & HAS_FEATURES))
+		return convert_text_staged(copris_text, attrib, encoding, features);
+
+	// Big texts are recoded in parts by several threads, after the other stages. These
+	// are still run in blocks, so that neither the modeline nor session commands move
+	// the whole text.
+	bool in_parts = (attrib->copris_flags & HAS_ENCODING) &&
+	                recode_in_parts(utstring_len(copris_text));
+
+	int error = convert_blocks(copris_text, ((attrib->copris_flags & HAS_ENCODING) &&
+	                           !in_parts) ? encoding : NULL, features);
+
+	if (in_parts)
+		error = recode_text(copris_text, encoding);
+
+	// Report an error only if user hasn't forced recoding
+	if (error && !(attrib->copris_flags & ENCODING_NO_STOP))
+		return 1;
+
+	return 0;
+}
+
+int convert_text_staged(UT_string *copris_text, struct Attribs *attrib,
+                        struct Inifile **encoding, struct Inifile **features)
+{
+	// Stage 2: Handle variables, session commands and Markdown with a printer feature file
+	if (attrib->copris_flags & HAS_FEATURES) {
+		modeline_t modeline = NO_MODELINE;
+
+		// Check for the modeline at the beginning of text, which enables variable reading
+		modeline = parse_modeline(copris_text);
+		apply_modeline(copris_text, modeline);
+
+		if (modeline & ML_ENABLE_VAR)
+			parse_variables(copris_text, features);
+
+		if (!(modeline & ML_DISABLE_MD))
+			parse_markdown(copris_text, features);
+
+		apply_session_commands(copris_text, features, SESSION_PRINT);
+	}
+
+	// Stage 3: Recode text with an encoding file
+	if (attrib->copris_flags & HAS_ENCODING) {
+		int error = recode_text(copris_text, encoding);
+
+		// Report an error only if user hasn't forced recoding
+		if (error && !(attrib->copris_flags & ENCODING_NO_STOP))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Run stages 2 and 3 on 'copris_text' a block of CONVERT_BLOCK bytes at a time, passing
+ * each block through all of them before the next one, so that the text is read once,
+ * and its converted text is written once. Only what a stage can't convert yet (the end
+ * of a line for Markdown, or a character for recoding) waits for the next block. Text
+ * isn't recoded if 'encoding' is NULL.
+ * Return nonzero if text contained characters, not present in 'encoding'.
+ */
+static int convert_blocks(UT_string *copris_text, struct Inifile **encoding,
+                          struct Inifile **features)
+{
+	const char *text = utstring_body(copris_text);
+	size_t text_len = utstring_len(copris_text);
+
+	// Check for the modeline at the beginning of text, which enables variable reading
+	modeline_t modeline = parse_modeline(copris_text);
+	size_t i = check_modeline(text, text_len, modeline);
+
+	bool parse_vars = (modeline & ML_ENABLE_VAR);
+	bool parse_md   = !(modeline & ML_DISABLE_MD);
+
+	UT_string *converted_text; // Text, ready to be printed
+	utstring_new(converted_text);
+	utstring_reserve(converted_text, text_len);
+
+	// Without recoding, stage 2 writes straight into converted text
+	UT_string *formatted_text = converted_text;
+	struct Recode_pieces *recoding = NULL;
+
+	if (encoding != NULL) {
+		utstring_new(formatted_text);
+		utstring_reserve(formatted_text, CONVERT_BLOCK);
+		recoding = recode_begin();
+	}
+
+	UT_string *segment;       // Block with variables parsed
+	UT_string *markdown_rest; // Text, not yet parsed by the Markdown parser
+	utstring_new(segment);
+	utstring_new(markdown_rest);
+
+	struct Markdown_state markdown;
+	markdown_init(&markdown);
+	int variables_state = 0;
+
+	apply_session_commands(formatted_text, features, SESSION_BEFORE_TEXT);
+
+	bool last;
+	do {
+		// Variables and Markdown are parsed a whole line at a time
+		size_t block_len = text_len - i;
+
+		if (block_len > CONVERT_BLOCK) {
+			const char *newline = memrchr(&text[i], '\n', CONVERT_BLOCK);
+			if (newline == NULL)
+				newline = memchr(&text[i + CONVERT_BLOCK], '\n', block_len - CONVERT_BLOCK);
+
+			if (newline != NULL)
+				block_len = (size_t)(newline - &text[i]) + 1;
+		}
+
+		last = (i + block_len == text_len);
+
+		const char *block = &text[i];
+		i += block_len;
+
+		// Stage 2: Handle variables, session commands and Markdown
+		if (parse_vars) {
+			utstring_clear(segment);
+			utstring_bincpy(segment, block, block_len);
+			parse_variables_chunk(segment, features, &variables_state);
+
+			block = utstring_body(segment);
+			block_len = utstring_len(segment);
+		}
+
+		if (parse_md) {
+			// Continue after text that the parser held back from the previous block
+			const char *md_text = block;
+			size_t md_len = block_len;
+
+			if (utstring_len(markdown_rest) > 0) {
+				utstring_bincpy(markdown_rest, block, block_len);
+				md_text = utstring_body(markdown_rest);
+				md_len = utstring_len(markdown_rest);
+			}
+
+			size_t available_len = md_len;
+
+			// A comment variable also removes its new line, so search for the last one again
+			if (!last) {
+				const char *newline = memrchr(md_text, '\n', md_len);
+				md_len = newline ? (size_t)(newline - md_text) + 1 : 0;
+			}
+
+			size_t parsed_len = parse_markdown_chunk(&markdown, md_text, md_len, last,
+			                                         formatted_text, features);
+
+			if (md_text == utstring_body(markdown_rest)) {
+				utstring_shift(markdown_rest, parsed_len);
+			} else {
+				utstring_bincpy(markdown_rest, &md_text[parsed_len],
+				                available_len - parsed_len);
+			}
+
+			if (last)
+				markdown_finish(&markdown, formatted_text, features);
+		} else {
+			utstring_bincpy(formatted_text, block, block_len);
+		}
+
+		if (last)
+			apply_session_commands(formatted_text, features, SESSION_AFTER_TEXT);
+
+		// Stage 3: Recode text with an encoding file, except for a character that may
+		// go on in the next block
+		if (recoding != NULL) {
+			size_t recoded_len = recode_piece(recoding, converted_text,
+			                                  utstring_body(formatted_text),
+			                                  utstring_len(formatted_text), last, encoding);
+			utstring_shift(formatted_text, recoded_len);
+		}
+	} while (!last);
+
+	int error = 0;
+
+	if (recoding != NULL) {
+		error = recode_end(recoding);
+		utstring_free(formatted_text);
+	}
+
+	utstring_free(segment);
+	utstring_free(markdown_rest);
+
+	// Replace input text, and free it along with the temporary string
+	utstring_swap(copris_text, converted_text);
+	utstring_free(converted_text);
+
+	return error;
+}
+
+int report_missing_characters(int childfd)
+{
+	const char error_msg[] =
+	        "One or more multi-byte characters, not handled by "
+	        "encoding file(s), were received. If this is the intended "
+	        "behaviour, run COPRIS with --ignore-missing.";
+
+	if (verbosity) {
+		if (childfd != -1)
+			send_to_socket(childfd, error_msg);
+
+		PRINT_MSG("%s", error_msg);
+		return -1;
+	}
+
+	PRINT_NOTE(error_msg);
+	return 0;
+}
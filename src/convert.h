@@ -0,0 +1,23 @@
+/*
+ * Run stages 2 and 3 on 'copris_text': process the modeline, variables, Markdown and
+ * session commands with 'features', and recode text with 'encoding', according to
+ * user-specified arguments in 'attrib'.
+ * Return 0 on success, or 1 if text contained characters, not present in 'encoding',
+ * and the user hasn't forced recoding.
+ */
+int convert_text(UT_string *copris_text, struct Attribs *attrib,
+                 struct Inifile **encoding, struct Inifile **features);
+
+/*
+ * Run stages 2 and 3 like convert_text() does, but one after another, each over the
+ * whole text. Used for texts without a printer feature file, which are only recoded.
+ */
+int convert_text_staged(UT_string *copris_text, struct Attribs *attrib,
+                        struct Inifile **encoding, struct Inifile **features);
+
+/*
+ * Tell the user (and the client on socket 'childfd', if it isn't -1) that
+ * received text contained characters, not handled by encoding files.
+ * Return nonzero if COPRIS should terminate.
+ */
+int report_missing_characters(int childfd);
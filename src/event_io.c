@@ -0,0 +1,437 @@
+/*
+ * Event-driven (epoll) server for receiving text from multiple clients at once
+ *
+ * In daemon mode, connections are accepted and read as their data arrives, so
+ * one slow or idle client cannot stall the others. Text of each connection is
+ * collected separately, and handed over to the caller once the client finishes.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'accept4'
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <uthash.h>   /* uthash library - hash table      */
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "socket_io.h"
+#include "event_io.h"
+#include "resolver.h"
+#include "ratelimit.h"
+#include "utstring_cut.h"
+
+struct Connection {
+	int fd;                                /* Child socket (hash key)           */
+	UT_string *text;                       /* Text, received so far             */
+	struct Stats stats;                    /* Statistics of this connection     */
+	char host_info[HOST_INFO_LENGTH];      /* Client's host name                */
+	char host_address[HOST_INFO_LENGTH];   /* Client's address                  */
+	long long connected;                   /* Time of connecting (monotonic_ms) */
+	long long last_read;                   /* Time of last received text        */
+	long long resume_at;                   /* End of pause, if sending too fast */
+	bool header_checked;                   /* Length header has been looked for */
+	struct Connection *next;               /* Next finished connection in queue */
+	UT_hash_handle hh;
+};
+
+static int accept_connections(int parentfd);
+static int read_from_connection(struct Connection *conn, struct Attribs *attrib);
+static void finish_connection(struct Connection *conn);
+static void drop_connection(struct Connection *conn);
+static int check_connections(struct Attribs *attrib);
+static bool is_readable(int fd);
+
+static int epollfd = -1;
+static int wake_fd = -1;                        // Wakes up the loop without a connection
+static struct Connection *connections = NULL;   // Connections, still being read
+static struct Connection *finished_head = NULL; // Queue of connections with complete
+static struct Connection *finished_tail = NULL; // text, in order of completion
+
+int copris_event_init(int parentfd, int wakefd)
+{
+	// All pending connections are accepted at once, until the socket would block
+	int flags = fcntl(parentfd, F_GETFL);
+	if (flags == -1 || fcntl(parentfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		PRINT_SYSTEM_ERROR("fcntl", "Failed to make socket non-blocking.");
+		return -1;
+	}
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd == -1) {
+		PRINT_SYSTEM_ERROR("epoll_create1", "Failed to create event queue.");
+		return -1;
+	}
+
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = parentfd };
+
+	int tmperr = epoll_ctl(epollfd, EPOLL_CTL_ADD, parentfd, &event);
+	if (tmperr != 0) {
+		PRINT_SYSTEM_ERROR("epoll_ctl", "Failed to register socket with the event queue.");
+		return -1;
+	}
+
+	if (wakefd != -1) {
+		event.data.fd = wakefd;
+
+		tmperr = epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &event);
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("epoll_ctl", "Failed to register descriptor with the "
+			                                "event queue.");
+			return -1;
+		}
+
+		wake_fd = wakefd;
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Event queue created.");
+
+	return 0;
+}
+
+int copris_handle_events(UT_string *copris_text, int parentfd, int *childfd,
+                         struct Attribs *attrib)
+{
+	struct epoll_event events[MAX_EVENTS];
+	bool woken = false;
+
+	// Wait until at least one client has finished sending its text
+	while (finished_head == NULL && !woken) {
+		// Wake up in time for the nearest client's deadline, or end of its pause
+		int wait_time = check_connections(attrib);
+		int event_count = epoll_wait(epollfd, events, MAX_EVENTS, wait_time);
+
+		if (event_count == -1) {
+			if (errno == EINTR)
+				continue;
+
+			PRINT_SYSTEM_ERROR("epoll_wait", "Failed waiting for events.");
+			return -1;
+		}
+
+		for (int i = 0; i < event_count; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == parentfd) {
+				int error = accept_connections(parentfd);
+				if (error)
+					return -1;
+
+				continue;
+			}
+
+			if (fd == wake_fd) {
+				// Reset the counter, the caller checks what has happened
+				uint64_t count;
+				if (read(fd, &count, sizeof count) == -1 && errno != EAGAIN) {
+					PRINT_SYSTEM_ERROR("read", "Failed reading from wake-up descriptor.");
+					return -1;
+				}
+
+				woken = true;
+				continue;
+			}
+
+			struct Connection *conn;
+			HASH_FIND_INT(connections, &fd, conn);
+			assert(conn != NULL);
+
+			int status = read_from_connection(conn, attrib);
+			if (status > 0)
+				finish_connection(conn);
+			else if (status < 0)
+				drop_connection(conn);
+		}
+	}
+
+	// Woken up without any text
+	if (finished_head == NULL) {
+		*childfd = -1;
+		return 0;
+	}
+
+	// Hand the oldest finished text over to the caller
+	struct Connection *conn = finished_head;
+	finished_head = conn->next;
+	if (finished_head == NULL)
+		finished_tail = NULL;
+
+	print_end_of_stream(&conn->stats, attrib);
+
+	// Host name may have been resolved while the text was being received
+	resolver_cached_name(conn->host_address, conn->host_info);
+
+	if (LOG_INFO)
+		PRINT_MSG("Connection from %s (%s) closed.", conn->host_info, conn->host_address);
+
+	utstring_concat(copris_text, conn->text);
+	*childfd = conn->fd;
+
+	utstring_free(conn->text);
+	free(conn);
+
+	return 0;
+}
+
+bool copris_event_pending(void)
+{
+	return finished_head != NULL;
+}
+
+void copris_event_close(void)
+{
+	struct Connection *conn;
+	struct Connection *tmp;
+
+	HASH_ITER(hh, connections, conn, tmp) {
+		drop_connection(conn);
+	}
+
+	while (finished_head != NULL) {
+		conn = finished_head;
+		finished_head = conn->next;
+
+		close_socket(conn->fd, "child");
+		utstring_free(conn->text);
+		free(conn);
+	}
+
+	finished_tail = NULL;
+
+	if (epollfd != -1) {
+		close(epollfd);
+		epollfd = -1;
+	}
+
+	wake_fd = -1;
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Event queue closed.");
+}
+
+// Accept all pending connections and register them with the event queue
+static int accept_connections(int parentfd)
+{
+	for (;;) {
+		struct sockaddr_storage clientaddr;
+		socklen_t clientlen = sizeof(clientaddr);
+
+		int childfd = accept4(parentfd, (struct sockaddr *)&clientaddr, &clientlen,
+		                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (childfd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0; /* No more pending connections */
+
+			// Client gave up before being accepted, or we're out of descriptors.
+			// Either way, that shouldn't bring down other connections.
+			if (errno == ECONNABORTED || errno == EMFILE || errno == ENFILE ||
+			    errno == EINTR || errno == EPROTO) {
+				PRINT_SYSTEM_ERROR("accept4", "Failed to accept a connection.");
+				return 0;
+			}
+
+			PRINT_SYSTEM_ERROR("accept4", "Failed to accept the connection.");
+			return -1;
+		}
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Connection to socket accepted.");
+
+		struct Connection *conn = malloc(sizeof *conn);
+		CHECK_MALLOC(conn);
+
+		conn->fd    = childfd;
+		conn->stats = STATS_INIT;
+		conn->next  = NULL;
+		conn->connected = monotonic_ms();
+		conn->last_read = 0;
+		conn->resume_at = 0;
+		conn->header_checked = false;
+		utstring_new(conn->text);
+
+		get_client_info(&clientaddr, clientlen, conn->host_info, conn->host_address);
+
+		struct epoll_event event = { .events = EPOLLIN, .data.fd = childfd };
+
+		int tmperr = epoll_ctl(epollfd, EPOLL_CTL_ADD, childfd, &event);
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("epoll_ctl", "Failed to register connection with the "
+			                                "event queue.");
+			close_socket(childfd, "child");
+			utstring_free(conn->text);
+			free(conn);
+			continue;
+		}
+
+		HASH_ADD_INT(connections, fd, conn);
+	}
+}
+
+/*
+ * Read one chunk of available text from a connection.
+ * Return 0 if more text is expected, 1 if the client has finished (or has exceeded
+ * the byte limit) and -1 on a read error.
+ */
+static int read_from_connection(struct Connection *conn, struct Attribs *attrib)
+{
+	// Client, sending too fast, isn't read from until its allowance grows again
+	int rate_wait;
+	size_t length = ratelimit_allowance(conn->host_address, read_size(&conn->stats, attrib),
+	                                    &rate_wait);
+	if (length == 0) {
+		// Hangups and errors are reported even without any events asked for, so the
+		// connection leaves the event queue altogether until its pause is over
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		conn->resume_at = monotonic_ms() + rate_wait;
+
+		return 0;
+	}
+
+	// Read straight into the end of connection's text
+	utstring_reserve_tail(conn->text, length);
+	ssize_t buffer_length = read(conn->fd, utstring_tail(conn->text), length);
+
+	if (buffer_length == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+
+		PRINT_SYSTEM_ERROR("read", "Error reading from socket of %s (%s).",
+		                   conn->host_info, conn->host_address);
+		return -1;
+	}
+
+	if (buffer_length == 0)
+		return 1; /* End of stream */
+
+	utstring_extend(conn->text, buffer_length);
+	conn->last_read = monotonic_ms();
+	ratelimit_consume(conn->host_address, buffer_length);
+
+	conn->stats.chunks++;
+	conn->stats.sum += buffer_length;
+
+	// A job, announced to be over the limit, is refused before reading any of it
+	if (!conn->header_checked &&
+	    check_length_header(conn->text, conn->fd, &conn->header_checked,
+	                        &conn->stats, attrib) != 0)
+		return 1;
+
+	// Check if length of received text went over the limit (if limit is active)
+	size_t limit = byte_limit(&conn->stats, attrib);
+	if (limit && conn->stats.sum > limit) {
+		apply_byte_limit(conn->text, conn->fd, &conn->stats, attrib);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Stop watching a connection and put it in the queue of finished ones
+static void finish_connection(struct Connection *conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	HASH_DEL(connections, conn);
+
+	if (finished_tail == NULL)
+		finished_head = conn;
+	else
+		finished_tail->next = conn;
+
+	finished_tail = conn;
+}
+
+// Forget about a connection and close it, discarding any received text
+static void drop_connection(struct Connection *conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	HASH_DEL(connections, conn);
+
+	resolver_cached_name(conn->host_address, conn->host_info);
+
+	if (LOG_INFO)
+		PRINT_MSG("Dropping connection from %s (%s).", conn->host_info, conn->host_address);
+
+	close_socket(conn->fd, "child");
+	utstring_free(conn->text);
+	free(conn);
+}
+
+/*
+ * Resume paused connections whose pause is over, and drop those whose clients have
+ * missed any of their deadlines, so they can't hold on to their sockets (and memory)
+ * forever.
+ * Return number of milliseconds until the nearest remaining deadline or end of pause,
+ * or -1 if none.
+ */
+static int check_connections(struct Attribs *attrib)
+{
+	if (!attrib->timeout_first && !attrib->timeout_idle && !attrib->timeout_total &&
+	    !attrib->rate)
+		return -1;
+
+	int nearest = -1;
+	struct Connection *conn;
+	struct Connection *tmp;
+	long long now = monotonic_ms();
+
+	HASH_ITER(hh, connections, conn, tmp) {
+		if (conn->resume_at && conn->resume_at <= now) {
+			struct epoll_event event = { .events = EPOLLIN, .data.fd = conn->fd };
+			epoll_ctl(epollfd, EPOLL_CTL_ADD, conn->fd, &event);
+
+			// Time spent paused doesn't count as client's idling
+			conn->resume_at = 0;
+			if (conn->last_read)
+				conn->last_read = now;
+		} else if (conn->resume_at) {
+			int pause_left = (int)(conn->resume_at - now);
+			if (nearest == -1 || pause_left < nearest)
+				nearest = pause_left;
+		}
+
+		timeout_t deadline;
+		int wait_time = time_to_deadline(conn->connected, conn->last_read, attrib, &deadline);
+
+		// Text (or end of it), waiting in the socket, wasn't read only because the loop
+		// was held up, e.g. by a full spool. The client itself is on time.
+		if (wait_time == 0 && deadline != TIMEOUT_TOTAL && is_readable(conn->fd))
+			continue;
+
+		if (wait_time == 0) {
+			apply_timeout(conn->text, conn->fd, deadline, &conn->stats, attrib);
+			print_end_of_stream(&conn->stats, attrib);
+			drop_connection(conn);
+			continue;
+		}
+
+		if (wait_time != -1 && (nearest == -1 || wait_time < nearest))
+			nearest = wait_time;
+	}
+
+	return nearest;
+}
+
+// Check whether reading from 'fd' wouldn't block
+static bool is_readable(int fd)
+{
+	struct pollfd client = { .fd = fd, .events = POLLIN };
+	return poll(&client, 1, 0) == 1;
+}
@@ -0,0 +1,29 @@
+/*
+ * Create an event queue and register listening socket 'parentfd' with it. If 'wakefd'
+ * isn't -1, it is watched as well, and wakes up copris_handle_events() when readable.
+ * Return 0 on success.
+ */
+int copris_event_init(int parentfd, int wakefd);
+
+/*
+ * Accept and read connections on listening socket 'parentfd' as their data arrives,
+ * until any of the clients finishes sending text. Put that text into 'copris_text' and
+ * its socket into 'childfd', which the caller closes after processing. Each connection
+ * keeps its own statistics, byte limit and deadlines from 'attrib'; clients which miss
+ * a deadline are dropped. If woken up by 'wakefd' before that, return with empty
+ * 'copris_text' and 'childfd' set to -1.
+ * Return 0 on success.
+ */
+int copris_handle_events(UT_string *copris_text, int parentfd, int *childfd,
+                         struct Attribs *attrib);
+
+/*
+ * Return true if a finished text is already waiting, so copris_handle_events() would
+ * return it without waiting for clients.
+ */
+bool copris_event_pending(void);
+
+/*
+ * Close all remaining connections, discarding their text, and the event queue.
+ */
+void copris_event_close(void);
@@ -28,12 +28,15 @@
 #include "feature.h"
 #include "printer_commands.h"
 #include "parse_value.h"
+#include "utstring_cut.h"
 
 static int inih_handler(void *, const char *, const char *, const char *);
 static int validate_command_pairs(const char *, struct Inifile **);
 
 int previous_command_count = 0;
 
+struct Inifile *command_table[NUM_OF_COMMANDS];
+
 int load_printer_feature_file(const char *filename, struct Inifile **features)
 {
 	FILE *file = fopen(filename, "r");
@@ -113,9 +116,15 @@ int initialise_commands(struct Inifile **features)
 		s->out_len = 0;
 		HASH_ADD_STR(*features, in, s);
 
+		// Values are filled in place, so the command stays reachable by its ID
+		assert(i < NUM_OF_COMMANDS);
+		command_table[i] = s;
+
 		command_count++;
 	}
 
+	assert(command_count == NUM_OF_COMMANDS);
+
 	if (LOG_DEBUG)
 		PRINT_MSG("Initialised %d empty printer commands.", command_count);
 
@@ -349,24 +358,33 @@ void unload_printer_feature_commands(struct Inifile **features)
 		count++;
 	}
 
+	memset(command_table, 0, sizeof command_table);
+
 	if (LOG_DEBUG)
 		PRINT_MSG("Unloaded printer feature commands (count = %d).", count);
 }
 
 int apply_session_commands(UT_string *copris_text, struct Inifile **features, session_t state)
 {
+	(void)features;
 	struct Inifile *s;
 
 	switch(state) {
 	case SESSION_PRINT:
-		HASH_FIND_STR(*features, "S_AFTER_TEXT", s);
+		s = command_table[CMD_S_AFTER_TEXT];
 		// S_BEFORE_TEXT is handled later in this function
 		break;
 	case SESSION_STARTUP:
-		HASH_FIND_STR(*features, "S_AT_STARTUP", s);
+		s = command_table[CMD_S_AT_STARTUP];
 		break;
 	case SESSION_SHUTDOWN:
-		HASH_FIND_STR(*features, "S_AT_SHUTDOWN", s);
+		s = command_table[CMD_S_AT_SHUTDOWN];
+		break;
+	case SESSION_BEFORE_TEXT:
+		s = command_table[CMD_S_BEFORE_TEXT];
+		break;
+	case SESSION_AFTER_TEXT:
+		s = command_table[CMD_S_AFTER_TEXT];
 		break;
 	default:
 		assert(false);
@@ -379,7 +397,7 @@ int apply_session_commands(UT_string *copris_text, struct Inifile **features, se
 
 	int num_of_characters = 0; // Number of additional characters in copris_text
 
-	// Append - either when starting/closing COPRIS, or after received text was printed
+	// Append - either when starting/closing COPRIS, or before/after received text is printed
 	if (s->out_len > 0) {
 		if (LOG_INFO)
 			PRINT_MSG("Adding session command %s.", s->in);
@@ -394,25 +412,15 @@ int apply_session_commands(UT_string *copris_text, struct Inifile **features, se
 		return num_of_characters;
 
 	// Prepend before received text
-	HASH_FIND_STR(*features, "S_BEFORE_TEXT", s);
+	s = command_table[CMD_S_BEFORE_TEXT];
 	assert(s != NULL);
 
 	if (s->out_len > 0) {
 		if (LOG_INFO)
 			PRINT_MSG("Adding session command S_BEFORE_TEXT.");
 
-		UT_string *temp_text;
-		utstring_new(temp_text);
-
-		// Begin the temporary string with BEFORE_TEXT, append received text
-		utstring_bincpy(temp_text, s->out, s->out_len);
-		utstring_concat(temp_text, copris_text);
-
-		// Move temporary text to 'copris_text'
-		utstring_clear(copris_text);
-		utstring_concat(copris_text, temp_text);
-
-		utstring_free(temp_text);
+		// Move received text aside in place, and put BEFORE_TEXT in front of it
+		utstring_unshift(copris_text, s->out, s->out_len);
 
 		num_of_characters += s->out_len;
 	}
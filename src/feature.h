@@ -4,6 +4,43 @@
  */
 int load_printer_feature_file(const char *filename, struct Inifile **features);
 
+/*
+ * IDs of commands from 'printer_commands.h', listed in the same order.
+ */
+typedef enum command {
+	CMD_F_BOLD_ON,
+	CMD_F_BOLD_OFF,
+	CMD_F_ITALIC_ON,
+	CMD_F_ITALIC_OFF,
+	CMD_F_H1_ON,
+	CMD_F_H1_OFF,
+	CMD_F_H2_ON,
+	CMD_F_H2_OFF,
+	CMD_F_H3_ON,
+	CMD_F_H3_OFF,
+	CMD_F_H4_ON,
+	CMD_F_H4_OFF,
+	CMD_F_BLOCKQUOTE_ON,
+	CMD_F_BLOCKQUOTE_OFF,
+	CMD_F_INLINE_CODE_ON,
+	CMD_F_INLINE_CODE_OFF,
+	CMD_F_CODE_BLOCK_ON,
+	CMD_F_CODE_BLOCK_OFF,
+	CMD_F_ANGLE_BRACKET_ON,
+	CMD_F_ANGLE_BRACKET_OFF,
+	CMD_S_BEFORE_TEXT,
+	CMD_S_AFTER_TEXT,
+	CMD_S_AT_STARTUP,
+	CMD_S_AT_SHUTDOWN,
+	NUM_OF_COMMANDS
+} command_t;
+
+/*
+ * Commands of the 'features' struct by their ID, set by initialise_commands(), so they're
+ * used without looking up their names. They're valid until the struct is unloaded.
+ */
+extern struct Inifile *command_table[NUM_OF_COMMANDS];
+
 /*
  * Initialise the 'features' struct with predefined names and empty strings as values.
  */
@@ -24,9 +61,11 @@ void unload_printer_feature_commands(struct Inifile **features);
  * List of possible internal states that trigger session commands (see function below),
  */
 typedef enum session {
-	SESSION_PRINT,    /* A chunk of text is about to get printed  */
-	SESSION_STARTUP,  /* COPRIS is starting up                    */
-	SESSION_SHUTDOWN  /* COPRIS is shutting down                  */
+	SESSION_PRINT,       /* A chunk of text is about to get printed  */
+	SESSION_STARTUP,     /* COPRIS is starting up                    */
+	SESSION_SHUTDOWN,    /* COPRIS is shutting down                  */
+	SESSION_BEFORE_TEXT, /* Streamed text is about to get printed    */
+	SESSION_AFTER_TEXT   /* Streamed text has been printed           */
 } session_t;
 
 /*
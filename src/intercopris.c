@@ -315,6 +315,9 @@ int main(int argc, char **argv)
 		append_history(command_count, IC_HISTORY_FILE);
 
 	// Clean up
+	if (output_device)
+		copris_output_close();
+
 	if (features)
 		unload_printer_feature_commands(&features);
 
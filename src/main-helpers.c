@@ -41,6 +41,10 @@ int write_to_output(UT_string *copris_text, struct Attribs *attrib)
 
 	if (attrib->copris_flags & HAS_OUTPUT_FILE) {
 		error = copris_write_file(attrib->output_file, copris_text);
+
+		// Session commands reach every printer of the pool
+		for (int i = 1; i < attrib->output_count && !error; i++)
+			error = copris_write_file(attrib->output_files[i], copris_text);
 	} else {
 		error = copris_write_stdout(copris_text);
 	}
@@ -10,7 +10,8 @@ void append_file_name(const char *filename, char **filenames, int count);
 void free_filenames(char **filenames, int count);
 
 /*
- * Write 'copris_text' to the appropriate output, specified in 'attrib'.
+ * Write 'copris_text' to the appropriate output, specified in 'attrib' (to each output
+ * file, if there's a pool of them).
  * Return zero on success, nonzero on failure.
  */
 int write_to_output(UT_string *copris_text, struct Attribs *attrib);
@@ -19,11 +19,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
 #include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <utstring.h> /* uthash library - dynamic strings */
 
@@ -31,12 +35,20 @@
 #include "Copris.h"
 
 #include "socket_io.h"
+#include "event_io.h"
+#include "workers.h"
+#include "spool.h"
 #include "stream_io.h"
 #include "recode.h"
+#include "builtin_encodings.h"
 #include "feature.h"
-#include "markdown.h"
 #include "main-helpers.h"
+#include "convert.h"
 #include "parse_vars.h"
+#include "streaming.h"
+#include "resolver.h"
+#include "ratelimit.h"
+#include "writer.h"
 
 /*
  * Verbosity levels:
@@ -47,23 +59,74 @@
  */
 int verbosity = 1;
 
+// Sockets of clients, whose texts are spooled, but not yet synced to the spool directory
+static int *held_clients = NULL;
+static size_t held_count = 0;
+static size_t held_capacity = 0;
+
 static void copris_help(const char *argv0) {
 	printf("Usage: %s [arguments] [printer or output file]\n"
 	       "\n"
 	       "  -p, --port PORT         Run as a network server on port number PORT\n"
-	       "  -e, --encoding FILE     Recode received text with encoding FILE\n"
+	       "  -4, --ipv4              Only accept IPv4 network connections\n"
+	       "  -6, --ipv6              Only accept IPv6 network connections\n"
+	       "      --unix-socket PATH  Run as a local server on Unix domain socket PATH\n"
+	       "  -e, --encoding FILE     Recode received text with encoding FILE, or with\n"
+	       "                          a built-in one, named 'builtin:NAME'\n"
 	       "      --ignore-missing    If using '--encoding', don't stop if FILE doesn't\n"
 	       "                          catch every multi-byte character in input text\n"
+	       "      --recode-threads N  Recode big texts in up to N threads at once\n"
+	       "      --encoding-cache DIR\n"
+	       "                          Keep compiled encoding FILEs in directory DIR and\n"
+	       "                          load them from there on later runs\n"
+	       "      --recode-stats FILE Write statistics of recoding all texts, with\n"
+	       "                          characters without a definition, to FILE\n"
 	       "  -f, --feature FILE      Process Markdown, variables and session commands\n"
 	       "                          in received text according to printer feature FILE\n"
 	       "      --dump-commands     Show all possible printer feature commands\n"
 	       "  -d, --daemon            Do not exit after the first network connection\n"
+	       "      --backlog NUMBER    Queue up to NUMBER pending network connections\n"
+	       "      --listeners NUMBER  As a daemon, accept connections in NUMBER processes,\n"
+	       "                          sharing the same port\n"
+	       "      --workers NUMBER    As a daemon, convert up to NUMBER received texts\n"
+	       "                          at once in separate threads\n"
+	       "      --spool-jobs NUMBER As a daemon, print texts in a writer thread, and let\n"
+	       "                          up to NUMBER converted texts wait for the printer\n"
+	       "      --spool-size SIZE   Let converted texts, waiting for the printer, take\n"
+	       "                          up to SIZE bytes (0 - no limit)\n"
+	       "      --spool-dir DIR     Keep texts, waiting for the printer, in directory\n"
+	       "                          DIR, so they're printed even after a restart\n"
+	       "      --priority CLASS    As a daemon, print texts with 'high', 'normal'\n"
+	       "                          (default) or 'low' priority, unless set otherwise\n"
+	       "                          in their modeline\n"
+	       "      --balance MODE      Give each spooled text to the first free printer of\n"
+	       "                          the pool ('free', default), or to printers in turn\n"
+	       "                          ('round-robin')\n"
+	       "      --output-timeout N  Take a printer of the pool out for a while if it\n"
+	       "                          accepts no text for N seconds\n"
+	       "      --resolve MODE      Look up client host names in the background ('async',\n"
+	       "                          default), while the client waits ('sync'), or 'off'\n"
+	       "      --timeout-first N   Drop a network client that sends no text in N seconds\n"
+	       "      --timeout-idle N    Drop a network client that pauses for N seconds\n"
+	       "      --timeout-job N     Drop a network client that doesn't finish its text\n"
+	       "                          in N seconds\n"
 	       "  -l, --limit LIMIT       Discard the whole chunk of text, received from the\n"
 	       "                          network, when it surpasses LIMIT number of bytes\n"
 	       "      --cutoff-limit      If using '--limit', cut text off at exactly LIMIT\n"
 	       "                          number of bytes instead of discarding the whole chunk\n"
-	       "\n"
-	       "  -v, --verbose           Display diagnostic messages (can be used twice)\n"
+	       "      --rate RATE         Receive at most RATE bytes per second from each\n"
+	       "                          network client address\n"
+	       "      --buffer-size SIZE  Read up to SIZE bytes of text at once\n"
+	       "      --rcvbuf SIZE       Set network socket's receive buffer to SIZE bytes\n"
+	       "      --stream            Convert and print text while it's still being received\n"
+	       "      --flush POLICY      If using '--stream', flush output after each received\n"
+	       "                          'chunk' (default), each 'line', or only at the 'end'\n"
+	       "      --passthrough       Move unconverted text from the network straight to\n"
+	       "                          the output file, without copying it\n"
+	       "\n", argv0);
+
+	// Split in two, as ISO C compilers needn't support longer strings
+	printf("  -v, --verbose           Display diagnostic messages (can be used twice)\n"
 	       "  -q, --quiet             Suppress all unnecessary messages, except warnings\n"
 	       "                          and fatal errors\n"
 	       "  -h, --help              Show this argument summary\n"
@@ -78,7 +141,7 @@ static void copris_help(const char *argv0) {
 	       "To use variables in text, begin it with the following line:\n"
 	       "COPRIS ENABLE-VARIABLES\n"
 	       "Any used variables should then be prefixed with '%c'.\n",
-	       argv0, VAR_SYMBOL);
+	       VAR_SYMBOL);
 
 	exit(EXIT_SUCCESS);
 }
@@ -87,27 +150,78 @@ static void copris_version(void) {
 	printf("COPRIS version %s\n"
 	       "(C) 2020-2026 Nejc Bertoncelj <bertronika at mailo.com>\n\n"
 	       "Build-time options\n"
-	       "  Text buffer size:                     %4d bytes\n"
-	       "  Maximum .ini file element length:     %4d bytes\n"
+	       "  Default text buffer size:           %8d bytes\n"
+	       "  Maximum .ini file element length:   %8d bytes\n"
 	       "  Maximum number of each encoding and\n"
-	       "  feature files that can be loaded:     %4d\n"
-	       "  Symbol for invoking variables:         '%c'\n"
+	       "  feature files that can be loaded:   %8d\n"
+	       "  Symbol for invoking variables:          '%c'\n"
 	       "\n",
 	       VERSION, BUFSIZE, MAX_INIFILE_ELEMENT_LENGTH, NUM_OF_INPUT_FILES, VAR_SYMBOL);
 
+	printf("Built-in encodings (use as '-e %sNAME')\n ", BUILTIN_PREFIX);
+	for (int i = 0; i < builtin_encoding_count; i++)
+		printf(" %s", builtin_encodings[i].name);
+
+	printf("%s\n\n", (builtin_encoding_count == 0) ? " (none)" : "");
+
 	exit(EXIT_SUCCESS);
 }
 
+// Parse number of seconds from 'optarg_value' into 'timeout', described by 'name'
+static int parse_timeout(const char *optarg_value, const char *name, int *timeout) {
+	char *parse_error;
+	unsigned long temp_timeout = strtoul(optarg_value, &parse_error, 10);
+
+	if (*parse_error || *optarg_value == '-') {
+		PRINT_ERROR_MSG("Unrecognised characters in %s (%s).", name, optarg_value);
+		return 1;
+	}
+
+	if (temp_timeout > MAX_TIMEOUT) {
+		PRINT_ERROR_MSG("The %s %s out of range. Maximum possible value is %d "
+		                "(seconds).", name, optarg_value, MAX_TIMEOUT);
+		return 1;
+	}
+
+	*timeout = (int)temp_timeout;
+	return 0;
+}
+
 static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 	static struct option long_options[] = {
 		{"port",             required_argument, NULL, 'p'},
+		{"ipv4",             no_argument,       NULL, '4'},
+		{"ipv6",             no_argument,       NULL, '6'},
+		{"unix-socket",      required_argument, NULL, '+'},
 		{"encoding",         required_argument, NULL, 'e'},
 		{"ignore-missing",   no_argument,       NULL, '<'},
+		{"encoding-cache",   required_argument, NULL, '`'},
+		{"recode-threads",   required_argument, NULL, '>'},
+		{"recode-stats",     required_argument, NULL, '_'},
 		{"feature",          required_argument, NULL, 'f'},
 		{"dump-commands",    no_argument,       NULL, ','},
 		{"daemon",           no_argument,       NULL, 'd'},
+		{"backlog",          required_argument, NULL, '/'},
+		{"listeners",        required_argument, NULL, '@'},
+		{"workers",          required_argument, NULL, '*'},
+		{"spool-jobs",       required_argument, NULL, '['},
+		{"spool-size",       required_argument, NULL, ']'},
+		{"spool-dir",        required_argument, NULL, '{'},
+		{"priority",         required_argument, NULL, '}'},
+		{"balance",          required_argument, NULL, '|'},
+		{"output-timeout",   required_argument, NULL, '$'},
+		{"resolve",          required_argument, NULL, '&'},
+		{"timeout-first",    required_argument, NULL, '!'},
+		{"timeout-idle",     required_argument, NULL, '('},
+		{"timeout-job",      required_argument, NULL, ')'},
 		{"limit",            required_argument, NULL, 'l'},
 		{"cutoff-limit",     no_argument,       NULL, '.'},
+		{"rate",             required_argument, NULL, ';'},
+		{"buffer-size",      required_argument, NULL, '#'},
+		{"rcvbuf",           required_argument, NULL, '%'},
+		{"stream",           no_argument,       NULL, '~'},
+		{"passthrough",      no_argument,       NULL, '='},
+		{"flush",            required_argument, NULL, '^'},
 		{"verbose",          no_argument,       NULL, 'v'},
 		{"quiet",            no_argument,       NULL, 'q'},
 		{"help",             no_argument,       NULL, 'h'},
@@ -123,7 +237,7 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 	// Putting a colon in front of the options disables the built-in error reporting
 	// of getopt_long(3) and allows us to specify more appropriate errors (ie. 'You must
 	// specify a printer feature file.' instead of 'option requires an argument -- 'r')
-	while ((c = getopt_long(argc, argv, ":p:e:f:dl:vqhV", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, ":p:46e:f:dl:vqhV", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'p': {
 			unsigned long temp_portno = strtoul(optarg, &parse_error, 10);
@@ -151,6 +265,29 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 			attrib->portno = (unsigned int)temp_portno;
 			break;
 		}
+		case '4':
+			attrib->address_family = AF_INET;
+			break;
+		case '6':
+			attrib->address_family = AF_INET6;
+			break;
+		case '+': {
+			if (*optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in socket path (%s). "
+				                "Perhaps you forgot to specify the path?", optarg);
+				return 1;
+			}
+
+			struct sockaddr_un socket_address;
+			if (strlen(optarg) >= sizeof(socket_address.sun_path)) {
+				PRINT_ERROR_MSG("Socket path '%s' is too long. Maximum possible length "
+				                "is %zu characters.", optarg, sizeof(socket_address.sun_path) - 1);
+				return 1;
+			}
+
+			attrib->socket_path = optarg;
+			break;
+		}
 		case 'e': {
 			if (*optarg == '-') {
 				PRINT_ERROR_MSG("Unrecognised characters in encoding file name (%s). "
@@ -159,9 +296,9 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 			}
 
 			// Get the maximum path name length on the filesystem where
-			// the file resides.
+			// the file resides. Built-in encodings aren't files.
 			errno = 0; /* pathconf() needs errno to be reset */
-			max_path_len = pathconf(optarg, _PC_PATH_MAX);
+			max_path_len = IS_BUILTIN(optarg) ? 0 : pathconf(optarg, _PC_PATH_MAX);
 
 			if (max_path_len == -1) {
 				PRINT_SYSTEM_ERROR("pathconf", "Error querying encoding file '%s'.", optarg);
@@ -218,6 +355,188 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 		case 'd':
 			attrib->daemon = true;
 			break;
+		case '/': {
+			unsigned long temp_backlog = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in backlog number (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_backlog < 1 || temp_backlog > INT_MAX) {
+				PRINT_ERROR_MSG("Backlog number %s out of reasonable range.", optarg);
+				return 1;
+			}
+
+			attrib->backlog = (int)temp_backlog;
+			break;
+		}
+		case '@': {
+			unsigned long temp_listeners = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in number of listeners (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_listeners < 1 || temp_listeners > MAX_LISTENERS) {
+				PRINT_ERROR_MSG("Number of listeners %s out of range. Maximum possible "
+				                "value is %d.", optarg, MAX_LISTENERS);
+				return 1;
+			}
+
+			attrib->listeners = (int)temp_listeners;
+			break;
+		}
+		case '*': {
+			unsigned long temp_workers = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in number of workers (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_workers > MAX_WORKERS) {
+				PRINT_ERROR_MSG("Number of workers %s out of range. Maximum possible "
+				                "value is %d.", optarg, MAX_WORKERS);
+				return 1;
+			}
+
+			attrib->workers = (int)temp_workers;
+			break;
+		}
+		case '>': {
+			unsigned long temp_threads = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in number of recoding threads (%s).",
+				                optarg);
+				return 1;
+			}
+
+			if (temp_threads < 1 || temp_threads > MAX_RECODE_THREADS) {
+				PRINT_ERROR_MSG("Number of recoding threads %s out of range. Maximum "
+				                "possible value is %d.", optarg, MAX_RECODE_THREADS);
+				return 1;
+			}
+
+			attrib->recode_threads = (int)temp_threads;
+			break;
+		}
+		case '[': {
+			unsigned long temp_jobs = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in number of spooled jobs (%s).",
+				                optarg);
+				return 1;
+			}
+
+			if (temp_jobs > MAX_SPOOL_JOBS) {
+				PRINT_ERROR_MSG("Number of spooled jobs %s out of range. Maximum possible "
+				                "value is %d.", optarg, MAX_SPOOL_JOBS);
+				return 1;
+			}
+
+			attrib->spool_jobs = (int)temp_jobs;
+			break;
+		}
+		case ']': {
+			unsigned long temp_size = strtoul(optarg, &parse_error, 10);
+
+			if (temp_size == ULONG_MAX) {
+				PRINT_SYSTEM_ERROR("strtoul", "Error parsing spool size.");
+				return 1;
+			}
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in spool size (%s).", optarg);
+				return 1;
+			}
+
+			attrib->spool_size = (size_t)temp_size;
+			break;
+		}
+		case '{':
+			if (*optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in spool directory name (%s). "
+				                "Perhaps you forgot to specify the directory?", optarg);
+				return 1;
+			}
+
+			attrib->spool_dir = optarg;
+			break;
+		case '`':
+			if (*optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in encoding cache directory name "
+				                "(%s). Perhaps you forgot to specify the directory?", optarg);
+				return 1;
+			}
+
+			attrib->encoding_cache = optarg;
+			break;
+		case '_':
+			if (*optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in recoding statistics file name "
+				                "(%s). Perhaps you forgot to specify the file?", optarg);
+				return 1;
+			}
+
+			attrib->recode_stats = optarg;
+			break;
+		case '}':
+			if (strcmp(optarg, "high") == 0) {
+				attrib->priority = PRIORITY_HIGH;
+			} else if (strcmp(optarg, "normal") == 0) {
+				attrib->priority = PRIORITY_NORMAL;
+			} else if (strcmp(optarg, "low") == 0) {
+				attrib->priority = PRIORITY_LOW;
+			} else {
+				PRINT_ERROR_MSG("Unrecognised priority (%s). Use either 'high', 'normal' "
+				                "or 'low'.", optarg);
+				return 1;
+			}
+			break;
+		case '|':
+			if (strcmp(optarg, "free") == 0) {
+				attrib->balance = BALANCE_FREE;
+			} else if (strcmp(optarg, "round-robin") == 0) {
+				attrib->balance = BALANCE_ROUND_ROBIN;
+			} else {
+				PRINT_ERROR_MSG("Unrecognised balancing mode (%s). Use either 'free' or "
+				                "'round-robin'.", optarg);
+				return 1;
+			}
+			break;
+		case '$':
+			if (parse_timeout(optarg, "output timeout", &attrib->output_timeout))
+				return 1;
+			break;
+		case '&':
+			if (strcmp(optarg, "async") == 0) {
+				attrib->resolve = RESOLVE_ASYNC;
+			} else if (strcmp(optarg, "sync") == 0) {
+				attrib->resolve = RESOLVE_SYNC;
+			} else if (strcmp(optarg, "off") == 0) {
+				attrib->resolve = RESOLVE_OFF;
+			} else {
+				PRINT_ERROR_MSG("Unrecognised host name resolving mode (%s). Use either "
+				                "'async', 'sync' or 'off'.", optarg);
+				return 1;
+			}
+			break;
+		case '!':
+			if (parse_timeout(optarg, "first text timeout", &attrib->timeout_first))
+				return 1;
+			break;
+		case '(':
+			if (parse_timeout(optarg, "idle timeout", &attrib->timeout_idle))
+				return 1;
+			break;
+		case ')':
+			if (parse_timeout(optarg, "job timeout", &attrib->timeout_total))
+				return 1;
+			break;
 		case 'l': {
 			unsigned long temp_limit = strtoul(optarg, &parse_error, 10);
 
@@ -246,6 +565,76 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 		case '.':
 			attrib->copris_flags |= MUST_CUTOFF;
 			break;
+		case '#': {
+			unsigned long temp_bufsize = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in buffer size (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_bufsize < 1 || temp_bufsize > MAX_BUFSIZE) {
+				PRINT_ERROR_MSG("Buffer size %s out of range. Maximum possible "
+				                "value is %d (bytes).", optarg, MAX_BUFSIZE);
+				return 1;
+			}
+
+			attrib->bufsize = (size_t)temp_bufsize;
+			break;
+		}
+		case '%': {
+			unsigned long temp_rcvbuf = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in receive buffer size (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_rcvbuf < 1 || temp_rcvbuf > INT_MAX) {
+				PRINT_ERROR_MSG("Receive buffer size %s out of range. Maximum possible "
+				                "value is %d (bytes).", optarg, INT_MAX);
+				return 1;
+			}
+
+			attrib->rcvbuf = (int)temp_rcvbuf;
+			break;
+		}
+		case ';': {
+			unsigned long temp_rate = strtoul(optarg, &parse_error, 10);
+
+			if (*parse_error || *optarg == '-') {
+				PRINT_ERROR_MSG("Unrecognised characters in byte rate (%s).", optarg);
+				return 1;
+			}
+
+			if (temp_rate < 1 || temp_rate > INT_MAX) {
+				PRINT_ERROR_MSG("Byte rate %s out of range. Maximum possible "
+				                "value is %d (bytes per second).", optarg, INT_MAX);
+				return 1;
+			}
+
+			attrib->rate = (size_t)temp_rate;
+			break;
+		}
+		case '~':
+			attrib->copris_flags |= STREAM_TEXT;
+			break;
+		case '=':
+			attrib->copris_flags |= PASSTHROUGH;
+			break;
+		case '^':
+			if (strcmp(optarg, "chunk") == 0) {
+				attrib->flush = FLUSH_CHUNK;
+			} else if (strcmp(optarg, "line") == 0) {
+				attrib->flush = FLUSH_LINE;
+			} else if (strcmp(optarg, "end") == 0) {
+				attrib->flush = FLUSH_END;
+			} else {
+				PRINT_ERROR_MSG("Unrecognised flush policy (%s). Use either 'chunk', "
+				                "'line' or 'end'.", optarg);
+				return 1;
+			}
+			break;
 		case 'v':
 			if (verbosity != 0 && verbosity < 3)
 				verbosity++;
@@ -268,6 +657,42 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 				PRINT_ERROR_MSG("You must specify a printer feature file.");
 			else if (optopt == 'l')
 				PRINT_ERROR_MSG("You must specify a limit number.");
+			else if (optopt == '+')
+				PRINT_ERROR_MSG("You must specify a socket path.");
+			else if (optopt == '/')
+				PRINT_ERROR_MSG("You must specify a backlog number.");
+			else if (optopt == '@')
+				PRINT_ERROR_MSG("You must specify a number of listeners.");
+			else if (optopt == '*')
+				PRINT_ERROR_MSG("You must specify a number of workers.");
+			else if (optopt == '[')
+				PRINT_ERROR_MSG("You must specify a number of spooled jobs.");
+			else if (optopt == ']')
+				PRINT_ERROR_MSG("You must specify a spool size.");
+			else if (optopt == '{')
+				PRINT_ERROR_MSG("You must specify a spool directory.");
+			else if (optopt == '}')
+				PRINT_ERROR_MSG("You must specify a priority.");
+			else if (optopt == '`')
+				PRINT_ERROR_MSG("You must specify an encoding cache directory.");
+			else if (optopt == '>')
+				PRINT_ERROR_MSG("You must specify a number of recoding threads.");
+			else if (optopt == '_')
+				PRINT_ERROR_MSG("You must specify a recoding statistics file.");
+			else if (optopt == '|')
+				PRINT_ERROR_MSG("You must specify a balancing mode.");
+			else if (optopt == ';')
+				PRINT_ERROR_MSG("You must specify a byte rate.");
+			else if (optopt == '#')
+				PRINT_ERROR_MSG("You must specify a buffer size.");
+			else if (optopt == '%')
+				PRINT_ERROR_MSG("You must specify a receive buffer size.");
+			else if (optopt == '&')
+				PRINT_ERROR_MSG("You must specify a host name resolving mode.");
+			else if (optopt == '!' || optopt == '(' || optopt == ')' || optopt == '$')
+				PRINT_ERROR_MSG("You must specify a timeout in seconds.");
+			else if (optopt == '^')
+				PRINT_ERROR_MSG("You must specify a flush policy.");
 			else
 				PRINT_ERROR_MSG("Option '-%c' is missing an argument.", optopt);
 			return 1;
@@ -287,13 +712,22 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 	if (argv[optind] == NULL)
 		goto no_output_file;
 
-	// Parse the output file name. Note that only the first argument is accepted.
-	// If it equals '-', assume standard output.
+	// Parse the output file name. If it equals '-', assume standard output.
 	if (*argv[optind] == '-') {
 		PRINT_NOTE("Found '-' as the output file name, redirecting text to standard output.\n"
 		           "COPRIS does not use '-' to denote reading from standard input. To do that, "
 		           "simply omit the last argument.");
-	} else {
+		goto no_output_file;
+	}
+
+	// Further output files make up a pool of printers
+	for (; argv[optind] != NULL; optind++) {
+		if (attrib->output_count == MAX_OUTPUTS) {
+			PRINT_ERROR_MSG("Too many output files. A pool may have at most %d "
+			                "printers.", MAX_OUTPUTS);
+			return 1;
+		}
+
 		errno = 0; /* pathconf() needs errno to be reset */
 		max_path_len = pathconf(argv[optind], _PC_PATH_MAX);
 
@@ -309,18 +743,110 @@ static int parse_arguments(int argc, char **argv, struct Attribs *attrib) {
 			return 1;
 		}
 
-		attrib->output_file = argv[optind];
-		attrib->copris_flags |= HAS_OUTPUT_FILE;
-
-		if (argv[++optind] != NULL)
-			PRINT_NOTE("Multiple output file names detected; only the first one "
-			           "will be used.");
+		attrib->output_files[attrib->output_count++] = argv[optind];
 	}
 
+	attrib->output_file = attrib->output_files[0];
+	attrib->copris_flags |= HAS_OUTPUT_FILE;
+
 	no_output_file:
 	return 0;
 }
 
+// Texts are printed with the server's priority, unless their modeline asks otherwise
+// (which is only looked for with a printer feature file)
+static priority_t text_priority(UT_string *copris_text, struct Attribs *attrib) {
+	if (!(attrib->copris_flags & HAS_FEATURES))
+		return attrib->priority;
+
+	modeline_t modeline = parse_modeline(copris_text);
+
+	if (modeline & ML_PRIORITY_HIGH)
+		return PRIORITY_HIGH;
+
+	if (modeline & ML_PRIORITY_LOW)
+		return PRIORITY_LOW;
+
+	return attrib->priority;
+}
+
+// Stage 4: Write 'copris_text' to the output destination, and close the socket of the
+// client that sent it (unless 'childfd' is -1). 'status' is returned by convert_text().
+// If the writer thread is used, the text is handed over to it to be printed with
+// 'priority', and replaced with an empty string. With a spool directory, the socket is
+// closed by commit_spooled_texts() instead.
+static int print_text(UT_string **copris_text, int status, int childfd,
+                      priority_t priority, struct Attribs *attrib) {
+	if (status != 0) {
+		int error = report_missing_characters(childfd);
+		if (error)
+			return error;
+	}
+
+	int error;
+	if (attrib->spool_jobs) {
+		// Clients take turns by their address
+		char host_address[HOST_INFO_LENGTH];
+		get_client_address(childfd, host_address);
+
+		error = spool_submit(copris_text, priority, host_address);
+	} else {
+		error = write_to_output(*copris_text, attrib);
+	}
+
+	if (error)
+		return error;
+
+	if (childfd == -1)
+		return 0;
+
+	// A client takes its closed socket for its text being accepted, which it isn't until
+	// the text would survive a crash
+	if (attrib->spool_dir) {
+		if (held_count == held_capacity) {
+			held_capacity = held_capacity ? held_capacity * 2 : 16;
+			held_clients = realloc(held_clients, held_capacity * sizeof *held_clients);
+			CHECK_MALLOC(held_clients);
+		}
+
+		held_clients[held_count++] = childfd;
+		return 0;
+	}
+
+	// Close the current session's socket
+	return close_socket(childfd, "child");
+}
+
+// Sync texts, spooled since the last call, to the spool directory, and only then close
+// sockets of the clients that sent them
+static int commit_spooled_texts(void) {
+	spool_commit();
+
+	int error = 0;
+	for (size_t i = 0; i < held_count; i++)
+		error |= close_socket(held_clients[i], "child");
+
+	held_count = 0;
+	return error;
+}
+
+// Print texts, converted by worker threads, that are next in line
+static int print_converted_texts(struct Attribs *attrib) {
+	UT_string *converted_text;
+	priority_t priority;
+	int status;
+	int childfd;
+
+	while (workers_collect(&converted_text, &childfd, &priority, &status)) {
+		int error = print_text(&converted_text, status, childfd, priority, attrib);
+		utstring_free(converted_text);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 int main(int argc, char **argv) {
 	// Run-time options (program attributes)
 	struct Attribs attrib;
@@ -330,21 +856,47 @@ int main(int argc, char **argv) {
 	struct Inifile *encoding = NULL, *features = NULL;
 
 	attrib.portno       = 0;  // If 0, read from stdin
+	attrib.backlog      = BACKLOG;
+	attrib.listeners    = 1;
 	attrib.daemon       = false;
+	attrib.workers      = 0;
+	attrib.recode_threads = 1;
+	attrib.spool_jobs   = 0;  // If 0, print texts in the main thread
+	attrib.spool_size   = SPOOL_SIZE;
+	attrib.spool_dir    = NULL;
+	attrib.priority     = PRIORITY_NORMAL;
+	attrib.balance      = BALANCE_FREE;
 	attrib.limitnum     = 0;
+	attrib.rate         = 0;
+	attrib.bufsize      = BUFSIZE;
+	attrib.rcvbuf       = 0;
+	attrib.flush        = FLUSH_CHUNK;
+	attrib.resolve      = RESOLVE_ASYNC;
 	attrib.copris_flags = 0x00;
 
 	attrib.encoding_file_count = 0;
+	attrib.encoding_cache      = NULL;
+	attrib.recode_stats        = NULL;
 	attrib.feature_file_count  = 0;
+	attrib.address_family      = AF_UNSPEC; // Both IPv6 and IPv4
+	attrib.socket_path         = NULL;
+	attrib.timeout_first       = 0; // Wait for clients forever
+	attrib.timeout_idle        = 0;
+	attrib.timeout_total       = 0;
+	attrib.output_count        = 0;
+	attrib.output_timeout      = 0; // Wait for printers forever
 
 	// Parse command line arguments
 	int error = parse_arguments(argc, argv, &attrib);
 	if (error)
 		return error;
 
-	// If no port number was specified by the user, assume input from stdin
+	// A service manager may have started COPRIS with a socket, already listening
+	attrib.inherited_fd = copris_socket_inherited();
+
+	// If no port number or socket path was specified by the user, assume input from stdin
 	bool is_stdin = false;
-	if (attrib.portno == 0)
+	if (attrib.portno == 0 && attrib.socket_path == NULL && attrib.inherited_fd == -1)
 		is_stdin = true;
 
 	if (is_stdin && verbosity != 0 && !isatty(STDOUT_FILENO)) {
@@ -378,18 +930,146 @@ int main(int argc, char **argv) {
 	if (attrib.daemon && LOG_DEBUG)
 		PRINT_MSG("Daemon mode enabled.");
 
+	// Socket from the service manager takes precedence over any specified one
+	if (attrib.inherited_fd != -1 && (attrib.portno || attrib.socket_path)) {
+		attrib.portno = 0;
+		attrib.socket_path = NULL;
+		PRINT_NOTE("Using the socket, passed by the service manager, ignoring the port "
+		           "number and socket path.");
+	} else if (attrib.socket_path && attrib.portno) {
+		attrib.portno = 0;
+		PRINT_NOTE("Listening on a Unix domain socket, ignoring the port number.");
+	}
+
+	// Only a daemon accepts more than one connection
+	if (attrib.listeners > 1 && !attrib.daemon) {
+		attrib.listeners = 1;
+		PRINT_NOTE("Multiple listeners are only used in daemon mode, continuing with one.");
+	}
+
+	// Only a daemon may have more than one text to convert at a time
+	if (attrib.workers && !attrib.daemon) {
+		attrib.workers = 0;
+		PRINT_NOTE("Worker threads are only used in daemon mode, continuing without them.");
+	}
+
+	// Passthrough needs a network client, an output file and no conversion
+	if (attrib.copris_flags & PASSTHROUGH) {
+		if (is_stdin) {
+			attrib.copris_flags &= ~PASSTHROUGH;
+			PRINT_NOTE("Passthrough mode is not available while reading from stdin, "
+			           "continuing without it.");
+		} else if (attrib.copris_flags & (HAS_ENCODING | HAS_FEATURES)) {
+			attrib.copris_flags &= ~PASSTHROUGH;
+			PRINT_NOTE("Passthrough mode can't convert text with encoding or printer "
+			           "feature files, continuing without it.");
+		} else if (!(attrib.copris_flags & HAS_OUTPUT_FILE)) {
+			attrib.copris_flags &= ~PASSTHROUGH;
+			PRINT_NOTE("Passthrough mode needs an output file, continuing without it.");
+		}
+	}
+
+	if (attrib.copris_flags & PASSTHROUGH) {
+		// Text is written as it arrives anyway
+		if (attrib.copris_flags & STREAM_TEXT) {
+			attrib.copris_flags &= ~STREAM_TEXT;
+			PRINT_NOTE("Passthrough mode already streams text, ignoring '--stream'.");
+		}
+
+		if (attrib.limitnum && !(attrib.copris_flags & MUST_CUTOFF)) {
+			attrib.copris_flags |= MUST_CUTOFF;
+			PRINT_NOTE("Passed through text can't be discarded once over the limit, "
+			           "cutting it off at the limit instead.");
+		}
+
+		if (attrib.workers) {
+			attrib.workers = 0;
+			PRINT_NOTE("Worker threads have nothing to convert in passthrough mode, "
+			           "continuing without them.");
+		}
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Passing text through to the output file without copying it.");
+	}
+
+	if (attrib.copris_flags & STREAM_TEXT) {
+		// Printed text can't be taken back, so only the excess can be left out
+		if (attrib.limitnum && !(attrib.copris_flags & MUST_CUTOFF)) {
+			attrib.copris_flags |= MUST_CUTOFF;
+			PRINT_NOTE("Streamed text can't be discarded once over the limit, cutting "
+			           "it off at the limit instead.");
+		}
+
+		// Output of a streamed text would mix with others, so clients are served in turn
+		if (attrib.workers) {
+			attrib.workers = 0;
+			PRINT_NOTE("Worker threads can't be used while streaming text, continuing "
+			           "without them.");
+		}
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Streaming text to output as it arrives.");
+	}
+
+	// Only a daemon has texts waiting to be printed; streamed and passed through texts
+	// are written while they're being received
+	if (attrib.spool_jobs && (!attrib.daemon ||
+	    (attrib.copris_flags & (STREAM_TEXT | PASSTHROUGH))))
+		attrib.spool_jobs = 0;
+
+	if (attrib.priority != PRIORITY_NORMAL && !attrib.spool_jobs)
+		PRINT_NOTE("Priorities only order texts, waiting in a daemon's spool (enabled with "
+		           "'--spool-jobs'), ignoring the priority.");
+
+	if (attrib.spool_dir && !attrib.spool_jobs) {
+		attrib.spool_dir = NULL;
+		PRINT_NOTE("Spool directory is only used by a daemon's writer thread (enabled "
+		           "with '--spool-jobs'), continuing without it.");
+	}
+
+	// Only the writer threads can spread texts among printers
+	if (attrib.output_count > 1 && !attrib.spool_jobs) {
+		attrib.output_count = 1;
+		PRINT_NOTE("A pool of printers is only used by a daemon's writer threads (enabled "
+		           "with '--spool-jobs'); only the first output file will be used.");
+	}
+
+	if (attrib.output_timeout && !attrib.spool_jobs) {
+		attrib.output_timeout = 0;
+		PRINT_NOTE("Output timeout only applies to a daemon's writer threads (enabled with "
+		           "'--spool-jobs'), ignoring it.");
+	} else if (attrib.output_timeout && LOG_DEBUG) {
+		PRINT_MSG("Waiting up to %d s for a printer to accept text.", attrib.output_timeout);
+	}
+
+	// Each process would replay the others' unprinted texts
+	if (attrib.spool_dir && attrib.listeners > 1) {
+		attrib.listeners = 1;
+		PRINT_NOTE("Spool directory can't be shared among listeners, continuing with one.");
+	}
+
 	// Load an encoding file
 	if (attrib.copris_flags & HAS_ENCODING) {
-		for (int i = 0; i < attrib.encoding_file_count; i++) {
-			error = load_encoding_file(attrib.encoding_files[i], &encoding);
-			if (error)
-				return EXIT_FAILURE;
+		error = load_encoding_files(attrib.encoding_files, attrib.encoding_file_count,
+		                            attrib.encoding_cache, &encoding);
+		if (error)
+			return EXIT_FAILURE;
 
-			if ((attrib.copris_flags & ENCODING_NO_STOP) && LOG_INFO)
-				PRINT_MSG("Forcing recoding even in case of missing encoding definitions.");
-		}
+		if ((attrib.copris_flags & ENCODING_NO_STOP) && LOG_INFO)
+			PRINT_MSG("Forcing recoding even in case of missing encoding definitions.");
+
+		recode_set_threads(attrib.recode_threads);
+		recode_set_stats_file(attrib.recode_stats);
+	} else if (attrib.encoding_cache) {
+		PRINT_NOTE("Encoding cache is only used with encoding files, ignoring it.");
 	}
 
+	if (attrib.recode_stats && !(attrib.copris_flags & HAS_ENCODING))
+		PRINT_NOTE("Recoding statistics are only kept with encoding files, ignoring them.");
+
+	if (attrib.recode_threads > 1 && !(attrib.copris_flags & HAS_ENCODING))
+		PRINT_NOTE("Recoding threads are only used with encoding files, ignoring them.");
+
 	// Load a printer feature file
 	if (attrib.copris_flags & HAS_FEATURES) {
 		error = initialise_commands(&features);
@@ -405,28 +1085,78 @@ int main(int argc, char **argv) {
 
 	if (attrib.limitnum > 0 && LOG_DEBUG)
 		PRINT_MSG("Limiting incoming data to %zu bytes.", attrib.limitnum);
+
+	if (attrib.rate && is_stdin)
+		PRINT_NOTE("Byte rate only applies to network clients, ignoring it.");
+	else if (attrib.rate && LOG_DEBUG)
+		PRINT_MSG("Limiting each client to %zu bytes per second.", attrib.rate);
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Reading up to %zu bytes of text at once.", attrib.bufsize);
+
+	if (attrib.rcvbuf && is_stdin)
+		PRINT_NOTE("Receive buffer size only applies to a network socket, ignoring it.");
+
+	if ((attrib.timeout_first || attrib.timeout_idle || attrib.timeout_total) && is_stdin) {
+		attrib.timeout_first = 0;
+		attrib.timeout_idle  = 0;
+		attrib.timeout_total = 0;
+		PRINT_NOTE("Timeouts only apply to network clients, ignoring them.");
+	} else if (LOG_DEBUG) {
+		if (attrib.timeout_first)
+			PRINT_MSG("Waiting up to %d s for the first chunk of text.", attrib.timeout_first);
+		if (attrib.timeout_idle)
+			PRINT_MSG("Waiting up to %d s for each next chunk of text.", attrib.timeout_idle);
+		if (attrib.timeout_total)
+			PRINT_MSG("Waiting up to %d s for the whole text.", attrib.timeout_total);
+	}
 	
-	if (!is_stdin && LOG_DEBUG)
-		PRINT_MSG("Server is listening to port %u.", attrib.portno);
+	if (!is_stdin && LOG_DEBUG) {
+		if (attrib.inherited_fd != -1)
+			PRINT_MSG("Server is listening to socket %d, passed by the service manager.",
+			          attrib.inherited_fd);
+		else if (attrib.socket_path)
+			PRINT_MSG("Server is listening to socket '%s'.", attrib.socket_path);
+		else
+			PRINT_MSG("Server is listening to port %u.", attrib.portno);
+	}
 
 	if (LOG_INFO) {
 		PRINT_LOCATION(stdout);
 		printf("Data stream will be sent to ");
-		if (attrib.copris_flags & HAS_OUTPUT_FILE)
-			printf("%s.\n", attrib.output_file);
-		else
+		if (attrib.copris_flags & HAS_OUTPUT_FILE) {
+			for (int i = 0; i < attrib.output_count; i++)
+				printf("%s%s", (i == 0) ? "" : ", ", attrib.output_files[i]);
+
+			printf(".\n");
+		} else {
 			printf("stdout.\n");
+		}
 	}
 
 	// Open socket and listen if not reading from stdin
 	int parentfd = 0;
-	int childfd = 0;
+	int childfd = -1;
+	bool use_events = attrib.daemon && !(attrib.copris_flags & (STREAM_TEXT | PASSTHROUGH));
 	if (!is_stdin) {
-		error = copris_socket_listen(&parentfd, attrib.portno);
+		error = copris_socket_listen(&parentfd, &attrib);
 		if (error)
 			return EXIT_FAILURE;
 	}
 
+	// Output files are kept open between jobs; let the user have them reopened
+	if (attrib.copris_flags & HAS_OUTPUT_FILE) {
+		copris_output_timeout(attrib.output_timeout);
+
+		for (int i = 0; i < attrib.output_count; i++) {
+			error = copris_output_open(attrib.output_files[i]);
+			if (error)
+				return EXIT_FAILURE;
+		}
+
+		copris_output_watch_hangup();
+	}
+
 	// Create a string for the input text, passed between functions
 	UT_string *copris_text;
 	utstring_new(copris_text);
@@ -443,76 +1173,157 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (!is_stdin) {
+		// Start other listeners before any threads, which wouldn't survive fork()
+		if (attrib.listeners > 1) {
+			int listener = copris_spawn_listeners(&parentfd, &attrib);
+			if (listener == -1)
+				return EXIT_FAILURE;
+		}
+
+		error = resolver_start(attrib.resolve);
+		if (error)
+			return EXIT_FAILURE;
+
+		ratelimit_start(attrib.rate);
+
+		// Let worker threads convert texts, and wake up the event loop once they're done
+		int wakefd = -1;
+		if (attrib.workers) {
+			error = workers_start(attrib.workers, &wakefd, &attrib, &encoding, &features);
+			if (error)
+				return EXIT_FAILURE;
+		}
+
+		// Let the writer thread print texts, while next ones are being received
+		if (attrib.spool_jobs) {
+			error = spool_start(attrib.spool_jobs, attrib.spool_size, attrib.spool_dir,
+			                    &attrib);
+			if (error)
+				return EXIT_FAILURE;
+		}
+
+		// As a daemon, serve multiple clients at once (unless text is streamed)
+		if (use_events) {
+			error = copris_event_init(parentfd, wakefd);
+			if (error)
+				return EXIT_FAILURE;
+		}
+	}
+
 	// Run the main program loop
 	do {
+		// Streamed text passes stages 2 to 4 while it's being read
+		if (attrib.copris_flags & STREAM_TEXT)
+			stream_begin(&attrib, &encoding, &features);
+
 		// Stage 1: Read input text
 		if (is_stdin) {
-			copris_handle_stdin(copris_text);
+			copris_handle_stdin(copris_text, &attrib);
 		} else {
-			error = copris_handle_socket(copris_text, &parentfd, &childfd, &attrib);
+			// Texts, spooled since the loop last waited for clients, are synced at once
+			if (use_events && attrib.spool_dir && !copris_event_pending()) {
+				error = commit_spooled_texts();
+				if (error)
+					return EXIT_FAILURE;
+			}
+
+			if (use_events)
+				error = copris_handle_events(copris_text, parentfd, &childfd, &attrib);
+			else
+				error = copris_handle_socket(copris_text, &parentfd, &childfd, &attrib);
+
 			if (error)
 				return EXIT_FAILURE;
 		}
 
-		if (utstring_len(copris_text) == 0)
-			continue; // Do not attempt to write/display nothing
-
-		// Stage 2: Handle variables, session commands and Markdown with a printer feature file
-		if (attrib.copris_flags & HAS_FEATURES) {
-			modeline_t modeline = NO_MODELINE;
-
-			// Check for the modeline at the beginning of text, which enables variable reading
-			modeline = parse_modeline(copris_text);
-			apply_modeline(copris_text, modeline);
+		// Convert and print the rest of the streamed text
+		if (attrib.copris_flags & STREAM_TEXT) {
+			int status = stream_end(copris_text);
+			if (status == -1)
+				return EXIT_FAILURE;
 
-			if (modeline & ML_ENABLE_VAR)
-				parse_variables(copris_text, &features);
+			// Text has already been printed, the client can only be told about it
+			if (status == 1 && report_missing_characters(childfd) != 0)
+				return EXIT_FAILURE;
 
-			if (!(modeline & ML_DISABLE_MD))
-				parse_markdown(copris_text, &features);
+			if (childfd != -1) {
+				error = close_socket(childfd, "child");
+				if (error)
+					return EXIT_FAILURE;
+			}
 
-			apply_session_commands(copris_text, &features, SESSION_PRINT);
+			continue;
 		}
 
-		// Stage 3: Recode text with an encoding file
-		if (attrib.copris_flags & HAS_ENCODING) {
-			error = recode_text(copris_text, &encoding);
+		// Texts are converted by worker threads and written here in order of arrival
+		if (attrib.workers) {
+			if (utstring_len(copris_text) > 0) {
+				workers_submit(copris_text, childfd, text_priority(copris_text, &attrib));
+				utstring_new(copris_text);
+			} else if (childfd != -1) {
+				error = close_socket(childfd, "child");
+				if (error)
+					return EXIT_FAILURE;
+			}
 
-			// Terminate on error only if user hasn't forced recoding
-			if (error && !(attrib.copris_flags & ENCODING_NO_STOP)) {
-				const char error_msg[] =
-				        "One or more multi-byte characters, not handled by "
-				        "encoding file(s), were received. If this is the intended "
-				        "behaviour, run COPRIS with --ignore-missing.";
+			error = print_converted_texts(&attrib);
+			if (error)
+				return EXIT_FAILURE;
 
-				if (verbosity) {
-					if (!is_stdin)
-						send_to_socket(childfd, error_msg);
+			continue;
+		}
 
-					PRINT_MSG("%s", error_msg);
+		// Do not attempt to write/display nothing
+		if (utstring_len(copris_text) == 0) {
+			if (childfd != -1) {
+				error = close_socket(childfd, "child");
+				if (error)
 					return EXIT_FAILURE;
-				}
-
-				PRINT_NOTE(error_msg);
 			}
+
+			continue;
 		}
 
+		// Modeline is removed during conversion
+		priority_t priority = text_priority(copris_text, &attrib);
+
+		// Stages 2 and 3: Handle variables, session commands and Markdown with a printer
+		// feature file, and recode text with an encoding file
+		int status = convert_text(copris_text, &attrib, &encoding, &features);
+
 		// Stage 4: Write text to the output destination
-		error = write_to_output(copris_text, &attrib);
+		error = print_text(&copris_text, status, childfd, priority, &attrib);
 		if (error)
 			return EXIT_FAILURE;
 
 		// Current session's text has been processed, clear it for a new read
 		utstring_clear(copris_text);
 
-		// Close the current session's socket
-		if (!is_stdin) {
-			error = close_socket(childfd, "child");
+	} while (attrib.daemon); /* end of main program loop */
+
+	// Print any texts that are still being converted
+	if (attrib.workers) {
+		workers_stop();
+
+		error = print_converted_texts(&attrib);
+		if (error)
+			return EXIT_FAILURE;
+	}
+
+	// Wait for the writer thread to print all spooled texts
+	if (attrib.spool_jobs) {
+		if (attrib.spool_dir) {
+			error = commit_spooled_texts();
+			free(held_clients);
 			if (error)
 				return EXIT_FAILURE;
 		}
 
-	} while (attrib.daemon); /* end of main program loop */
+		error = spool_stop();
+		if (error)
+			return EXIT_FAILURE;
+	}
 
 	// Append the shutdown session command
 	if (attrib.copris_flags & HAS_FEATURES) {
@@ -535,11 +1346,25 @@ int main(int argc, char **argv) {
 
 	// Close the global parent socket
 	if (!is_stdin && attrib.daemon) {
+		if (use_events)
+			copris_event_close();
+
 		error = close_socket(parentfd, "parent");
 		if (error)
 			return EXIT_FAILURE;
+
+		if (attrib.socket_path)
+			remove_socket_file(&attrib);
 	}
 
+	if (!is_stdin) {
+		resolver_stop();
+		ratelimit_stop();
+	}
+
+	if (attrib.copris_flags & HAS_OUTPUT_FILE)
+		copris_output_close();
+
 	utstring_free(copris_text);
 
 	if (!is_stdin && LOG_DEBUG)
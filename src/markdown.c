@@ -42,31 +42,62 @@
 
 #include "Copris.h"
 #include "debug.h"
+#include "feature.h"
 #include "markdown.h"
-
-typedef enum attribute {
-	NONE        = 0,
-	BOLD        = 1 << 0,
-	ITALIC      = 1 << 1,
-	HEADING     = 1 << 2,
-	BLOCKQUOTE  = 1 << 3,
-	INLINE_CODE = 1 << 4,
-	CODE_BLOCK  = 1 << 5,
-	RULE        = 1 << 6,
-	LINK        = 1 << 7
-} attribute_t;
+#include "scan.h"
+#include "utstring_cut.h"
 
 #define INSERT_TEXT(string)  \
         utstring_bincpy(converted_text, string, (sizeof string) - 1)
 
-#define INSERT_CODE(string)  \
-        insert_code_helper(string, features, converted_text)
+#define INSERT_CODE(id)      \
+        insert_code_helper(id, converted_text)
 
 #define MARKUP_ALLOWED       \
         (!inline_code_on && !inline_code_esc_on && \
          !code_block_on && !code_block_open && !link_on)
 
-static void insert_code_helper(const char *, struct Inifile **, UT_string *);
+static inline void insert_code_helper(command_t, UT_string *);
+
+// Characters that may begin or end markup (or a line, which closes it)
+static const struct Scan_set markup_chars = {
+	.bytes = { '*', '_', '#', '>', '`', '<', '\\', '\n' },
+	.count = 8,
+	.table = {
+		['*'] = true, ['_'] = true, ['#'] = true, ['>'] = true,
+		['`'] = true, ['<'] = true, ['\\'] = true, ['\n'] = true
+	}
+};
+
+void parse_markdown(UT_string *copris_text, struct Inifile **features)
+{
+	// Create a temporary string
+	UT_string *converted_text;
+	utstring_new(converted_text);
+	utstring_reserve(converted_text, utstring_len(copris_text));
+
+	struct Markdown_state state;
+	markdown_init(&state);
+
+	parse_markdown_chunk(&state, utstring_body(copris_text), utstring_len(copris_text),
+	                     true, converted_text, features);
+	markdown_finish(&state, converted_text, features);
+
+	// Replace input text, and free it along with the temporary string
+	utstring_swap(copris_text, converted_text);
+	utstring_free(converted_text);
+}
+
+void markdown_init(struct Markdown_state *state)
+{
+	static const struct Markdown_state state_init = {
+		.text_attribute = NONE,
+		.last_char      = '\n', /* Text begins on a new line */
+		.current_line   = 1
+	};
+
+	*state = state_init;
+}
 
 /*
  * Asterisks bring quite a lot of ambiguity. That's the reason the parser deals so
@@ -78,45 +109,81 @@ static void insert_code_helper(const char *, struct Inifile **, UT_string *);
  * The latter two aren't touched by this function, but shall not be mistakenly
  * parsed as bold/italic.
  */
-void parse_markdown(UT_string *copris_text, struct Inifile **features)
+size_t parse_markdown_chunk(struct Markdown_state *state, const char *text, size_t text_len,
+                            bool last, UT_string *converted_text, struct Inifile **features)
 {
-	// Create a temporary string
-	UT_string *converted_text;
-	utstring_new(converted_text);
-
-	attribute_t text_attribute = 0;
-	bool bold_on = false;
-	bool italic_on = false;
-	bool inline_code_on = false;
-	bool inline_code_esc_on = false; // Escaped form: "`` ... ``"
-	bool code_block_on = false;
-	bool link_on = false;
-
-	int heading_level = 0;
-	bool code_block_open = false;
-	bool blockquote_open = false;
-
-	const char *text = utstring_body(copris_text);
-	size_t text_len = utstring_len(copris_text);
-	char last_char = ' ';
-
-	static char *heading_on[]  = {0, "F_H1_ON", "F_H2_ON", "F_H3_ON", "F_H4_ON"};
-	static char *heading_off[] = {0, "F_H1_OFF", "F_H2_OFF", "F_H3_OFF", "F_H4_OFF"};
+	// Commands are emitted from 'command_table', set up along with 'features'
+	(void)features;
+
+	// Continue where the previous chunk of text left off
+	attribute_t text_attribute = state->text_attribute;
+	bool bold_on = state->bold_on;
+	bool italic_on = state->italic_on;
+	bool inline_code_on = state->inline_code_on;
+	bool inline_code_esc_on = state->inline_code_esc_on;
+	bool code_block_on = state->code_block_on;
+	bool link_on = state->link_on;
+
+	int heading_level = state->heading_level;
+	bool code_block_open = state->code_block_open;
+	bool blockquote_open = state->blockquote_open;
+
+	bool escaped_char = state->escaped_char;
+	bool rule_pending = state->rule_pending;
+	char last_char = state->last_char;
+
+	static const command_t heading_on[]  = {0, CMD_F_H1_ON, CMD_F_H2_ON,
+	                                        CMD_F_H3_ON, CMD_F_H4_ON};
+	static const command_t heading_off[] = {0, CMD_F_H1_OFF, CMD_F_H2_OFF,
+	                                        CMD_F_H3_OFF, CMD_F_H4_OFF};
+
+	int current_line = state->current_line;
+	struct Error_line error_line = state->error_line;
+
+	size_t line_char_i = state->line_char_i;
+
+	size_t i;
+	for (i = 0; i < text_len; i++) {
+		// Plain text in the middle of a line is copied up to the next markup character at
+		// once. Characters at the beginning of a line, or escaped, are handled one by one.
+		if (text_attribute == NONE && !rule_pending && !escaped_char && last_char != '\n') {
+			size_t plain_len = scan_span(&markup_chars, &text[i], text_len - i);
+
+			if (plain_len > 0) {
+				utstring_bincpy(converted_text, &text[i], plain_len);
+				i += plain_len;
+				line_char_i += plain_len;
+				last_char = text[i - 1];
+
+				if (i == text_len)
+					break;
+			}
+		}
 
-	int current_line = 1;
-	struct Error_line {
-		int bold;
-		int italic;
-		int inline_code;
-		int code_block;
-		int link;
-	} error_line = {0, 0, 0, 0, 0};
+		// A new line, ending the previous chunk, may have begun a horizontal rule. As it
+		// didn't have any line attributes to close, it has already been copied to output.
+		if (rule_pending) {
+			rule_pending = false;
+
+			if (i + 3 < text_len && text[i + 3] == '\n' &&
+			    ((text[i] == '*' && text[i + 1] == '*' && text[i + 2] == '*') ||
+			     (text[i] == '-' && text[i + 1] == '-' && text[i + 2] == '-'))) {
+				utstring_bincpy(converted_text, &text[i], 4);
+				i += 3;
+				line_char_i = 0;
+				continue;
+			}
+		}
 
-	size_t line_char_i = 0;
+		// There's not enough text after a new line to check for a horizontal rule. Leave
+		// it for the next chunk if it has to close line attributes, else copy it right away.
+		if (!last && text[i] == '\n' && i + 4 >= text_len) {
+			if (heading_level || blockquote_open || code_block_open)
+				break;
 
-	bool escaped_char = (text[0] == '\\'); // Detect early escape character
+			rule_pending = !escaped_char;
+		}
 
-	for (size_t i = 0; i < text_len; i++) {
 		// Catch horizontal rules ('***'/'---') and copy them to output.
 		if (!escaped_char && (i + 4 < text_len && text[i + 4] == '\n' && text[i] == '\n') &&
 		    ((text[i + 1] == '*' && text[i + 2] == '*' && text[i + 3] == '*') ||
@@ -147,7 +214,7 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 
 		// Headings: '#' through '####' on a blank line. More than one space after the
 		//           pound sign will be preserved (e.g. to center titles).
-		} else if (MARKUP_ALLOWED && !escaped_char && (i == 0 || last_char == '\n') &&
+		} else if (MARKUP_ALLOWED && !escaped_char && last_char == '\n' &&
 		           (i + 1 < text_len && text[i] == '#')) {
 			if (i + 2 < text_len && text[i + 1] == '#') {
 				if (i + 3 < text_len && text[i + 2] == '#') {
@@ -172,7 +239,7 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 			}
 
 		// Blockquote: '> ' or '>\n' on a new line.
-		} else if (MARKUP_ALLOWED && !escaped_char && (i == 0 || last_char == '\n') && (
+		} else if (MARKUP_ALLOWED && !escaped_char && last_char == '\n' && (
 		           i + 1 < text_len && text[i] == '>' &&
 		           (text[i + 1] == ' ' || text[i + 1] == '\n'))) {
 			text_attribute = BLOCKQUOTE;
@@ -207,7 +274,7 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 				inline_code_on = !inline_code_on;
 			}
 #ifndef DISABLE_WHITESPACE_CODE_BLOCK
-		} else if (!escaped_char && (i == 0 || last_char == '\n') && !code_block_on &&
+		} else if (!escaped_char && last_char == '\n' && !code_block_on &&
 			       (i + 3 < text_len && text[i] == ' ' && text[i + 1] == ' ' &&
 			        text[i + 2] == ' ' && text[i + 3] == ' ')) {
 			text_attribute |= CODE_BLOCK;
@@ -235,36 +302,36 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 					INSERT_CODE(heading_off[heading_level]);
 					heading_level = 0;
 				} else if (blockquote_open) {
-					INSERT_CODE("F_BLOCKQUOTE_OFF");
+					INSERT_CODE(CMD_F_BLOCKQUOTE_OFF);
 					blockquote_open = false;
 				} else if (code_block_open) {
-					INSERT_CODE("F_CODE_BLOCK_OFF");
+					INSERT_CODE(CMD_F_CODE_BLOCK_OFF);
 					code_block_open = false;
 				}
 			}
 			// Don't copy the backslash to output, except if it was escaped
-			if (text[i] != '\\' || (i > 0 && text[i - 1] == '\\' && text[i] == '\\'))
+			if (text[i] != '\\' || last_char == '\\')
 				utstring_bincpy(converted_text, &text[i], 1);
 
 		} else if (text_attribute == (ITALIC | BOLD)) {
 			if (bold_on)
-				INSERT_CODE("F_BOLD_ON");
+				INSERT_CODE(CMD_F_BOLD_ON);
 
-			INSERT_CODE((italic_on ? "F_ITALIC_ON" : "F_ITALIC_OFF"));
+			INSERT_CODE((italic_on ? CMD_F_ITALIC_ON : CMD_F_ITALIC_OFF));
 
 			if (!bold_on)
-				INSERT_CODE("F_BOLD_OFF");
+				INSERT_CODE(CMD_F_BOLD_OFF);
 
 			text_attribute &= ~(ITALIC | BOLD);
 
 		} else if (text_attribute == ITALIC) {
-			INSERT_CODE((italic_on ? "F_ITALIC_ON" : "F_ITALIC_OFF"));
+			INSERT_CODE((italic_on ? CMD_F_ITALIC_ON : CMD_F_ITALIC_OFF));
 			text_attribute &= ~(ITALIC);
 			if (italic_on)
 				error_line.italic = current_line;
 
 		} else if (text_attribute == BOLD) {
-			INSERT_CODE((bold_on ? "F_BOLD_ON" : "F_BOLD_OFF"));
+			INSERT_CODE((bold_on ? CMD_F_BOLD_ON : CMD_F_BOLD_OFF));
 			text_attribute &= ~(BOLD);
 			if (bold_on)
 				error_line.bold = current_line;
@@ -275,20 +342,20 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 			text_attribute &= ~(HEADING);
 
 		} else if (text_attribute == BLOCKQUOTE) {
-			INSERT_CODE("F_BLOCKQUOTE_ON");
+			INSERT_CODE(CMD_F_BLOCKQUOTE_ON);
 			char quote_text[] = "> ";
 			INSERT_TEXT(quote_text);
 			text_attribute &= ~(BLOCKQUOTE);
 
 		} else if (text_attribute == INLINE_CODE) {
-			INSERT_CODE(inline_code_on ? "F_INLINE_CODE_ON" : "F_INLINE_CODE_OFF");
+			INSERT_CODE(inline_code_on ? CMD_F_INLINE_CODE_ON : CMD_F_INLINE_CODE_OFF);
 			text_attribute &= ~(INLINE_CODE);
 			if (inline_code_on)
 				error_line.inline_code = current_line;
 
 		} else if (text_attribute == CODE_BLOCK) {
 			INSERT_CODE((code_block_on || code_block_open) ?
-			            "F_CODE_BLOCK_ON" : "F_CODE_BLOCK_OFF");
+			            CMD_F_CODE_BLOCK_ON : CMD_F_CODE_BLOCK_OFF);
 			text_attribute &= ~(CODE_BLOCK);
 			if (code_block_on)
 				error_line.code_block = current_line;
@@ -306,10 +373,10 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 		} else if (text_attribute == LINK) {
 			if (link_on) {
 				INSERT_TEXT("<");
-				INSERT_CODE("F_ANGLE_BRACKET_ON");
+				INSERT_CODE(CMD_F_ANGLE_BRACKET_ON);
 				error_line.link = current_line;
 			} else {
-				INSERT_CODE("F_ANGLE_BRACKET_OFF");
+				INSERT_CODE(CMD_F_ANGLE_BRACKET_OFF);
 				INSERT_TEXT(">");
 			}
 			text_attribute &= ~(LINK);
@@ -324,52 +391,71 @@ void parse_markdown(UT_string *copris_text, struct Inifile **features)
 		}
 	}
 
+	state->text_attribute     = text_attribute;
+	state->bold_on            = bold_on;
+	state->italic_on          = italic_on;
+	state->inline_code_on     = inline_code_on;
+	state->inline_code_esc_on = inline_code_esc_on;
+	state->code_block_on      = code_block_on;
+	state->link_on            = link_on;
+	state->heading_level      = heading_level;
+	state->code_block_open    = code_block_open;
+	state->blockquote_open    = blockquote_open;
+	state->escaped_char       = escaped_char;
+	state->rule_pending       = rule_pending;
+	state->last_char          = last_char;
+	state->current_line       = current_line;
+	state->error_line         = error_line;
+	state->line_char_i        = line_char_i;
+
+	return i;
+}
+
+void markdown_finish(struct Markdown_state *state, UT_string *converted_text,
+                     struct Inifile **features)
+{
+	(void)features;
+
 	// Close missing tags, notify user
-	if (link_on) {
-		INSERT_CODE("F_ANGLE_BRACKET_OFF");
+	if (state->link_on) {
+		INSERT_CODE(CMD_F_ANGLE_BRACKET_OFF);
 		if (LOG_ERROR)
 			PRINT_MSG("Warning: angle brackets still open on EOF, possibly in line %d.",
-					  error_line.link);
+					  state->error_line.link);
 	}
 
-	if (code_block_on) {
-		INSERT_CODE("F_CODE_BLOCK_OFF");
+	if (state->code_block_on) {
+		INSERT_CODE(CMD_F_CODE_BLOCK_OFF);
 		if (LOG_ERROR)
 			PRINT_MSG("Warning: code block still open on EOF, possibly in line %d.",
-			          error_line.code_block);
+			          state->error_line.code_block);
 	}
 
-	if (inline_code_on) {
-		INSERT_CODE("F_INLINE_CODE_OFF");
+	if (state->inline_code_on) {
+		INSERT_CODE(CMD_F_INLINE_CODE_OFF);
 		if (LOG_ERROR)
 			PRINT_MSG("Warning: inline code still open on EOF, possibly in line %d.",
-			          error_line.inline_code);
+			          state->error_line.inline_code);
 	}
 
-	if (bold_on) {
-		INSERT_CODE("F_BOLD_OFF");
+	if (state->bold_on) {
+		INSERT_CODE(CMD_F_BOLD_OFF);
 		if (LOG_ERROR)
 			PRINT_MSG("Warning: bold text still open on EOF, possibly in line %d.",
-			          error_line.bold);
+			          state->error_line.bold);
 	}
 
-	if (italic_on) {
-		INSERT_CODE("F_ITALIC_OFF");
+	if (state->italic_on) {
+		INSERT_CODE(CMD_F_ITALIC_OFF);
 		if (LOG_ERROR)
 			PRINT_MSG("Warning: italic text still open on EOF, possibly in line %d.",
-			          error_line.italic);
+			          state->error_line.italic);
 	}
-
-	// Overwrite input text
-	utstring_clear(copris_text);
-	utstring_concat(copris_text, converted_text);
-	utstring_free(converted_text);
 }
 
-static void insert_code_helper(const char *code, struct Inifile **features, UT_string *text)
+static inline void insert_code_helper(command_t id, UT_string *text)
 {
-	struct Inifile *s;
-	HASH_FIND_STR(*features, code, s);
+	const struct Inifile *s = command_table[id];
 
 	assert(s != NULL);
 
@@ -1,3 +1,47 @@
+typedef enum attribute {
+	NONE        = 0,
+	BOLD        = 1 << 0,
+	ITALIC      = 1 << 1,
+	HEADING     = 1 << 2,
+	BLOCKQUOTE  = 1 << 3,
+	INLINE_CODE = 1 << 4,
+	CODE_BLOCK  = 1 << 5,
+	RULE        = 1 << 6,
+	LINK        = 1 << 7
+} attribute_t;
+
+/*
+ * State of the Markdown parser, carried over between chunks of the same text.
+ */
+struct Markdown_state {
+	attribute_t text_attribute;
+	bool bold_on;
+	bool italic_on;
+	bool inline_code_on;
+	bool inline_code_esc_on; // Escaped form: "`` ... ``"
+	bool code_block_on;
+	bool link_on;
+
+	int heading_level;
+	bool code_block_open;
+	bool blockquote_open;
+
+	bool escaped_char;       // Previous character was a backslash
+	bool rule_pending;       // Previous chunk ended with a new line, not yet checked for a rule
+	char last_char;          // Last character of previous chunk
+
+	int current_line;
+	struct Error_line {
+		int bold;
+		int italic;
+		int inline_code;
+		int code_block;
+		int link;
+	} error_line;
+
+	size_t line_char_i;
+};
+
 /*
  * Take input text 'copris_text' and replace Markdown elements with appropriate command
  * values - printer escape codes, passed by 'features' hash table. Put parsed text into
@@ -8,3 +52,24 @@
  * is too ambiguous to be figured out.
  */
 void parse_markdown(UT_string *copris_text, struct Inifile **features);
+
+/*
+ * Prepare parser 'state' for a new text, parsed in chunks.
+ */
+void markdown_init(struct Markdown_state *state);
+
+/*
+ * Parse chunk 'text' of length 'text_len' like parse_markdown() does, continuing from
+ * 'state', and append the result to 'converted_text'. Chunks, apart from the 'last' one,
+ * must end with a new line.
+ * Return number of bytes parsed. Any remaining bytes must begin the next chunk.
+ */
+size_t parse_markdown_chunk(struct Markdown_state *state, const char *text, size_t text_len,
+                            bool last, UT_string *converted_text, struct Inifile **features);
+
+/*
+ * Close element pairs, left open at the end of text in 'state', by appending their
+ * command values to 'converted_text', and print warnings.
+ */
+void markdown_finish(struct Markdown_state *state, UT_string *converted_text,
+                     struct Inifile **features);
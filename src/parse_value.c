@@ -7,7 +7,7 @@
  * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
  */
 
-// For 'strndup' in ISO C
+// For 'strndup' and 'strtok_r' in ISO C
 #define _XOPEN_SOURCE 700
 
 #include <stdio.h>
@@ -33,7 +33,9 @@ int parse_values_with_variables(const char *value, size_t value_len,
 	int element_count = 0;
 	// int variable_count = 0;
 
-	char *token = strtok(value_copy, " ");
+	// Conversion may run in several threads at once, use the reentrant strtok()
+	char *saveptr;
+	char *token = strtok_r(value_copy, " ", &saveptr);
 	while (token != NULL) {
 		if (!isdigit(token[0])) {
 			// Value is a variable
@@ -80,7 +82,7 @@ int parse_values_with_variables(const char *value, size_t value_len,
 			utstring_bincpy(parsed_value, parsed_token, new_value_len);
 			element_count += new_value_len;
 		}
-		token = strtok(NULL, " ");
+		token = strtok_r(NULL, " ", &saveptr);
 	}
 
 	free(value_copy);
@@ -23,6 +23,7 @@
 #include "debug.h"
 #include "parse_vars.h"
 #include "parse_value.h"
+#include "utstring_cut.h"
 
 modeline_t parse_modeline(UT_string *copris_text)
 {
@@ -46,17 +47,22 @@ modeline_t parse_modeline(UT_string *copris_text)
 	    strcasestr(text, "DISABLE-MD"))
 		modeline |= ML_DISABLE_MD;
 
+	if (strcasestr(text, "PRIORITY-HIGH"))
+		modeline |= ML_PRIORITY_HIGH;
+	else if (strcasestr(text, "PRIORITY-LOW"))
+		modeline |= ML_PRIORITY_LOW;
+
 	return modeline;
 }
 
-void apply_modeline(UT_string *copris_text, modeline_t modeline)
+size_t check_modeline(const char *text, size_t text_len, modeline_t modeline)
 {
 	switch(modeline) {
 	case NO_MODELINE:
 		if (LOG_INFO)
 			PRINT_MSG("No 'COPRIS <cmd>' modeline found, not parsing any variables.");
 
-		return;
+		return 0;
 	case ML_EMPTY:
 		if (LOG_ERROR)
 			PRINT_MSG("Modeline is empty, ignoring it.");
@@ -71,51 +77,57 @@ void apply_modeline(UT_string *copris_text, modeline_t modeline)
 		break;
 	}
 
-	// Get the text without a modeline
-	const char *text = utstring_body(copris_text);
-	char *text_without_ml = strchr(text, '\n');
+	// Find the end of the modeline
+	const char *text_without_ml = memchr(text, '\n', text_len);
 
 	// Assume there's no further data if no newline is found
 	if (text_without_ml == NULL) {
-		utstring_clear(copris_text);
 		if (LOG_INFO)
 			PRINT_NOTE("There's no data after the modeline.");
 
-		return;
+		return text_len;
 	}
 
-	// Skip '\n', get new text's length
+	// Skip '\n', get modeline's length
 	text_without_ml += 1;
 
-	int ml_length = text_without_ml - text;
+	size_t ml_length = (size_t)(text_without_ml - text);
 	assert(ml_length > 0);
 
-	size_t text_without_ml_length = utstring_len(copris_text) - ml_length;
-
-	// Create a copy of text without the modeline
-	UT_string *temp_text;
-	utstring_new(temp_text);
-	utstring_bincpy(temp_text, text_without_ml, text_without_ml_length);
+	return ml_length;
+}
 
-	utstring_clear(copris_text);
-	utstring_concat(copris_text, temp_text);
+void apply_modeline(UT_string *copris_text, modeline_t modeline)
+{
+	size_t ml_length = check_modeline(utstring_body(copris_text), utstring_len(copris_text),
+	                                  modeline);
 
-	utstring_free(temp_text);
+	// Move the rest of text over the modeline, without copying it elsewhere first
+	utstring_shift(copris_text, ml_length);
 }
 
 static int parse_extracted_variable(UT_string *text, struct Inifile **features,
                                     UT_string *variable);
 
 void parse_variables(UT_string *copris_text, struct Inifile **features)
+{
+	int nothing_parsed = 0;
+	parse_variables_chunk(copris_text, features, &nothing_parsed);
+}
+
+void parse_variables_chunk(UT_string *copris_text, struct Inifile **features,
+                           int *nothing_parsed)
 {
 	UT_string *temp_text, *variable_name;
 	utstring_new(temp_text);
 	utstring_new(variable_name);
 
+	// Text mostly keeps its length, so it's rarely reallocated while being copied over
+	utstring_reserve(temp_text, utstring_len(copris_text));
+
 	char *s = utstring_body(copris_text);
 	size_t l = utstring_len(copris_text);
 	int new_line = 0;
-	int nothing_parsed = 0;
 
 	while (l > 0) {
 		// Find the next symbol denoting a variable
@@ -142,7 +154,7 @@ void parse_variables(UT_string *copris_text, struct Inifile **features)
 			if (tok_len == 1) {
 				// $ is standalone, copy it to output
 				utstring_bincpy(temp_text, tok, tok_len);
-				nothing_parsed = 1;
+				*nothing_parsed = 1;
 				goto skip_parse;
 			}
 
@@ -153,20 +165,20 @@ void parse_variables(UT_string *copris_text, struct Inifile **features)
 
 			// Parse contents of the variable
 			utstring_bincpy(variable_name, tok, tok_len);
-			nothing_parsed = parse_extracted_variable(temp_text, features, variable_name);
+			*nothing_parsed = parse_extracted_variable(temp_text, features, variable_name);
 			utstring_clear(variable_name);
 
 			skip_parse:
 			// Skip the new line, if there's one
-			new_line = (tok_end == NULL || nothing_parsed) ? 0 : 1;
+			new_line = (tok_end == NULL || *nothing_parsed) ? 0 : 1;
 			s += tok_len + new_line;
 			l -= tok_len + new_line;
 		}
 	}
 	utstring_free(variable_name);
 
-	utstring_clear(copris_text);
-	utstring_concat(copris_text, temp_text);
+	// Parsed text takes the place of the original one, which is freed along
+	utstring_swap(copris_text, temp_text);
 	utstring_free(temp_text);
 }
 
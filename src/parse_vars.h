@@ -1,13 +1,16 @@
 typedef enum modeline {
-	NO_MODELINE   = (1 << 0), // No modeline found at the beginning of text
-	ML_EMPTY      = (1 << 1), // Modeline was found, but contains no command
-	ML_UNKNOWN    = (1 << 2), // Modeline was found, but contains unknown command(s)
-	ML_ENABLE_VAR = (1 << 3), // Modeline instructs us to enable variable parsing
-	ML_DISABLE_MD = (1 << 4)  // Modeline instructs us to disable parsing Markdown
+	NO_MODELINE      = (1 << 0), // No modeline found at the beginning of text
+	ML_EMPTY         = (1 << 1), // Modeline was found, but contains no command
+	ML_UNKNOWN       = (1 << 2), // Modeline was found, but contains unknown command(s)
+	ML_ENABLE_VAR    = (1 << 3), // Modeline instructs us to enable variable parsing
+	ML_DISABLE_MD    = (1 << 4), // Modeline instructs us to disable parsing Markdown
+	ML_PRIORITY_HIGH = (1 << 5), // Modeline asks for text to be printed before others
+	ML_PRIORITY_LOW  = (1 << 6)  // Modeline asks for text to be printed after others
 } modeline_t;
 /*
  * Check 'copris_text' if there's a "modeline" at the beginning of text:
  *   COPRIS [ENABLE-VARIABLES|ENABLE-VARS] [DISABLE-MARKDOWN|DISABLE-MD]
+ *          [PRIORITY-HIGH|PRIORITY-LOW]
  *
  * Letters are case-insensitive, order of commands is not important.
  * At least one command must be specified to make a modeline valid.
@@ -16,6 +19,13 @@ typedef enum modeline {
  */
 modeline_t parse_modeline(UT_string *copris_text);
 
+/*
+ * Validate 'modeline' commands in 'text' of length 'text_len' and display possible
+ * error messages. Return the length of the modeline at the beginning of 'text',
+ * including its new line (0 if there's none).
+ */
+size_t check_modeline(const char *text, size_t text_len, modeline_t modeline);
+
 /*
  * Validate 'modeline' commands in 'copris_text', display possible
  * error messages and remove it from 'copris_text'.
@@ -27,3 +37,11 @@ void apply_modeline(UT_string *copris_text, modeline_t modeline);
  * command variables from 'features'.
  */
 void parse_variables(UT_string *copris_text, struct Inifile **features);
+
+/*
+ * Parse a chunk of text like parse_variables() does. Chunks must end with a new line
+ * (apart from the last one). 'nothing_parsed' carries parser state between chunks of
+ * the same text, and must be set to 0 before the first one.
+ */
+void parse_variables_chunk(UT_string *copris_text, struct Inifile **features,
+                           int *nothing_parsed);
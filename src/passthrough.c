@@ -0,0 +1,282 @@
+/*
+ * Zero-copy passthrough of received text to the output file
+ *
+ * If text needs no conversion, it is moved from the client's socket to the output file
+ * through a pipe with splice(2), and never copied into COPRIS' own memory. Output files
+ * which don't support splicing (some character devices) are written from the pipe with
+ * ordinary read(2)/write(2) calls instead.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'splice', 'pipe2' and F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "socket_io.h"
+#include "passthrough.h"
+#include "writer.h"
+#include "ratelimit.h"
+
+static ssize_t drain_pipe(int pipefd, int outputfd, size_t length, bool *can_splice);
+static int check_limit(int childfd, long long connected, long long last_read,
+                       struct Stats *stats, struct Attribs *attrib);
+static int write_all(int fd, const char *buffer, size_t length);
+
+int copris_passthrough(int childfd, const char *host_address,
+                       struct Stats *stats, struct Attribs *attrib)
+{
+	int outputfd = copris_output_acquire(attrib->output_file);
+	if (outputfd == -1)
+		return -1;
+
+	int pipefd[2];
+	int tmperr = pipe2(pipefd, O_CLOEXEC);
+	if (tmperr != 0) {
+		PRINT_SYSTEM_ERROR("pipe2", "Failed to create passthrough pipe.");
+		copris_output_release(attrib->output_file);
+		return -1;
+	}
+
+	// A pipe as big as the read size moves each chunk at once (if the kernel allows it)
+	fcntl(pipefd[1], F_SETPIPE_SZ, (int)attrib->bufsize);
+
+	int error = 0;
+	bool output_error = false;
+	bool can_splice = true; // Output accepts splice()
+	long long connected = monotonic_ms(); // For client's deadlines
+	long long last_read = 0;
+
+	for (;;) {
+		size_t length = attrib->bufsize;
+
+		// Don't take more than the limit allows
+		if (attrib->limitnum) {
+			if (stats->sum >= attrib->limitnum) {
+				error = check_limit(childfd, connected, last_read, stats, attrib);
+				break;
+			}
+
+			if (length > attrib->limitnum - stats->sum)
+				length = attrib->limitnum - stats->sum;
+		}
+
+		// Don't wait for the client past any of its deadlines. Text, already passed
+		// through, can't be taken back.
+		timeout_t deadline;
+		int wait_time = time_to_deadline(connected, last_read, attrib, &deadline);
+		if (wait_time == 0) {
+			apply_timeout(NULL, childfd, deadline, stats, attrib);
+			break;
+		}
+
+		if (wait_time > 0) {
+			struct pollfd client = { .fd = childfd, .events = POLLIN };
+			int ready = poll(&client, 1, wait_time);
+			if (ready == 0 || (ready == -1 && errno == EINTR))
+				continue;
+
+			if (ready == -1) {
+				PRINT_SYSTEM_ERROR("poll", "Error waiting for socket.");
+				error = -1;
+				break;
+			}
+		}
+
+		// Client, sending too fast, must wait for its allowance
+		int rate_wait;
+		length = ratelimit_allowance(host_address, length, &rate_wait);
+		if (length == 0) {
+			poll(NULL, 0, rate_wait);
+			if (last_read)
+				last_read = monotonic_ms();
+
+			continue;
+		}
+
+		ssize_t received = splice(childfd, NULL, pipefd[1], NULL, length,
+		                          SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (received == -1) {
+			if (errno == EINTR)
+				continue;
+
+			PRINT_SYSTEM_ERROR("splice", "Error moving text from socket.");
+			error = -1;
+			break;
+		}
+
+		if (received == 0)
+			break; /* End of stream */
+
+		stats->chunks++;
+		stats->sum += received;
+		last_read = monotonic_ms();
+		ratelimit_consume(host_address, received);
+
+		if (drain_pipe(pipefd[0], outputfd, received, &can_splice) == -1) {
+			error = -1;
+			output_error = true;
+			break;
+		}
+	}
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	copris_output_release(attrib->output_file);
+
+	// Start afresh with the next job
+	if (output_error)
+		copris_output_close();
+
+	if (!error && LOG_INFO)
+		PRINT_MSG("Passed %zu byte(s) through to %s.",
+		          stats->sum - stats->discarded, attrib->output_file);
+
+	return error;
+}
+
+// Move 'length' bytes from the pipe to the output file.
+// Return number of moved bytes, or -1 on error.
+static ssize_t drain_pipe(int pipefd, int outputfd, size_t length, bool *can_splice)
+{
+	size_t remaining = length;
+
+	while (remaining > 0 && *can_splice) {
+		ssize_t moved = splice(pipefd, NULL, outputfd, NULL, remaining,
+		                       SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (moved == -1) {
+			if (errno == EINTR)
+				continue;
+
+			// Output doesn't support splicing, write the rest in the usual way
+			if (errno == EINVAL) {
+				if (LOG_DEBUG)
+					PRINT_MSG("Output file doesn't support splice(), copying text instead.");
+
+				*can_splice = false;
+				break;
+			}
+
+			PRINT_SYSTEM_ERROR("splice", "Error moving text to output file.");
+			return -1;
+		}
+
+		remaining -= moved;
+	}
+
+	while (remaining > 0) {
+		char buffer[4096];
+		size_t chunk = (remaining < sizeof buffer) ? remaining : sizeof buffer;
+
+		ssize_t buffer_length = read(pipefd, buffer, chunk);
+		if (buffer_length == -1) {
+			if (errno == EINTR)
+				continue;
+
+			PRINT_SYSTEM_ERROR("read", "Error reading from passthrough pipe.");
+			return -1;
+		}
+
+		if (write_all(outputfd, buffer, buffer_length) == -1)
+			return -1;
+
+		remaining -= buffer_length;
+	}
+
+	return length;
+}
+
+// Client has sent exactly the limit; see if there's anything more, but not past any of
+// its deadlines ('connected' and 'last_read' are as in copris_passthrough()). Since
+// received text has already been written, the excess is always cut off.
+static int check_limit(int childfd, long long connected, long long last_read,
+                       struct Stats *stats, struct Attribs *attrib)
+{
+	char buffer[BUFSIZ];
+	ssize_t buffer_length;
+
+	for (;;) {
+		timeout_t deadline;
+		int wait_time = time_to_deadline(connected, last_read, attrib, &deadline);
+		if (wait_time == 0) {
+			apply_timeout(NULL, childfd, deadline, stats, attrib);
+			return 0;
+		}
+
+		if (wait_time > 0) {
+			struct pollfd client = { .fd = childfd, .events = POLLIN };
+			int ready = poll(&client, 1, wait_time);
+			if (ready == 0 || (ready == -1 && errno == EINTR))
+				continue;
+
+			if (ready == -1) {
+				PRINT_SYSTEM_ERROR("poll", "Error waiting for socket.");
+				return -1;
+			}
+		}
+
+		buffer_length = read(childfd, buffer, sizeof buffer);
+		if (buffer_length != -1 || errno != EINTR)
+			break;
+	}
+
+	if (buffer_length == -1) {
+		PRINT_SYSTEM_ERROR("read", "Error reading from socket.");
+		return -1;
+	}
+
+	if (buffer_length == 0)
+		return 0; /* Nothing over the limit */
+
+	const char limit_message[] = "You have sent too much text. Terminating connection.\n";
+	send_to_socket(childfd, limit_message);
+
+	stats->chunks++;
+	stats->sum += buffer_length;
+	stats->discarded = buffer_length;
+	stats->size_limit_active = true;
+
+	if (LOG_ERROR) {
+		if (LOG_INFO)
+			PRINT_LOCATION(stdout);
+
+		printf("Client exceeded send size limit (%zu B/%zu B), cutting off text and "
+		       "terminating connection.\n", stats->sum, attrib->limitnum);
+	}
+
+	return 0;
+}
+
+static int write_all(int fd, const char *buffer, size_t length)
+{
+	while (length > 0) {
+		ssize_t written = write(fd, buffer, length);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+
+			PRINT_SYSTEM_ERROR("write", "Error writing to output file.");
+			return -1;
+		}
+
+		buffer += written;
+		length -= written;
+	}
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+/*
+ * Move text from client's socket 'childfd' directly to the output file from 'attrib',
+ * without converting it, and count it in 'stats'. If a limit is set in 'attrib', text
+ * over the limit is cut off, since everything before it has already been written.
+ * Client's address 'host_address' is used for rate limiting.
+ * Return 0 on success.
+ */
+int copris_passthrough(int childfd, const char *host_address,
+                       struct Stats *stats, struct Attribs *attrib);
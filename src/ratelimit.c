@@ -0,0 +1,151 @@
+/*
+ * Per-client byte rate limiting
+ *
+ * Each client address gets a token bucket, holding up to one second's worth of bytes
+ * and refilled at the chosen rate. A client may only be read from while its bucket
+ * isn't empty, so many clients, sending at once, can't fill up memory faster than
+ * text is processed; the rest waits in their sockets. Connections from the same
+ * address share a bucket.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'memccpy' in ISO C
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <uthash.h>   /* uthash library - hash table      */
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "socket_io.h"
+#include "ratelimit.h"
+
+struct Bucket {
+	char address[HOST_INFO_LENGTH];   /* Client's address (hash key)        */
+	double tokens;                    /* Number of bytes client may send    */
+	long long refilled;               /* Time of last refill (monotonic_ms) */
+	UT_hash_handle hh;
+};
+
+static struct Bucket *find_bucket(const char *host_address);
+static void refill(struct Bucket *bucket, long long now);
+static void evict_buckets(long long now);
+
+static size_t byte_rate = 0;          // Bytes per second, allowed to each client
+static struct Bucket *buckets = NULL;
+static unsigned int bucket_count = 0;
+
+void ratelimit_start(size_t rate)
+{
+	byte_rate = rate;
+}
+
+void ratelimit_stop(void)
+{
+	struct Bucket *bucket;
+	struct Bucket *tmp;
+
+	HASH_ITER(hh, buckets, bucket, tmp) {
+		HASH_DEL(buckets, bucket);
+		free(bucket);
+	}
+
+	bucket_count = 0;
+}
+
+size_t ratelimit_allowance(const char *host_address, size_t wanted, int *wait_time)
+{
+	*wait_time = 0;
+
+	if (!byte_rate)
+		return wanted;
+
+	struct Bucket *bucket = find_bucket(host_address);
+	refill(bucket, monotonic_ms());
+
+	// Rather than letting the client through byte by byte, wait for a sizeable chunk
+	size_t chunk = (byte_rate >= 10) ? byte_rate / 10 : 1;
+	if (chunk > wanted)
+		chunk = wanted;
+
+	if (bucket->tokens >= chunk)
+		return (bucket->tokens < wanted) ? (size_t)bucket->tokens : wanted;
+
+	*wait_time = (int)((chunk - bucket->tokens) * 1000 / byte_rate) + 1;
+	return 0;
+}
+
+void ratelimit_consume(const char *host_address, size_t used)
+{
+	if (!byte_rate)
+		return;
+
+	struct Bucket *bucket = find_bucket(host_address);
+	bucket->tokens -= used;
+}
+
+// Find bucket of client 'host_address', or give it a full one
+static struct Bucket *find_bucket(const char *host_address)
+{
+	struct Bucket *bucket;
+	HASH_FIND_STR(buckets, host_address, bucket);
+
+	if (bucket != NULL)
+		return bucket;
+
+	long long now = monotonic_ms();
+	if (bucket_count >= RATELIMIT_TABLE_SIZE)
+		evict_buckets(now);
+
+	bucket = malloc(sizeof *bucket);
+	CHECK_MALLOC(bucket);
+
+	memccpy(bucket->address, host_address, '\0', HOST_INFO_LENGTH);
+	bucket->address[HOST_INFO_LENGTH - 1] = '\0';
+	bucket->tokens   = byte_rate;
+	bucket->refilled = now;
+
+	HASH_ADD_STR(buckets, address, bucket);
+	bucket_count++;
+
+	return bucket;
+}
+
+static void refill(struct Bucket *bucket, long long now)
+{
+	bucket->tokens += (double)(now - bucket->refilled) * byte_rate / 1000;
+	bucket->refilled = now;
+
+	if (bucket->tokens > byte_rate)
+		bucket->tokens = byte_rate;
+}
+
+// Forget clients whose buckets have filled up again - they are as good as new
+static void evict_buckets(long long now)
+{
+	struct Bucket *bucket;
+	struct Bucket *tmp;
+
+	HASH_ITER(hh, buckets, bucket, tmp) {
+		refill(bucket, now);
+
+		if (bucket->tokens >= byte_rate) {
+			HASH_DEL(buckets, bucket);
+			free(bucket);
+			bucket_count--;
+		}
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("%u client(s) remain rate limited.", bucket_count);
+}
@@ -0,0 +1,20 @@
+/*
+ * Limit each client address to 'rate' bytes per second (0 - unlimited).
+ */
+void ratelimit_start(size_t rate);
+
+/*
+ * Forget all clients.
+ */
+void ratelimit_stop(void);
+
+/*
+ * Return number of bytes, up to 'wanted', client 'host_address' may send right now.
+ * If none, put number of milliseconds until it may send again into 'wait_time'.
+ */
+size_t ratelimit_allowance(const char *host_address, size_t wanted, int *wait_time);
+
+/*
+ * Take 'used' bytes, actually received, from the allowance of client 'host_address'.
+ */
+void ratelimit_consume(const char *host_address, size_t used);
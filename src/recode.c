@@ -3,6 +3,28 @@
  *
  * Terminology note: encoding files consist of definitions.
  *
+ * Once loaded, definitions are compiled into a table, indexed by code point, so recoding
+ * a character takes a table lookup instead of hashing it. The table is split into pages
+ * of RECODE_PAGE_SIZE code points. The first one (ASCII and Latin-1) is always present,
+ * others only if any of their characters are defined. Replacements are stored one after
+ * another in a single buffer.
+ *
+ * A compiled table may also be kept in a cache file, named by a hash of its encoding
+ * files' contents and modification times. Later runs map the file into memory and use
+ * the table straight from it, without parsing the files or allocating anything, and
+ * processes using the same files share its pages. Encoding files, shipped with COPRIS,
+ * are built into it as such tables (see 'builtin_encodings.h').
+ *
+ * Recoding a character doesn't depend on text before it, so a big text may be split
+ * into parts at character boundaries, which are recoded in separate threads and joined
+ * in order.
+ *
+ * Recoding is counted for each text and for all texts so far: bytes before and after,
+ * characters replaced by their definitions, and multibyte characters without one, by
+ * their code point. Only the latter are looked up (in a hash table), and a character is
+ * mostly the same as the previous one without a definition, so counting hardly slows
+ * down recoding.
+ *
  * Copyright (C) 2020 Nejc Bertoncelj <nejc at bertoncelj.eu.org>
  *
  * This file is part of COPRIS, a converting printer server, licensed under the
@@ -12,10 +34,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <limits.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <ini.h>      /* inih library - .ini file parser  */
 #include <uthash.h>   /* uthash library - hash table      */
@@ -24,14 +53,129 @@
 #include "Copris.h"
 #include "debug.h"
 #include "recode.h"
+#include "builtin_encodings.h"
 #include "utf8.h"
 #include "parse_value.h"
+#include "scan.h"
+#include "utstring_cut.h"
+
+// Recoding of a single character, compiled from its definition
+struct Recoding {
+	uint32_t offset;   /* Position of replacement in 'replacements'  */
+	uint16_t length;   /* Its length (0 - character is removed)      */
+	bool defined;      /* Character has a definition                 */
+};
+
+#define RECODE_PAGE_BITS  8
+#define RECODE_PAGE_SIZE  (1 << RECODE_PAGE_BITS)
+#define RECODE_PAGE_COUNT (0x110000 >> RECODE_PAGE_BITS)
+
+// Compiled table, as stored in a cache file or built into COPRIS. The header is followed
+// by numbers of the stored pages (other than the first one), the first page, stray bytes,
+// the stored pages, and replacements.
+struct Table_header {
+	char magic[8];              /* TABLE_MAGIC                                  */
+	uint32_t version;           /* TABLE_VERSION                                */
+	uint32_t page_count;        /* Stored pages, other than the first one       */
+	uint64_t key;               /* Hash of encoding files, the table comes from */
+	uint64_t replacements_size; /* Bytes of replacements                        */
+};
+
+// Multibyte character without a definition, found while recoding
+struct Unmapped {
+	uint32_t codepoint;   /* Its code point                    */
+	size_t count;         /* Number of times it was found      */
+	UT_hash_handle hh;
+};
+
+// Statistics of recoding a text (or a part of it), or all texts so far
+struct Recode_stats {
+	size_t bytes_in;            /* Bytes of text before recoding               */
+	size_t bytes_out;           /* Bytes of text after recoding                */
+	size_t recoded;             /* Characters, replaced by their definitions   */
+	size_t unmapped;            /* Multibyte characters without a definition   */
+	struct Unmapped *histogram; /* The latter, by code point                   */
+	struct Unmapped *last;      /* The last one counted (mostly found again)   */
+};
+
+// Part of a text, recoded in a thread of its own
+struct Recode_part {
+	const char *original; /* Text to recode                              */
+	size_t length;        /* Its length                                  */
+	UT_string *recoded;   /* Recoded text                                */
+	int error;            /* Nonzero if text had undefined characters    */
+	size_t invalid_at;    /* Offset of the first invalid UTF-8 sequence  */
+	struct Recode_stats stats;
+	pthread_t thread;
+	bool threaded;        /* Recoded by 'thread'                         */
+};
+
+// Text, recoded in pieces one after another (see recode_piece())
+struct Recode_pieces {
+	size_t length;        /* Bytes of text, recoded so far               */
+	int error;            /* Nonzero if text had undefined characters    */
+	size_t invalid_at;    /* Offset of the first invalid UTF-8 sequence  */
+	struct Recode_stats stats;
+};
+
+#define TABLE_MAGIC   "COPRISET"
+#define TABLE_VERSION 1
 
 static int inih_handler(void *, const char *, const char *, const char *);
+static void compile_definitions(struct Inifile **encoding);
+static void find_recoded_chars(void);
+static void free_compiled_definitions(void);
+static struct Recoding *find_recoding(uint32_t codepoint, bool add);
+static int hash_encoding_files(char **filenames, int count, uint64_t *key);
+static int map_table_cache(const char *path, uint64_t key);
+static int use_table_image(const void *image, size_t size);
+static int add_image_definitions(const void *image, size_t size, struct Inifile **encoding);
+static const struct Builtin_encoding *find_builtin_encoding(const char *name);
+static int load_builtin_encoding(const char *name, bool only_one, struct Inifile **encoding);
+static void write_table_cache(const char *path, uint64_t key);
+static int recode_parts(UT_string *recoded_text, const char *original, size_t length,
+                        int part_count, size_t *invalid_at, struct Recode_stats *stats);
+static size_t find_part_end(const char *original, size_t position);
+static void *recode_part(void *arg);
+static int recode_span(UT_string *recoded_text, const char *original, size_t length,
+                       size_t *consumed, size_t *invalid_at, struct Recode_stats *stats);
+static void finish_text(struct Recode_stats *stats, size_t invalid_at, size_t length);
+static void count_unmapped(struct Recode_stats *stats, uint32_t codepoint, size_t count);
+static void add_stats(struct Recode_stats *to, struct Recode_stats *from);
+static void copy_stats(struct Recode_stats *to, const struct Recode_stats *from);
+static void free_stats(struct Recode_stats *stats);
+static int compare_unmapped(const struct Unmapped *a, const struct Unmapped *b);
+static void print_stats(const char *what, struct Recode_stats *stats);
+static void write_stats_file(struct Recode_stats *stats);
+static void *stats_writer(void *arg);
+static bool stop_stats_writer(void);
 
 bool error_known = false;
 int previous_definition_count = 0;
 
+// Pages, other than the first, stray bytes and replacements are borrowed (read-only) when
+// the table is used from a cache file or a built-in encoding
+static struct Recoding latin_page[RECODE_PAGE_SIZE];
+static struct Recoding stray_storage[0x80];
+static struct Recoding *pages[RECODE_PAGE_COUNT] = { latin_page };
+static struct Recoding *stray_bytes = stray_storage; // Bytes 0x80-0xFF, not part of a character
+static const char *replacements = NULL;
+static size_t replacements_size = 0;
+static bool table_borrowed = false;
+static void *table_mapping = NULL;              // Cache file, the table is used from
+static size_t table_mapping_size = 0;
+static const struct Inifile *compiled_from = NULL; // Hash table, the table is compiled from
+static struct Scan_set recoded_chars;           // Bytes that may need recoding
+static int recode_threads = 1;                  // Threads, recoding a single text
+static struct Recode_stats totals;              // Statistics of all texts so far
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *stats_file = NULL;           // File, 'totals' are written to
+static pthread_t stats_thread;                  // Writes 'stats_file' while texts come in
+static pid_t stats_thread_owner = 0;            // Process, running it (0 - not running)
+static pthread_cond_t stats_changed = PTHREAD_COND_INITIALIZER;
+static bool stats_pending = false;              // 'totals' changed since last written
+static bool stats_stopping = false;
+
 int load_encoding_file(const char *filename, struct Inifile **encoding)
 {
 	FILE *file = fopen(filename, "r");
@@ -75,6 +219,9 @@ int load_encoding_file(const char *filename, struct Inifile **encoding)
 	if (definition_count < 1)
 		PRINT_NOTE("Your encoding file appears to be empty.");
 
+	// Definitions from all files loaded so far replace the previous table
+	compile_definitions(encoding);
+
 	error = 0;
 
 	// Why parentheses? warning: a label can only be part of a statement and a declaration
@@ -90,6 +237,43 @@ int load_encoding_file(const char *filename, struct Inifile **encoding)
 	return error;
 }
 
+int load_encoding_files(char **filenames, int count, const char *cache_dir,
+                        struct Inifile **encoding)
+{
+	uint64_t key;
+	char path[PATH_MAX];
+	bool use_cache = false;
+
+	if (cache_dir != NULL && hash_encoding_files(filenames, count, &key) == 0) {
+		int length = snprintf(path, sizeof path, "%s/copris-encoding-%016llx.bin",
+		                      cache_dir, (unsigned long long)key);
+		use_cache = (length > 0 && (size_t)length < sizeof path);
+	}
+
+	if (use_cache && map_table_cache(path, key) == 0) {
+		if (LOG_INFO)
+			PRINT_MSG("Using compiled encoding definitions from cache file '%s'.", path);
+
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int error;
+		if (IS_BUILTIN(filenames[i]))
+			error = load_builtin_encoding(filenames[i], count == 1, encoding);
+		else
+			error = load_encoding_file(filenames[i], encoding);
+
+		if (error)
+			return error;
+	}
+
+	if (use_cache)
+		write_table_cache(path, key);
+
+	return 0;
+}
+
 /*
  * [section]
  * name = value  (inih library)
@@ -222,55 +406,1042 @@ void unload_encoding_definitions(struct Inifile **encoding)
 		count++;
 	}
 
+	free_compiled_definitions();
+	previous_definition_count = 0;
+
+	// Totals are final now, so they're written (and sorted) here, without the writer
+	stop_stats_writer();
+
+	if (totals.bytes_in > 0) {
+		if (LOG_DEBUG)
+			print_stats("All texts", &totals);
+
+		if (stats_file != NULL)
+			write_stats_file(&totals);
+	}
+
+	free_stats(&totals);
+
 	if (LOG_DEBUG)
 		PRINT_MSG("Unloaded encoding definitions (count = %d).", count);
 }
 
+// Build the recoding table from definitions in 'encoding'
+static void compile_definitions(struct Inifile **encoding)
+{
+	free_compiled_definitions();
+
+	struct Inifile *s;
+	struct Inifile *tmp;
+	size_t total_length = 0;
+
+	HASH_ITER(hh, *encoding, s, tmp) {
+		total_length += strlen(s->out);
+	}
+
+	char *buffer = malloc(total_length + 1);
+	CHECK_MALLOC(buffer);
+
+	size_t offset = 0;
+	int page_count = 1;
+
+	HASH_ITER(hh, *encoding, s, tmp) {
+		size_t in_len = strlen(s->in);
+		struct Recoding *recoding;
+		uint32_t codepoint;
+
+		if (in_len == 1 && (unsigned char)s->in[0] >= 0x80) {
+			recoding = &stray_bytes[(unsigned char)s->in[0] - 0x80];
+		} else if (utf8_decode(s->in, in_len, &codepoint) == in_len) {
+			if (find_recoding(codepoint, false) == NULL)
+				page_count++;
+
+			recoding = find_recoding(codepoint, true);
+		} else {
+			// No text would ever be recoded with it
+			if (LOG_ERROR)
+				PRINT_MSG("Definition for '%s' is not a valid character, ignoring it.", s->in);
+
+			continue;
+		}
+
+		// Output is copied up to the first NUL byte, as it always was
+		size_t out_len = strlen(s->out);
+		memcpy(buffer + offset, s->out, out_len);
+
+		recoding->offset  = (uint32_t)offset;
+		recoding->length  = (uint16_t)out_len;
+		recoding->defined = true;
+
+		offset += out_len;
+	}
+
+	find_recoded_chars();
+
+	replacements = buffer;
+	replacements_size = offset;
+	compiled_from = *encoding;
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Compiled encoding definitions into %d page(s) of the recoding table "
+		          "and %zu byte(s) of replacements.", page_count, offset);
+}
+
+// Collect bytes that may need recoding; runs of other (ASCII) bytes are copied as they are
+static void find_recoded_chars(void)
+{
+	char ascii_defined[0x80];
+	int ascii_count = 0;
+
+	for (int c = 0; c < 0x80; c++) {
+		if (latin_page[c].defined)
+			ascii_defined[ascii_count++] = (char)c;
+	}
+
+	scan_set_init(&recoded_chars, ascii_defined, ascii_count, true);
+}
+
+static void free_compiled_definitions(void)
+{
+	if (table_mapping != NULL) {
+		munmap(table_mapping, table_mapping_size);
+		table_mapping = NULL;
+	} else if (!table_borrowed) {
+		for (int i = 1; i < RECODE_PAGE_COUNT; i++)
+			free(pages[i]);
+
+		free((char *)replacements);
+	}
+
+	memset(pages, 0, sizeof pages);
+	memset(latin_page, 0, sizeof latin_page);
+	memset(stray_storage, 0, sizeof stray_storage);
+	pages[0] = latin_page;
+	stray_bytes = stray_storage;
+
+	replacements = NULL;
+	replacements_size = 0;
+	table_borrowed = false;
+	compiled_from = NULL;
+
+	scan_set_init(&recoded_chars, NULL, 0, true);
+}
+
+// Find the recoding of 'codepoint'. If 'add' is set, allocate its page if needed.
+// Return the recoding, or NULL if no character of its page is defined.
+static struct Recoding *find_recoding(uint32_t codepoint, bool add)
+{
+	struct Recoding **page = &pages[codepoint >> RECODE_PAGE_BITS];
+
+	if (*page == NULL) {
+		if (!add)
+			return NULL;
+
+		*page = calloc(RECODE_PAGE_SIZE, sizeof **page);
+		CHECK_MALLOC(*page);
+	}
+
+	return &(*page)[codepoint & (RECODE_PAGE_SIZE - 1)];
+}
+
+// Hash contents, sizes and modification times of encoding files 'filenames' (FNV-1a),
+// along with the table's layout, into 'key'. Built-in encodings are hashed by their table.
+// Return 0 on success.
+static int hash_encoding_files(char **filenames, int count, uint64_t *key)
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	const uint64_t prime = 0x100000001B3;
+
+	#define HASH_BYTES(data, size) \
+		for (size_t n = 0; n < (size); n++) \
+			hash = (hash ^ ((const unsigned char *)(data))[n]) * prime;
+
+	uint32_t layout[] = { TABLE_VERSION, RECODE_PAGE_BITS, sizeof(struct Recoding) };
+	HASH_BYTES(layout, sizeof layout);
+
+	for (int i = 0; i < count; i++) {
+		if (IS_BUILTIN(filenames[i])) {
+			const struct Builtin_encoding *builtin = find_builtin_encoding(filenames[i]);
+			if (builtin == NULL)
+				return -1; /* Reported once the encoding is loaded */
+
+			HASH_BYTES(builtin->image, builtin->size);
+			continue;
+		}
+
+		int fd = open(filenames[i], O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			return -1; /* Reported once the file is loaded */
+
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
+			close(fd);
+			return -1;
+		}
+
+		int64_t stamp[] = { st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+		HASH_BYTES(stamp, sizeof stamp);
+
+		// Contents are mapped, like the cache file; an empty file can't be mapped
+		void *mapping = MAP_FAILED;
+		if (st.st_size > 0)
+			mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+
+		if (st.st_size > 0) {
+			if (mapping == MAP_FAILED)
+				return -1;
+
+			HASH_BYTES(mapping, (size_t)st.st_size);
+			munmap(mapping, st.st_size);
+		}
+	}
+
+	#undef HASH_BYTES
+
+	*key = hash;
+	return 0;
+}
+
+// Map the compiled table from cache file 'path', if it's there and made for 'key'.
+// Return 0 on success.
+static int map_table_cache(const char *path, uint64_t key)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			PRINT_SYSTEM_ERROR("open", "Failed to open encoding cache file '%s'.", path);
+
+		return -1;
+	}
+
+	struct stat st;
+	void *mapping = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct Table_header))
+		mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		if (LOG_ERROR)
+			PRINT_MSG("Failed to map encoding cache file '%s', ignoring it.", path);
+
+		return -1;
+	}
+
+	const struct Table_header *header = mapping;
+	if (header->key != key || use_table_image(mapping, st.st_size) != 0) {
+		if (LOG_ERROR)
+			PRINT_MSG("Encoding cache file '%s' is damaged, replacing it.", path);
+
+		munmap(mapping, st.st_size);
+		return -1;
+	}
+
+	table_mapping = mapping;
+	table_mapping_size = st.st_size;
+
+	return 0;
+}
+
+// Check compiled table 'image' of 'size' bytes, and recode with it from now on.
+// Return 0 on success.
+static int use_table_image(const void *image, size_t size)
+{
+	const struct Table_header *header = image;
+
+	if (size < sizeof *header ||
+	    memcmp(header->magic, TABLE_MAGIC, sizeof header->magic) != 0 ||
+	    header->version != TABLE_VERSION || header->page_count >= RECODE_PAGE_COUNT)
+		return -1;
+
+	const uint32_t *page_numbers = (const uint32_t *)(header + 1);
+	size_t recoding_count = RECODE_PAGE_SIZE + 0x80 +
+	                        (size_t)header->page_count * RECODE_PAGE_SIZE;
+	struct Recoding *table = (struct Recoding *)(page_numbers + header->page_count);
+
+	if (size != sizeof *header + header->page_count * sizeof *page_numbers +
+	            recoding_count * sizeof *table + header->replacements_size)
+		return -1;
+
+	// A replacement outside of the table would be read from anywhere
+	for (size_t i = 0; i < recoding_count; i++) {
+		if (table[i].defined &&
+		    (uint64_t)table[i].offset + table[i].length > header->replacements_size)
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < header->page_count; i++) {
+		if (page_numbers[i] == 0 || page_numbers[i] >= RECODE_PAGE_COUNT)
+			return -1;
+	}
+
+	free_compiled_definitions();
+
+	// The first page is copied, as it's looked at for every byte of text
+	memcpy(latin_page, table, sizeof latin_page);
+	stray_bytes = table + RECODE_PAGE_SIZE;
+
+	struct Recoding *page = stray_bytes + 0x80;
+	for (uint32_t i = 0; i < header->page_count; i++, page += RECODE_PAGE_SIZE)
+		pages[page_numbers[i]] = page;
+
+	replacements = (const char *)(table + recoding_count);
+	replacements_size = header->replacements_size;
+	table_borrowed = true;
+
+	find_recoded_chars();
+
+	return 0;
+}
+
+// Add definitions from compiled table 'image' of 'size' bytes to hash table 'encoding',
+// replacing existing ones, as if they were loaded from an encoding file.
+// Return 0 on success.
+static int add_image_definitions(const void *image, size_t size, struct Inifile **encoding)
+{
+	// Decoding the image into a table is the easiest way of walking it
+	if (use_table_image(image, size) != 0)
+		return -1;
+
+	for (uint32_t codepoint = 0; codepoint < 0x110000 + 0x80; codepoint++) {
+		const struct Recoding *recoding;
+		char in[UTF8_MAX_LENGTH + 1];
+		size_t in_len;
+
+		if (codepoint < 0x110000) {
+			if ((codepoint & (RECODE_PAGE_SIZE - 1)) == 0 &&
+			    pages[codepoint >> RECODE_PAGE_BITS] == NULL) {
+				codepoint += RECODE_PAGE_SIZE - 1; /* Skip the whole page */
+				continue;
+			}
+
+			recoding = find_recoding(codepoint, false);
+			in_len = utf8_encode(codepoint, in);
+		} else {
+			recoding = &stray_bytes[codepoint - 0x110000];
+			in[0] = (char)(0x80 + codepoint - 0x110000);
+			in_len = 1;
+		}
+
+		if (!recoding->defined)
+			continue;
+
+		if (in_len >= MAX_INIFILE_ELEMENT_LENGTH ||
+		    recoding->length >= MAX_INIFILE_ELEMENT_LENGTH) {
+			PRINT_ERROR_MSG("Built-in definition is longer than the maximum of %zu bytes.",
+			                (size_t)MAX_INIFILE_ELEMENT_LENGTH);
+			return -1;
+		}
+
+		in[in_len] = '\0';
+
+		struct Inifile *s;
+		HASH_FIND_STR(*encoding, in, s);
+
+		if (s == NULL) {
+			s = malloc(sizeof *s);
+			CHECK_MALLOC(s);
+
+			memcpy(s->in, in, in_len + 1);
+			HASH_ADD_STR(*encoding, in, s);
+		}
+
+		memcpy(s->out, replacements + recoding->offset, recoding->length);
+		s->out[recoding->length] = '\0';
+	}
+
+	return 0;
+}
+
+// Find built-in encoding 'name' (with its prefix).
+// Return the encoding, or NULL if there's no such encoding.
+static const struct Builtin_encoding *find_builtin_encoding(const char *name)
+{
+	name += strlen(BUILTIN_PREFIX);
+
+	for (int i = 0; i < builtin_encoding_count; i++) {
+		if (strcmp(builtin_encodings[i].name, name) == 0)
+			return &builtin_encodings[i];
+	}
+
+	return NULL;
+}
+
+// Load built-in encoding 'name'. If it's the only one ('only_one'), recode with its
+// table directly, else add its definitions to 'encoding', like load_encoding_file() does.
+// Return 0 on success.
+static int load_builtin_encoding(const char *name, bool only_one, struct Inifile **encoding)
+{
+	const struct Builtin_encoding *builtin = find_builtin_encoding(name);
+	if (builtin == NULL) {
+		PRINT_ERROR_MSG("Encoding '%s' isn't built into COPRIS. Built-in encodings are "
+		                "listed by 'copris --version'.", name);
+		return -1;
+	}
+
+	if (only_one) {
+		if (use_table_image(builtin->image, builtin->size) != 0) {
+			PRINT_ERROR_MSG("Built-in encoding '%s' is damaged.", name);
+			return -1;
+		}
+
+		if (LOG_INFO)
+			PRINT_MSG("Using built-in encoding '%s'.", name);
+
+		return 0;
+	}
+
+	if (add_image_definitions(builtin->image, builtin->size, encoding) != 0) {
+		PRINT_ERROR_MSG("Failed to load built-in encoding '%s'.", name);
+		return -1;
+	}
+
+	if (LOG_INFO)
+		PRINT_MSG("Loaded definitions from built-in encoding '%s'.", name);
+
+	// Definitions from all files loaded so far replace the previous table
+	previous_definition_count = HASH_COUNT(*encoding);
+	compile_definitions(encoding);
+
+	return 0;
+}
+
+int save_encoding_image(FILE *file, uint64_t key)
+{
+	struct Table_header header = { .version = TABLE_VERSION, .key = key,
+	                               .replacements_size = replacements_size };
+	memcpy(header.magic, TABLE_MAGIC, sizeof header.magic);
+
+	for (uint32_t i = 1; i < RECODE_PAGE_COUNT; i++) {
+		if (pages[i] != NULL)
+			header.page_count++;
+	}
+
+	fwrite(&header, sizeof header, 1, file);
+
+	for (uint32_t i = 1; i < RECODE_PAGE_COUNT; i++) {
+		if (pages[i] != NULL)
+			fwrite(&i, sizeof i, 1, file);
+	}
+
+	fwrite(latin_page, sizeof latin_page, 1, file);
+	fwrite(stray_bytes, sizeof *stray_bytes, 0x80, file);
+
+	for (int i = 1; i < RECODE_PAGE_COUNT; i++) {
+		if (pages[i] != NULL)
+			fwrite(pages[i], sizeof *pages[i], RECODE_PAGE_SIZE, file);
+	}
+
+	fwrite(replacements, 1, replacements_size, file);
+
+	return ferror(file);
+}
+
+// Write the compiled table to cache file 'path', made for 'key'. It's written under
+// a temporary name first, so other processes never map a half-written file.
+static void write_table_cache(const char *path, uint64_t key)
+{
+	char temp_path[PATH_MAX + 32];
+	snprintf(temp_path, sizeof temp_path, "%s.%ld", path, (long)getpid());
+
+	FILE *file = fopen(temp_path, "wb");
+	if (file == NULL) {
+		PRINT_SYSTEM_ERROR("fopen", "Failed to create encoding cache file '%s'.", temp_path);
+		return;
+	}
+
+	int error = save_encoding_image(file, key);
+	if (fclose(file) != 0 || error) {
+		PRINT_SYSTEM_ERROR("fwrite", "Failed to write encoding cache file '%s'.", temp_path);
+		unlink(temp_path);
+		return;
+	}
+
+	if (rename(temp_path, path) != 0) {
+		PRINT_SYSTEM_ERROR("rename", "Failed to store encoding cache file '%s'.", path);
+		unlink(temp_path);
+		return;
+	}
+
+	if (LOG_INFO)
+		PRINT_MSG("Stored compiled encoding definitions in cache file '%s'.", path);
+}
+
+void recode_set_threads(int count)
+{
+	recode_threads = (count < 1) ? 1 : (count > MAX_RECODE_THREADS) ? MAX_RECODE_THREADS : count;
+}
+
+void recode_set_stats_file(const char *path)
+{
+	// Totals, not written yet, still belong to the previous file
+	if (stop_stats_writer() && stats_file != NULL) {
+		struct Recode_stats copy = { 0 };
+
+		pthread_mutex_lock(&totals_lock);
+		copy_stats(&copy, &totals);
+		pthread_mutex_unlock(&totals_lock);
+
+		write_stats_file(&copy);
+		free_stats(&copy);
+	}
+
+	stats_file = path;
+}
+
 int recode_text(UT_string *copris_text, struct Inifile **encoding)
 {
+	size_t length = utstring_len(copris_text);
+	size_t part_count = length / RECODE_PART_MIN;
+	if (part_count > (size_t)recode_threads)
+		part_count = recode_threads;
+
 	UT_string *recoded_text;
 	utstring_new(recoded_text);
+	utstring_reserve(recoded_text, length);
+
+	assert(*encoding == compiled_from);
+	(void)encoding;
+
+	int error;
+	size_t invalid_at;
+	struct Recode_stats stats = { 0 };
+
+	if (part_count > 1)
+		error = recode_parts(recoded_text, utstring_body(copris_text), length,
+		                     (int)part_count, &invalid_at, &stats);
+	else
+		error = recode_span(recoded_text, utstring_body(copris_text), length, NULL,
+		                    &invalid_at, &stats);
+
+	finish_text(&stats, invalid_at, length);
+
+	// Replace input text, and free it along with the temporary string
+	utstring_swap(copris_text, recoded_text);
+	utstring_free(recoded_text);
+
+	return error;
+}
+
+// Split 'length' bytes of text 'original' into 'part_count' parts of about the same
+// length, recode them in separate threads, and append them to 'recoded_text' in order.
+// Put the offset of the first invalid UTF-8 sequence (or 'length') into 'invalid_at',
+// and add statistics of all parts to 'stats'.
+// Return 0 on success or nonzero if text contained undefined characters.
+static int recode_parts(UT_string *recoded_text, const char *original, size_t length,
+                        int part_count, size_t *invalid_at, struct Recode_stats *stats)
+{
+	struct Recode_part parts[MAX_RECODE_THREADS];
+	int count = 0;
+	size_t start = 0;
+
+	for (int i = 1; i <= part_count; i++) {
+		size_t end = (i == part_count) ? length
+		                               : find_part_end(original, length / part_count * i);
+
+		// No boundary found, the next part takes this one's text
+		if (end <= start)
+			continue;
+
+		parts[count] = (struct Recode_part){ .original = &original[start],
+		                                     .length = end - start };
+		utstring_new(parts[count].recoded);
+		utstring_reserve(parts[count].recoded, end - start);
+
+		start = end;
+		count++;
+	}
+
+	// The first part is recoded by the calling thread, as are parts whose thread failed
+	// to start
+	for (int i = 1; i < count; i++) {
+		int tmperr = pthread_create(&parts[i].thread, NULL, recode_part, &parts[i]);
+		parts[i].threaded = (tmperr == 0);
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (!parts[i].threaded)
+			recode_part(&parts[i]);
+	}
+
+	size_t recoded_length = 0;
+	for (int i = 0; i < count; i++) {
+		if (parts[i].threaded)
+			pthread_join(parts[i].thread, NULL);
+
+		recoded_length += utstring_len(parts[i].recoded);
+	}
+
+	utstring_reserve_tail(recoded_text, recoded_length);
 
 	int error = 0;
-	const char *original = utstring_body(copris_text);
+	*invalid_at = length;
+
+	for (int i = 0; i < count; i++) {
+		utstring_bincpy(recoded_text, utstring_body(parts[i].recoded),
+		                utstring_len(parts[i].recoded));
+		utstring_free(parts[i].recoded);
+		error |= parts[i].error;
+		add_stats(stats, &parts[i].stats);
+
+		if (parts[i].invalid_at < parts[i].length && *invalid_at == length)
+			*invalid_at = (size_t)(parts[i].original - original) + parts[i].invalid_at;
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Recoded %zu byte(s) of text in %d part(s).", length, count);
+
+	return error;
+}
+
+// Find a boundary, at or shortly before 'position' of text 'original', where recoding
+// a whole text would start a new character. No character, that may start in the three
+// bytes before it, would go past it (the same check utf8_terminate_incomplete_buffer()
+// makes), so it's a boundary even in text, which isn't valid UTF-8.
+// Return the boundary, or 0 if there's none close enough.
+static size_t find_part_end(const char *original, size_t position)
+{
+	for (size_t back = 0; back < 64 && back < position; back++) {
+		if (utf8_incomplete_length(original, position - back) == 0)
+			return position - back;
+	}
+
+	return 0;
+}
+
+static void *recode_part(void *arg)
+{
+	struct Recode_part *part = arg;
+
+	part->error = recode_span(part->recoded, part->original, part->length, NULL,
+	                          &part->invalid_at, &part->stats);
+
+	return NULL;
+}
+
+int recode_buffer(UT_string *recoded_text, const char *original, size_t length,
+                  struct Inifile **encoding)
+{
+	assert(*encoding == compiled_from);
+	(void)encoding;
+
+	size_t invalid_at;
+	struct Recode_stats stats = { 0 };
+	int error = recode_span(recoded_text, original, length, NULL, &invalid_at, &stats);
+
+	pthread_mutex_lock(&totals_lock);
+	add_stats(&totals, &stats);
+	pthread_mutex_unlock(&totals_lock);
+
+	return error;
+}
+
+bool recode_in_parts(size_t length)
+{
+	return (recode_threads > 1 && length / RECODE_PART_MIN > 1);
+}
+
+struct Recode_pieces *recode_begin(void)
+{
+	struct Recode_pieces *text = calloc(1, sizeof *text);
+	CHECK_MALLOC(text);
+
+	text->invalid_at = SIZE_MAX;
+
+	return text;
+}
+
+size_t recode_piece(struct Recode_pieces *text, UT_string *recoded_text, const char *original,
+                    size_t length, bool last, struct Inifile **encoding)
+{
+	assert(*encoding == compiled_from);
+	(void)encoding;
+
+	size_t consumed = length;
+	size_t invalid_at;
+
+	text->error |= recode_span(recoded_text, original, length, last ? NULL : &consumed,
+	                           &invalid_at, &text->stats);
+
+	if (invalid_at < consumed && text->invalid_at == SIZE_MAX)
+		text->invalid_at = text->length + invalid_at;
+
+	text->length += consumed;
+
+	return consumed;
+}
+
+int recode_end(struct Recode_pieces *text)
+{
+	int error = text->error;
+	finish_text(&text->stats, (text->invalid_at == SIZE_MAX) ? text->length : text->invalid_at,
+	            text->length);
+	free(text);
+
+	return error;
+}
+
+// Report statistics 'stats' of recoding a text of 'length' bytes, whose first invalid
+// UTF-8 sequence is at 'invalid_at' (or 'length'), and add them to the totals.
+static void finish_text(struct Recode_stats *stats, size_t invalid_at, size_t length)
+{
+	if (invalid_at < length && LOG_INFO)
+		PRINT_MSG("Text isn't valid UTF-8, its first invalid sequence is at byte %zu.",
+		          invalid_at);
+
+	if (LOG_DEBUG)
+		print_stats("Text", stats);
+
+	pthread_mutex_lock(&totals_lock);
+	add_stats(&totals, stats);
+
+	// Statistics file is written by a thread of its own, at most every few seconds
+	if (stats_file != NULL && !stats_pending) {
+		stats_pending = true;
+
+		if (stats_thread_owner != getpid()) {
+			int tmperr = pthread_create(&stats_thread, NULL, stats_writer, NULL);
+			if (tmperr != 0) {
+				errno = tmperr;
+				PRINT_SYSTEM_ERROR("pthread_create", "Failed to start recoding statistics "
+				                   "writer, '%s' will only be written at exit.", stats_file);
+			} else {
+				stats_thread_owner = getpid();
+			}
+		}
+
+		pthread_cond_signal(&stats_changed);
+	}
+
+	pthread_mutex_unlock(&totals_lock);
+}
+
+// Recode 'length' bytes of text 'original' and append the result to 'recoded_text'.
+// If 'consumed' isn't NULL, text continues past 'length': stop before a sequence that
+// may go on past it, and put the number of recoded bytes into 'consumed'.
+// Put the offset of the first invalid UTF-8 sequence (or 'length') into 'invalid_at',
+// and add statistics of recoding to 'stats'.
+// Return 0 on success or nonzero if text contained undefined characters.
+static int recode_span(UT_string *recoded_text, const char *original, size_t length,
+                       size_t *consumed, size_t *invalid_at, struct Recode_stats *stats)
+{
+	int error = 0;
+	size_t recoded_count = 0;
+	size_t start_length = utstring_len(recoded_text);
+	*invalid_at = length;
+
+	// Recoded text is mostly about as long as the original
+	utstring_reserve_tail(recoded_text, length);
 
-	for (size_t i = 0; i < utstring_len(copris_text);) {
-		char input_char[UTF8_MAX_LENGTH + 1];
+	size_t i = 0;
+
+	while (i < length) {
+		unsigned char c = (unsigned char)original[i];
+		const struct Recoding *recoding;
 		size_t input_len;
-		char output_char[MAX_INIFILE_ELEMENT_LENGTH];
-		size_t output_len;
-		struct Inifile *s;
+		uint32_t codepoint;
 
-		if (UTF8_IS_MULTIBYTE(original[i])) {
-			input_len = utf8_codepoint_length(original[i]);
-			memcpy(input_char, &original[i], input_len);
-		} else {
+		if (c < 0x80 && !latin_page[c].defined) {
+			size_t plain_len = scan_span(&recoded_chars, &original[i], length - i);
+
+			utstring_bincpy(recoded_text, &original[i], plain_len);
+			i += plain_len;
+			continue;
+		}
+
+		if (c < 0x80) {
 			input_len = 1;
-			input_char[0] = original[i];
+			recoding = &latin_page[c];
+		} else if ((input_len = utf8_decode(&original[i], length - i, &codepoint)) > 0) {
+			recoding = find_recoding(codepoint, false);
+		} else {
+			// Not a valid character; skip as many bytes as its first one announces
+			input_len = utf8_codepoint_length(original[i]);
+
+			// The rest of it may follow in the next piece of text
+			if (consumed != NULL && input_len > length - i)
+				break;
+
+			if (*invalid_at == length)
+				*invalid_at = i;
+
+			codepoint = 0; // Not counted as a character without a definition
+
+			if (input_len > length - i)
+				input_len = length - i;
+
+			recoding = (input_len == 1) ? &stray_bytes[c - 0x80] : NULL;
 		}
-		input_char[input_len] = '\0';
 
-		HASH_FIND_STR(*encoding, input_char, s);
-		if (s) {
+		const char *output;
+		size_t output_len;
+
+		if (recoding != NULL && recoding->defined) {
 			// Definition found
-			output_len = strlen(s->out);
-			memcpy(output_char, s->out, output_len);
+			output = replacements + recoding->offset;
+			output_len = recoding->length;
+			recoded_count++;
 		} else {
 			// Definition not found, copy original
+			output = &original[i];
 			output_len = input_len;
-			memcpy(output_char, input_char, output_len);
 			if (input_len > 1) {
 				error = 1; // Warn user if multi-byte characters are really wanted
+
+				if (codepoint >= 0x80)
+					count_unmapped(stats, codepoint, 1);
 			}
 		}
 
-		utstring_bincpy(recoded_text, output_char, output_len);
+		utstring_reserve_tail(recoded_text, output_len);
+
+		// Most characters are replaced by (or left as) a single byte
+		if (output_len == 1)
+			*utstring_tail(recoded_text) = *output;
+		else
+			memcpy(utstring_tail(recoded_text), output, output_len);
+
+		recoded_text->i += output_len;
 		i += input_len;
 	}
 
-	utstring_clear(copris_text);
-	utstring_concat(copris_text, recoded_text);
-	utstring_free(recoded_text);
+	utstring_body(recoded_text)[utstring_len(recoded_text)] = '\0';
+
+	if (consumed != NULL)
+		*consumed = i;
+
+	stats->bytes_in += i;
+	stats->bytes_out += utstring_len(recoded_text) - start_length;
+	stats->recoded += recoded_count;
 
 	return error;
 }
+
+// Count 'count' occurrences of character 'codepoint' without a definition into 'stats'.
+static void count_unmapped(struct Recode_stats *stats, uint32_t codepoint, size_t count)
+{
+	struct Unmapped *unmapped = stats->last;
+
+	if (unmapped == NULL || unmapped->codepoint != codepoint)
+		HASH_FIND(hh, stats->histogram, &codepoint, sizeof codepoint, unmapped);
+
+	if (unmapped == NULL) {
+		unmapped = malloc(sizeof *unmapped);
+		CHECK_MALLOC(unmapped);
+
+		unmapped->codepoint = codepoint;
+		unmapped->count = 0;
+		HASH_ADD(hh, stats->histogram, codepoint, sizeof unmapped->codepoint, unmapped);
+	}
+
+	unmapped->count += count;
+	stats->unmapped += count;
+	stats->last = unmapped;
+}
+
+// Add statistics 'from' to 'to', and free the former's characters without a definition.
+static void add_stats(struct Recode_stats *to, struct Recode_stats *from)
+{
+	to->bytes_in += from->bytes_in;
+	to->bytes_out += from->bytes_out;
+	to->recoded += from->recoded;
+
+	// The number of characters without a definition is added up by count_unmapped()
+	struct Unmapped *unmapped;
+	struct Unmapped *tmp;
+
+	HASH_ITER(hh, from->histogram, unmapped, tmp) {
+		count_unmapped(to, unmapped->codepoint, unmapped->count);
+		HASH_DEL(from->histogram, unmapped);
+		free(unmapped);
+	}
+
+	from->last = NULL;
+}
+
+// Copy statistics 'from' (without their last counted character) to empty 'to'.
+static void copy_stats(struct Recode_stats *to, const struct Recode_stats *from)
+{
+	to->bytes_in = from->bytes_in;
+	to->bytes_out = from->bytes_out;
+	to->recoded = from->recoded;
+
+	for (struct Unmapped *unmapped = from->histogram; unmapped != NULL;
+	     unmapped = unmapped->hh.next)
+		count_unmapped(to, unmapped->codepoint, unmapped->count);
+
+	to->last = NULL;
+}
+
+// Free characters without a definition of 'stats' and clear them.
+static void free_stats(struct Recode_stats *stats)
+{
+	struct Unmapped *unmapped;
+	struct Unmapped *tmp;
+
+	HASH_ITER(hh, stats->histogram, unmapped, tmp) {
+		HASH_DEL(stats->histogram, unmapped);
+		free(unmapped);
+	}
+
+	*stats = (struct Recode_stats){ 0 };
+}
+
+// Order characters without a definition from the most frequent one on.
+static int compare_unmapped(const struct Unmapped *a, const struct Unmapped *b)
+{
+	if (a->count != b->count)
+		return (a->count < b->count) ? 1 : -1;
+
+	return (a->codepoint > b->codepoint) - (a->codepoint < b->codepoint);
+}
+
+// Print statistics 'stats' of 'what', with up to RECODE_TOP_UNMAPPED most frequent
+// characters without a definition.
+static void print_stats(const char *what, struct Recode_stats *stats)
+{
+	PRINT_MSG("%s: recoded %zu byte(s) into %zu byte(s), replacing %zu character(s).",
+	          what, stats->bytes_in, stats->bytes_out, stats->recoded);
+
+	if (stats->histogram == NULL)
+		return;
+
+	HASH_SORT(stats->histogram, compare_unmapped);
+
+	PRINT_LOCATION(stdout);
+	printf("%s: %zu character(s) had no definition (%u different), most often",
+	       what, stats->unmapped, HASH_COUNT(stats->histogram));
+
+	int shown = 0;
+	for (struct Unmapped *unmapped = stats->histogram;
+	     unmapped != NULL && shown < RECODE_TOP_UNMAPPED;
+	     unmapped = unmapped->hh.next, shown++) {
+		char character[UTF8_MAX_LENGTH + 1];
+		character[utf8_encode(unmapped->codepoint, character)] = '\0';
+
+		printf("%s U+%04X '%s' (%zu)", (shown > 0) ? "," : "",
+		       (unsigned int)unmapped->codepoint, character, unmapped->count);
+	}
+
+	printf(".\n");
+}
+
+// Write statistics 'stats' of all texts so far to 'stats_file', with characters without
+// a definition as commented-out definitions, ready to be filled in and added to an
+// encoding file. It's written under a temporary name first, so it's never half-written.
+static void write_stats_file(struct Recode_stats *stats)
+{
+	char temp_path[PATH_MAX + 32];
+	snprintf(temp_path, sizeof temp_path, "%s.%ld", stats_file, (long)getpid());
+
+	FILE *file = fopen(temp_path, "w");
+	if (file == NULL) {
+		PRINT_SYSTEM_ERROR("fopen", "Failed to create recoding statistics file '%s'.",
+		                   temp_path);
+		return;
+	}
+
+	fprintf(file, "; Recoding statistics of all texts so far\n"
+	        "; Bytes before recoding: %zu\n"
+	        "; Bytes after recoding: %zu\n"
+	        "; Characters, replaced by their definitions: %zu\n"
+	        "; Characters without a definition: %zu (%u different)\n",
+	        stats->bytes_in, stats->bytes_out, stats->recoded, stats->unmapped,
+	        HASH_COUNT(stats->histogram));
+
+	if (stats->histogram != NULL)
+		fprintf(file, ";\n; Characters without a definition, the most frequent first."
+		        "\n; Uncomment them and fill in their definitions.\n");
+
+	HASH_SORT(stats->histogram, compare_unmapped);
+
+	struct Unmapped *unmapped;
+	for (unmapped = stats->histogram; unmapped != NULL; unmapped = unmapped->hh.next) {
+		char character[UTF8_MAX_LENGTH + 1];
+		character[utf8_encode(unmapped->codepoint, character)] = '\0';
+
+		fprintf(file, "\n; U+%04X, found %zu time(s)\n;%s = \n",
+		        (unsigned int)unmapped->codepoint, unmapped->count, character);
+	}
+
+	if (fclose(file) != 0) {
+		PRINT_SYSTEM_ERROR("fclose", "Failed to write recoding statistics file '%s'.",
+		                   temp_path);
+		unlink(temp_path);
+		return;
+	}
+
+	if (rename(temp_path, stats_file) != 0) {
+		PRINT_SYSTEM_ERROR("rename", "Failed to store recoding statistics file '%s'.",
+		                   stats_file);
+		unlink(temp_path);
+	}
+}
+
+// Write 'totals' to 'stats_file', once they've changed and RECODE_STATS_INTERVAL seconds
+// have passed, so that texts, recoded in the meantime, are written at once. They're
+// copied, then sorted and written without holding up recoding of other texts.
+static void *stats_writer(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&totals_lock);
+
+	for (;;) {
+		while (!stats_pending && !stats_stopping)
+			pthread_cond_wait(&stats_changed, &totals_lock);
+
+		struct timespec write_at;
+		clock_gettime(CLOCK_REALTIME, &write_at);
+		write_at.tv_sec += RECODE_STATS_INTERVAL;
+
+		while (!stats_stopping &&
+		       pthread_cond_timedwait(&stats_changed, &totals_lock, &write_at) != ETIMEDOUT)
+			;
+
+		// Final totals are written once definitions are unloaded
+		if (stats_stopping)
+			break;
+
+		struct Recode_stats copy = { 0 };
+		copy_stats(&copy, &totals);
+		stats_pending = false;
+
+		pthread_mutex_unlock(&totals_lock);
+
+		write_stats_file(&copy);
+		free_stats(&copy);
+
+		pthread_mutex_lock(&totals_lock);
+	}
+
+	pthread_mutex_unlock(&totals_lock);
+
+	return NULL;
+}
+
+// Stop the statistics writer (if running in this process) and wait for it to finish.
+// Return true if 'totals' have changed since they were last written.
+static bool stop_stats_writer(void)
+{
+	pthread_mutex_lock(&totals_lock);
+
+	bool running = (stats_thread_owner == getpid());
+	stats_stopping = true;
+	pthread_cond_broadcast(&stats_changed);
+
+	pthread_mutex_unlock(&totals_lock);
+
+	if (running)
+		pthread_join(stats_thread, NULL);
+
+	bool pending = stats_pending;
+	stats_thread_owner = 0;
+	stats_pending = false;
+	stats_stopping = false;
+
+	return pending;
+}
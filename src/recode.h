@@ -4,11 +4,45 @@
  */
 int load_encoding_file(const char *filename, struct Inifile **encoding);
 
+/*
+ * Load encoding files 'filenames' (their 'count') one after another, like
+ * load_encoding_file() does. Names with BUILTIN_PREFIX select encodings, built into
+ * COPRIS. If 'cache_dir' isn't NULL, use definitions, compiled from the same files, from
+ * a cache file in that directory instead, or store them there if there's no such file
+ * yet. Definitions, used from a cache file or a single built-in encoding, aren't put
+ * into the hash table.
+ * Return 0 on success.
+ */
+int load_encoding_files(char **filenames, int count, const char *cache_dir,
+                        struct Inifile **encoding);
+
+/*
+ * Write definitions, loaded so far, to 'file' as a compiled table, which can be used
+ * as a cache file for encoding files with hash 'key', or built into COPRIS.
+ * Return 0 on success.
+ */
+int save_encoding_image(FILE *file, uint64_t key);
+
 /*
  * Unload encoding hash table, passed on by 'encoding'.
  */
 void unload_encoding_definitions(struct Inifile **encoding);
 
+/*
+ * Let recode_text() split texts, bigger than RECODE_PART_MIN, into up to 'count' parts
+ * at character boundaries, and recode them in as many threads (1 - recode in the
+ * calling thread).
+ */
+void recode_set_threads(int count);
+
+/*
+ * Write statistics of recoding all texts so far to file 'path' every RECODE_STATS_INTERVAL
+ * seconds while texts are recoded, and once definitions are unloaded (NULL - don't write
+ * them). Statistics, not yet written to the previous file, are written to it first.
+ * They're also printed with '-vv', as are those of each text.
+ */
+void recode_set_stats_file(const char *path);
+
 /*
  * Take input text 'copris_text' and recode it according to definitions, passed on by
  * 'encoding' hash table. Put recoded text into 'copris_text', overwriting previous content.
@@ -16,3 +50,42 @@ void unload_encoding_definitions(struct Inifile **encoding);
  * hash table.
  */
 int recode_text(UT_string *copris_text, struct Inifile **encoding);
+
+/*
+ * Recode 'length' bytes of text 'original' like recode_text() does, and append
+ * the result to 'recoded_text'.
+ * Return 0 on success or nonzero if text contained characters, not present in the
+ * 'encoding' hash table.
+ */
+int recode_buffer(UT_string *recoded_text, const char *original, size_t length,
+                  struct Inifile **encoding);
+
+/*
+ * Return true if recode_text() would split a text of 'length' bytes into parts, recoded
+ * in several threads.
+ */
+bool recode_in_parts(size_t length);
+
+/*
+ * Begin recoding a single text in pieces, handed over one after another with
+ * recode_piece(). Return its state, which is freed by recode_end().
+ */
+struct Recode_pieces *recode_begin(void);
+
+/*
+ * Recode the next piece of 'text', 'length' bytes of 'original', according to definitions,
+ * passed on by 'encoding' hash table, and append the result to 'recoded_text'. Unless
+ * this is the 'last' piece, a character that may go on in the next piece isn't recoded;
+ * it has to begin the next piece.
+ * Return the number of recoded bytes.
+ */
+size_t recode_piece(struct Recode_pieces *text, UT_string *recoded_text, const char *original,
+                    size_t length, bool last, struct Inifile **encoding);
+
+/*
+ * End recoding 'text' in pieces, report its statistics like recode_text() does, and
+ * free it.
+ * Return 0 on success or nonzero if text contained characters, not present in the
+ * 'encoding' hash table.
+ */
+int recode_end(struct Recode_pieces *text);
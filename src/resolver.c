@@ -0,0 +1,291 @@
+/*
+ * Cached reverse lookup of client host names
+ *
+ * Host names are only used for reporting connections, so they are looked up in a
+ * separate thread by default, and connections are handled without waiting for them.
+ * Resolved names (and failed lookups) are cached by client address for RESOLVE_TTL
+ * seconds. Until a name is known, its connection is reported by address alone. Once
+ * the cache is full of hosts, waiting for a lookup, new clients aren't looked up.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'getnameinfo' and 'memccpy' in ISO C
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <errno.h>
+
+#include <uthash.h>   /* uthash library - hash table      */
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "socket_io.h"
+#include "resolver.h"
+
+struct Host {
+	char address[HOST_INFO_LENGTH];   /* Client's address (hash key)           */
+	char name[HOST_INFO_LENGTH];      /* Client's host name, once resolved     */
+	struct sockaddr_storage addr;     /* Client's address, for the lookup      */
+	socklen_t addr_length;
+	time_t expires;                   /* When the name must be looked up again */
+	bool pending;                     /* Waiting in queue for a lookup         */
+	struct Host *next;                /* Next host in the lookup queue         */
+	UT_hash_handle hh;
+};
+
+static void *resolver_thread(void *);
+static void lookup_name(const struct sockaddr *addr, socklen_t addr_length, char *name);
+static void evict_hosts(void);
+
+static resolve_t resolve_mode = RESOLVE_OFF;
+static bool running = false;
+
+static pthread_t thread;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lookup_requested = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+static struct Host *hosts = NULL;       // Cache of host names, in order of insertion
+static unsigned int host_count = 0;
+static struct Host *queue_head = NULL;  // Hosts, waiting for a lookup
+static struct Host *queue_tail = NULL;
+
+int resolver_start(resolve_t mode)
+{
+	resolve_mode = mode;
+
+	if (mode != RESOLVE_ASYNC)
+		return 0;
+
+	int tmperr = pthread_create(&thread, NULL, resolver_thread, NULL);
+	if (tmperr != 0) {
+		errno = tmperr;
+		PRINT_SYSTEM_ERROR("pthread_create", "Failed to start host name resolver thread.");
+		return -1;
+	}
+
+	running = true;
+	return 0;
+}
+
+void resolver_stop(void)
+{
+	pthread_mutex_lock(&cache_lock);
+
+	stopping = true;
+	pthread_cond_broadcast(&lookup_requested);
+
+	// A lookup in progress isn't waited for; its result is simply thrown away
+	if (running)
+		pthread_detach(thread);
+
+	running = false;
+
+	struct Host *host, *tmp;
+	HASH_ITER(hh, hosts, host, tmp) {
+		HASH_DEL(hosts, host);
+		free(host);
+	}
+
+	host_count = 0;
+	queue_head = queue_tail = NULL;
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+bool resolver_get_name(const struct sockaddr *addr, socklen_t addr_length,
+                       const char *host_address, char *host_info)
+{
+	if (resolve_mode == RESOLVE_OFF) {
+		memccpy(host_info, "name unknown", '\0', HOST_INFO_LENGTH);
+		return false;
+	}
+
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&cache_lock);
+
+	struct Host *host;
+	HASH_FIND_STR(hosts, host_address, host);
+
+	// Known and still valid (a pending lookup keeps the previous name)
+	if (host != NULL && (host->pending || host->expires > now)) {
+		bool known = (*host->name != '\0');
+		memccpy(host_info, known ? host->name : "name pending", '\0', HOST_INFO_LENGTH);
+
+		pthread_mutex_unlock(&cache_lock);
+		return known;
+	}
+
+	if (host == NULL) {
+		if (host_count >= RESOLVE_CACHE_SIZE)
+			evict_hosts();
+
+		// Every cached host waits for a lookup, so this one isn't looked up at all
+		if (host_count >= RESOLVE_CACHE_SIZE) {
+			pthread_mutex_unlock(&cache_lock);
+
+			if (LOG_DEBUG)
+				PRINT_MSG("Host name cache is full of pending lookups, not looking up "
+				          "%s.", host_address);
+
+			memccpy(host_info, host_address, '\0', HOST_INFO_LENGTH);
+			host_info[HOST_INFO_LENGTH - 1] = '\0';
+			return false;
+		}
+
+		host = calloc(1, sizeof *host);
+		CHECK_MALLOC(host);
+
+		memccpy(host->address, host_address, '\0', HOST_INFO_LENGTH);
+		host->address[HOST_INFO_LENGTH - 1] = '\0';
+		HASH_ADD_STR(hosts, address, host);
+		host_count++;
+	}
+
+	memcpy(&host->addr, addr, addr_length);
+	host->addr_length = addr_length;
+
+	if (resolve_mode == RESOLVE_SYNC) {
+		// Blocking lookup, but the cache still saves repeated ones
+		pthread_mutex_unlock(&cache_lock);
+
+		char name[HOST_INFO_LENGTH];
+		lookup_name(addr, addr_length, name);
+
+		pthread_mutex_lock(&cache_lock);
+		memccpy(host->name, name, '\0', HOST_INFO_LENGTH);
+		host->expires = now + RESOLVE_TTL;
+		memccpy(host_info, name, '\0', HOST_INFO_LENGTH);
+
+		pthread_mutex_unlock(&cache_lock);
+		return true;
+	}
+
+	// Let the resolver thread look it up, and use the previous name meanwhile
+	host->pending = true;
+	host->next = NULL;
+
+	if (queue_tail == NULL)
+		queue_head = host;
+	else
+		queue_tail->next = host;
+
+	queue_tail = host;
+	pthread_cond_signal(&lookup_requested);
+
+	bool known = (*host->name != '\0');
+	memccpy(host_info, known ? host->name : "name pending", '\0', HOST_INFO_LENGTH);
+
+	pthread_mutex_unlock(&cache_lock);
+	return known;
+}
+
+bool resolver_cached_name(const char *host_address, char *host_info)
+{
+	if (resolve_mode == RESOLVE_OFF)
+		return false;
+
+	pthread_mutex_lock(&cache_lock);
+
+	struct Host *host;
+	HASH_FIND_STR(hosts, host_address, host);
+
+	bool known = (host != NULL && *host->name != '\0');
+	if (known)
+		memccpy(host_info, host->name, '\0', HOST_INFO_LENGTH);
+
+	pthread_mutex_unlock(&cache_lock);
+	return known;
+}
+
+static void *resolver_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (;;) {
+		while (queue_head == NULL && !stopping)
+			pthread_cond_wait(&lookup_requested, &cache_lock);
+
+		if (stopping)
+			break;
+
+		struct Host *host = queue_head;
+		queue_head = host->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+
+		// Host may be evicted during the lookup, so work on a copy
+		char address[HOST_INFO_LENGTH];
+		struct sockaddr_storage addr;
+		socklen_t addr_length = host->addr_length;
+		memcpy(address, host->address, HOST_INFO_LENGTH);
+		memcpy(&addr, &host->addr, addr_length);
+
+		pthread_mutex_unlock(&cache_lock);
+
+		char name[HOST_INFO_LENGTH];
+		lookup_name((struct sockaddr *)&addr, addr_length, name);
+
+		pthread_mutex_lock(&cache_lock);
+
+		if (stopping)
+			break;
+
+		HASH_FIND_STR(hosts, address, host);
+		if (host != NULL) {
+			memccpy(host->name, name, '\0', HOST_INFO_LENGTH);
+			host->expires = time(NULL) + RESOLVE_TTL;
+			host->pending = false;
+		}
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	return NULL;
+}
+
+static void lookup_name(const struct sockaddr *addr, socklen_t addr_length, char *name)
+{
+	int tmperr = getnameinfo(addr, addr_length, name, HOST_INFO_LENGTH, NULL, 0, 0);
+	if (tmperr != 0) {
+		if (LOG_DEBUG)
+			PRINT_MSG("getnameinfo: Failed getting hostname from address (%s).",
+			          gai_strerror(tmperr));
+
+		memccpy(name, "name unknown", '\0', HOST_INFO_LENGTH);
+	}
+
+	name[HOST_INFO_LENGTH - 1] = '\0';
+}
+
+// Make room in a full cache by removing the oldest hosts, not waiting for a lookup
+static void evict_hosts(void)
+{
+	struct Host *host, *tmp;
+	HASH_ITER(hh, hosts, host, tmp) {
+		if (host_count < RESOLVE_CACHE_SIZE)
+			break;
+
+		if (host->pending)
+			continue;
+
+		HASH_DEL(hosts, host);
+		free(host);
+		host_count--;
+	}
+}
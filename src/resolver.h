@@ -0,0 +1,28 @@
+/*
+ * Start resolving host names in 'mode': in a separate thread (RESOLVE_ASYNC), while
+ * the connection waits (RESOLVE_SYNC), or not at all (RESOLVE_OFF).
+ * Return 0 on success.
+ */
+int resolver_start(resolve_t mode);
+
+/*
+ * Stop resolving host names and empty the cache. A lookup in progress is abandoned.
+ */
+void resolver_stop(void);
+
+/*
+ * Put host name of client 'addr' (of length 'addr_length'), whose address is
+ * 'host_address', into 'host_info' of HOST_INFO_LENGTH bytes. If the name isn't
+ * cached (or has expired), look it up, either right away or in the background. If
+ * the cache is full of pending lookups, 'host_info' gets the address instead.
+ * Return true if the name is known, false if 'host_info' only holds a placeholder.
+ */
+bool resolver_get_name(const struct sockaddr *addr, socklen_t addr_length,
+                       const char *host_address, char *host_info);
+
+/*
+ * Update 'host_info' with the cached host name of client 'host_address', if a lookup
+ * has finished in the meantime. Never starts a lookup.
+ * Return true if the name is known.
+ */
+bool resolver_cached_name(const char *host_address, char *host_info);
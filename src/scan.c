@@ -0,0 +1,77 @@
+/*
+ * Scanning text for bytes that need attention
+ *
+ * Most received text is plain 7-bit ASCII, which recoding and Markdown parsing copy
+ * unchanged. Instead of looking at it byte by byte, they look for the next byte that
+ * needs handling and copy the run before it at once. With SSE2 (always present on
+ * x86-64), 16 bytes are compared at a time; elsewhere, a byte table is walked.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+#include "scan.h"
+
+void scan_set_init(struct Scan_set *set, const char *bytes, int count, bool high_bit)
+{
+	memset(set, 0, sizeof *set);
+
+	set->high_bit = high_bit;
+	set->count = count;
+
+	for (int i = 0; i < count; i++) {
+		set->table[(unsigned char)bytes[i]] = true;
+
+		if (i < SCAN_MAX_BYTES)
+			set->bytes[i] = bytes[i];
+	}
+
+	if (high_bit) {
+		for (int c = 0x80; c <= 0xFF; c++)
+			set->table[c] = true;
+	}
+}
+
+size_t scan_span(const struct Scan_set *set, const char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// Sets too big to compare against would take longer than walking the table
+	if (set->count <= SCAN_MAX_BYTES) {
+		__m128i needles[SCAN_MAX_BYTES];
+		for (int k = 0; k < set->count; k++)
+			needles[k] = _mm_set1_epi8(set->bytes[k]);
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)(s + i));
+
+			// The mask is made of each byte's high bit, so a chunk marks its own
+			// non-ASCII bytes
+			__m128i hits = set->high_bit ? chunk : _mm_setzero_si128();
+
+			for (int k = 0; k < set->count; k++)
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[k]));
+
+			int mask = _mm_movemask_epi8(hits);
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	while (i < len && !set->table[(unsigned char)s[i]])
+		i++;
+
+	return i;
+}
@@ -0,0 +1,25 @@
+// Number of single bytes a set may have, so it's still scanned with vector instructions
+#define SCAN_MAX_BYTES 8
+
+/*
+ * Set of bytes, scan_span() stops at. Use scan_set_init() to fill it, or initialise it
+ * statically with matching 'bytes' and 'table'.
+ */
+struct Scan_set {
+	char bytes[SCAN_MAX_BYTES]; /* Bytes to stop at (if there are few of them)  */
+	int count;                  /* Number of bytes to stop at                   */
+	bool high_bit;              /* Also stop at every byte with the high bit set */
+	bool table[256];            /* All bytes to stop at, for the scalar scan    */
+};
+
+/*
+ * Fill 'set' with 'count' bytes from 'bytes', and with all non-ASCII bytes if 'high_bit'
+ * is set.
+ */
+void scan_set_init(struct Scan_set *set, const char *bytes, int count, bool high_bit);
+
+/*
+ * Find the first byte of 's', holding 'len' bytes, that is in 'set'.
+ * Return its position, or 'len' if there's none.
+ */
+size_t scan_span(const struct Scan_set *set, const char *s, size_t len);
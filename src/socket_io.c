@@ -7,14 +7,24 @@
  * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
  */
 
-// For 'getnameinfo' and 'memccpy' in ISO C
-#define _XOPEN_SOURCE 700
+// For 'getnameinfo', 'memccpy' and SO_REUSEPORT
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
@@ -26,35 +36,120 @@
 #include "debug.h"
 #include "socket_io.h"
 #include "utf8.h"
+#include "streaming.h"
+#include "resolver.h"
+#include "ratelimit.h"
+#include "passthrough.h"
 #include "utstring_cut.h"
 
-static int read_from_socket(UT_string *copris_text, int childfd,
-                             struct Stats *stats, struct Attribs *attrib);
-static void apply_byte_limit(UT_string *copris_text, int childfd,
+// First descriptor, passed by the service manager (SD_LISTEN_FDS_START)
+#define LISTEN_FDS_START 3
+
+static int listen_on_port(int *parentfd, struct Attribs *attrib);
+static int listen_on_path(int *parentfd, struct Attribs *attrib);
+static int make_passive(int parentfd, struct Attribs *attrib);
+static void format_address(struct sockaddr_storage *clientaddr, char *host_address);
+static int read_from_socket(UT_string *copris_text, int childfd, const char *host_address,
                              struct Stats *stats, struct Attribs *attrib);
 
-/*
- * Round backlog to a power of 2.
- * https://stackoverflow.com/a/5111841
- */
-#define BACKLOG 2
+static pid_t socket_file_owner = 0; // Process which created the Unix domain socket file
+
+int copris_socket_inherited(void)
+{
+	const char *listen_pid = getenv("LISTEN_PID");
+	const char *listen_fds = getenv("LISTEN_FDS");
+
+	if (listen_pid == NULL || listen_fds == NULL)
+		return -1;
+
+	// Variables are meant for this very process, not any of its descendants
+	char *parse_error;
+	unsigned long pid = strtoul(listen_pid, &parse_error, 10);
+	if (*parse_error || pid != (unsigned long)getpid())
+		return -1;
+
+	unsigned long fds = strtoul(listen_fds, &parse_error, 10);
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	if (*parse_error || fds == 0)
+		return -1;
+
+	if (fds > 1)
+		PRINT_NOTE("More than one socket was passed by the service manager, only "
+		           "the first one will be used.");
 
-int copris_socket_listen(int *parentfd, unsigned int portno)
+	return LISTEN_FDS_START;
+}
+
+int copris_socket_listen(int *parentfd, struct Attribs *attrib)
+{
+	int tmperr;
+
+	if (attrib->inherited_fd != -1) {
+		// Socket is already bound and listening, just make sure it suits us
+		int type = 0, accepting = 0;
+		socklen_t optlen = sizeof(int);
+		tmperr = getsockopt(attrib->inherited_fd, SOL_SOCKET, SO_TYPE, &type, &optlen);
+		optlen = sizeof(int);
+		tmperr |= getsockopt(attrib->inherited_fd, SOL_SOCKET, SO_ACCEPTCONN,
+		                     &accepting, &optlen);
+
+		if (tmperr != 0 || type != SOCK_STREAM || !accepting) {
+			PRINT_ERROR_MSG("Descriptor %d, passed by the service manager, is not a "
+			                "listening stream socket.", attrib->inherited_fd);
+			return -1;
+		}
+
+		*parentfd = attrib->inherited_fd;
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Using socket, passed by the service manager.");
+	} else if (attrib->socket_path) {
+		tmperr = listen_on_path(parentfd, attrib);
+		if (tmperr != 0)
+			return -1;
+	} else {
+		tmperr = listen_on_port(parentfd, attrib);
+		if (tmperr != 0)
+			return -1;
+	}
+
+	return make_passive(*parentfd, attrib);
+}
+
+static int listen_on_port(int *parentfd, struct Attribs *attrib)
 {
 	/*
 	 * Create a system socket using the following:
+	 *   AF_INET6     IPv6 (and IPv4 through mapped addresses, if dual-stack), or
 	 *   AF_INET      IPv4
 	 *   SOCK_STREAM  TCP protocol
 	 *   IPPROTO_IP   IP protocol
 	 */
-	*parentfd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	int family = (attrib->address_family == AF_INET) ? AF_INET : AF_INET6;
+
+	*parentfd = socket(family, SOCK_STREAM, IPPROTO_IP);
+
+	// Fall back to IPv4, if the system lacks IPv6 and user didn't insist on it
+	if (*parentfd == -1 && errno == EAFNOSUPPORT && attrib->address_family == AF_UNSPEC) {
+		if (LOG_DEBUG)
+			PRINT_MSG("IPv6 is not supported, listening on IPv4 only.");
+
+		family = AF_INET;
+		*parentfd = socket(family, SOCK_STREAM, IPPROTO_IP);
+	}
+
 	if (*parentfd == -1) {
 		PRINT_SYSTEM_ERROR("socket", "Failed to create socket endpoint.");
 		return -1;
 	}
 
 	if (LOG_DEBUG)
-		PRINT_MSG("Socket endpoint created.");
+		PRINT_MSG("Socket endpoint created (%s).", (family == AF_INET) ? "IPv4" :
+		          (attrib->address_family == AF_INET6) ? "IPv6" : "IPv6 and IPv4");
 
 	/*
 	 * A hack from tcpserver.c:87
@@ -66,15 +161,49 @@ int copris_socket_listen(int *parentfd, unsigned int portno)
 	setsockopt(*parentfd, SOL_SOCKET, SO_REUSEADDR,
 	           (const void *)&optval, sizeof(int));
 
+	// Let listener processes share the port; the kernel spreads connections among them
+	if (attrib->listeners > 1) {
+		int tmperr = setsockopt(*parentfd, SOL_SOCKET, SO_REUSEPORT,
+		                        (const void *)&optval, sizeof(int));
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("setsockopt", "Failed to share port among listeners.");
+			return -1;
+		}
+	}
+
+	// Dual-stack socket also accepts IPv4 clients, IPv6-only one doesn't
+	if (family == AF_INET6) {
+		int v6only = (attrib->address_family == AF_INET6);
+		int tmperr = setsockopt(*parentfd, IPPROTO_IPV6, IPV6_V6ONLY,
+		                        (const void *)&v6only, sizeof(int));
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("setsockopt", "Failed to set up IPv6 socket.");
+			return -1;
+		}
+	}
+
 // 	memset((char *)&serveraddr, '\0', sizeof(serveraddr)); // TODO: is this necessary?
 
-	struct sockaddr_in serveraddr; // Server's own address
-	serveraddr.sin_family      = AF_INET;
-	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	serveraddr.sin_port        = htons((unsigned short)portno);
-	
+	struct sockaddr_storage serveraddr; // Server's own address
+	socklen_t serverlen;
+	memset(&serveraddr, 0, sizeof(serveraddr));
+
+	if (family == AF_INET6) {
+		struct sockaddr_in6 *serveraddr6 = (struct sockaddr_in6 *)&serveraddr;
+		serveraddr6->sin6_family = AF_INET6;
+		serveraddr6->sin6_addr   = in6addr_any;
+		serveraddr6->sin6_port   = htons((unsigned short)attrib->portno);
+		serverlen = sizeof(*serveraddr6);
+	} else {
+		struct sockaddr_in *serveraddr4 = (struct sockaddr_in *)&serveraddr;
+		serveraddr4->sin_family      = AF_INET;
+		serveraddr4->sin_addr.s_addr = htonl(INADDR_ANY);
+		serveraddr4->sin_port        = htons((unsigned short)attrib->portno);
+		serverlen = sizeof(*serveraddr4);
+	}
+
 	// Associate the parent socket with a port
-	int tmperr = bind(*parentfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr));
+	int tmperr = bind(*parentfd, (struct sockaddr *)&serveraddr, serverlen);
 	if (tmperr != 0) {
 		PRINT_SYSTEM_ERROR("bind", "Failed to bind socket to address. "
 		                           "Non-root users should set it >1023.");
@@ -84,14 +213,90 @@ int copris_socket_listen(int *parentfd, unsigned int portno)
 	if (LOG_DEBUG)
 		PRINT_MSG("Socket bound to address.");
 
-	// Make the parent socket passive - accept incoming connections.
-	// Limit number of connections to the value of BACKLOG.
-	tmperr = listen(*parentfd, BACKLOG);
+	return 0;
+}
+
+static int listen_on_path(int *parentfd, struct Attribs *attrib)
+{
+	struct sockaddr_un serveraddr;
+	memset(&serveraddr, 0, sizeof(serveraddr));
+	serveraddr.sun_family = AF_UNIX;
+	memccpy(serveraddr.sun_path, attrib->socket_path, '\0', sizeof(serveraddr.sun_path));
+
+	*parentfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (*parentfd == -1) {
+		PRINT_SYSTEM_ERROR("socket", "Failed to create socket endpoint.");
+		return -1;
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Socket endpoint created (Unix domain).");
+
+	// A socket file, left behind by a previous run, would make bind() fail. Remove
+	// it, but only if nobody is listening on it anymore.
+	struct stat file_info;
+	if (lstat(attrib->socket_path, &file_info) == 0 && S_ISSOCK(file_info.st_mode)) {
+		int probefd = socket(AF_UNIX, SOCK_STREAM, 0);
+		int tmperr = connect(probefd, (struct sockaddr *)&serveraddr, sizeof(serveraddr));
+		int connect_errno = errno;
+		close(probefd);
+
+		if (tmperr == 0) {
+			PRINT_ERROR_MSG("Another server is already listening on '%s'.",
+			                attrib->socket_path);
+			return -1;
+		}
+
+		if (connect_errno == ECONNREFUSED) {
+			if (LOG_DEBUG)
+				PRINT_MSG("Removing stale socket file '%s'.", attrib->socket_path);
+
+			unlink(attrib->socket_path);
+		}
+	}
+
+	int tmperr = bind(*parentfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr));
 	if (tmperr != 0) {
-		PRINT_SYSTEM_ERROR("listen", "Failed to make socket passive.");
+		PRINT_SYSTEM_ERROR("bind", "Failed to bind socket to '%s'.", attrib->socket_path);
 		return -1;
 	}
 
+	socket_file_owner = getpid();
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Socket bound to '%s'.", attrib->socket_path);
+
+	return 0;
+}
+
+static int make_passive(int parentfd, struct Attribs *attrib)
+{
+	// Accepted sockets inherit the receive buffer size of the listening one
+	if (attrib->rcvbuf) {
+		int tmperr = setsockopt(parentfd, SOL_SOCKET, SO_RCVBUF,
+		                        (const void *)&attrib->rcvbuf, sizeof(int));
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("setsockopt", "Failed to set socket receive buffer size.");
+			return -1;
+		}
+
+		if (LOG_DEBUG) {
+			int rcvbuf = 0;
+			socklen_t rcvbuf_length = sizeof(rcvbuf);
+			getsockopt(parentfd, SOL_SOCKET, SO_RCVBUF, (void *)&rcvbuf, &rcvbuf_length);
+			PRINT_MSG("Socket receive buffer size set to %d bytes.", rcvbuf);
+		}
+	}
+
+	// Service manager has already made its socket passive
+	if (attrib->inherited_fd == -1) {
+		int tmperr = listen(parentfd, attrib->backlog);
+		if (tmperr != 0) {
+			PRINT_SYSTEM_ERROR("listen", "Failed to make socket passive.");
+			return -1;
+		}
+	}
+
 	if (LOG_INFO) {
 		PRINT_LOCATION(stdout);
 
@@ -104,12 +309,69 @@ int copris_socket_listen(int *parentfd, unsigned int portno)
 	return 0;
 }
 
+void remove_socket_file(const struct Attribs *attrib)
+{
+	if (socket_file_owner != getpid())
+		return;
+
+	if (unlink(attrib->socket_path) != 0)
+		PRINT_SYSTEM_ERROR("unlink", "Failed to remove socket file '%s'.", attrib->socket_path);
+	else if (LOG_DEBUG)
+		PRINT_MSG("Socket file '%s' removed.", attrib->socket_path);
+
+	socket_file_owner = 0;
+}
+
+int copris_spawn_listeners(int *parentfd, struct Attribs *attrib)
+{
+	// Don't let children inherit (and repeat) buffered messages
+	fflush(stdout);
+	fflush(stderr);
+
+	// Children are never waited for
+	signal(SIGCHLD, SIG_IGN);
+
+	for (int listener = 1; listener < attrib->listeners; listener++) {
+		pid_t pid = fork();
+		if (pid == -1) {
+			PRINT_SYSTEM_ERROR("fork", "Failed to start listener process.");
+			return -1;
+		}
+
+		if (pid > 0)
+			continue;
+
+		// Child: stop together with the original process
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() == 1)
+			_exit(EXIT_SUCCESS);
+
+		// Each listener on a port needs its own socket to have connections spread among
+		// them. Sockets on a path (or passed by the service manager) are shared instead.
+		if (attrib->socket_path == NULL && attrib->inherited_fd == -1) {
+			close(*parentfd);
+
+			int tmperr = copris_socket_listen(parentfd, attrib);
+			if (tmperr != 0)
+				return -1;
+		}
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Listener %d started with PID %d.", listener, getpid());
+
+		return listener;
+	}
+
+	return 0;
+}
+
 int copris_handle_socket(UT_string *copris_text, int *parentfd, int *childfd,
                          struct Attribs *attrib)
 {
-	struct sockaddr_in clientaddr;  // Client's address
-	socklen_t clientlen;            // (Byte) size of client's address (sockaddr)
+	struct sockaddr_storage clientaddr; // Client's address
+	socklen_t clientlen;                // (Byte) size of client's address (sockaddr)
 	clientlen = sizeof(clientaddr);
+	memset(&clientaddr, 0, sizeof(clientaddr));
 	int tmperr;
 
 	// Wait for a connection request, accept it and pass it on as a child socket
@@ -128,57 +390,304 @@ int copris_handle_socket(UT_string *copris_text, int *parentfd, int *childfd,
 
 		if (tmperr != 0)
 			return tmperr;
-	}
 
-	// Get host info (IP, hostname) of the client (TODO gai_strerror)
-	char host_info[256];
-	tmperr = getnameinfo((struct sockaddr *)&clientaddr, sizeof(clientaddr),
-	                      host_info, sizeof(host_info), NULL, 0, 0);
-	if (tmperr != 0) {
-		PRINT_SYSTEM_ERROR("getnameinfo", "Failed getting hostname from address.");
-		memccpy(host_info, "name unknown", '\0', 256);
+		if (attrib->socket_path)
+			remove_socket_file(attrib);
 	}
 
-	// Convert client's address from network byte order to a dotted-decimal form
-	char *host_address = inet_ntoa(clientaddr.sin_addr);
-	char addr_unknown[] = "<address unknown>";
-	if (host_address == NULL) {
-		PRINT_ERROR_MSG("inet_ntoa: Failed converting host's address to dotted decimal.\n");
-		host_address = addr_unknown;
+	// Get host info (IP, hostname) of the client
+	char host_info[HOST_INFO_LENGTH];
+	char host_address[HOST_INFO_LENGTH];
+	get_client_info(&clientaddr, clientlen, host_info, host_address);
+
+	// Read text from socket and process it, or pass it straight to the output file
+	struct Stats stats = STATS_INIT;
+	int read_error;
+	if (attrib->copris_flags & PASSTHROUGH)
+		read_error = copris_passthrough(*childfd, host_address, &stats, attrib);
+	else
+		read_error = read_from_socket(copris_text, *childfd, host_address, &stats, attrib);
+
+	if (read_error)
+		return -1;
+
+	print_end_of_stream(&stats, attrib);
+
+	// Host name may have been resolved in the meantime
+	resolver_cached_name(host_address, host_info);
+
+	if (LOG_INFO)
+		PRINT_MSG("Connection from %s (%s) closed.", host_info, host_address);
+
+	return 0;
+}
+
+void get_client_info(struct sockaddr_storage *clientaddr, socklen_t clientlen,
+                     char *host_info, char *host_address)
+{
+	format_address(clientaddr, host_address);
+
+	// Local clients have no name worth showing
+	if (clientaddr->ss_family == AF_UNIX) {
+		memccpy(host_info, "local client", '\0', HOST_INFO_LENGTH);
+
+		if (LOG_ERROR) {
+			if (LOG_INFO)
+				PRINT_LOCATION(stdout);
+
+			puts("Inbound connection from a local client.");
+		}
+
+		return;
 	}
 
+	// Get the client's hostname from cache, without waiting for it if so chosen
+	bool name_known = resolver_get_name((struct sockaddr *)clientaddr, clientlen,
+	                                    host_address, host_info);
+
 	if (LOG_ERROR) {
 		if (LOG_INFO)
 			PRINT_LOCATION(stdout);
 
-		printf("Inbound connection from %s (%s).\n", host_info, host_address);
+		if (name_known)
+			printf("Inbound connection from %s (%s).\n", host_info, host_address);
+		else
+			printf("Inbound connection from %s.\n", host_address);
 	}
+}
 
-	// Read text from socket and process it
-	struct Stats stats = STATS_INIT;
-	int read_error = read_from_socket(copris_text, *childfd, &stats, attrib);
-	if (read_error)
-		return -1;
+void get_client_address(int childfd, char *host_address)
+{
+	struct sockaddr_storage clientaddr;
+	socklen_t clientlen = sizeof clientaddr;
+
+	if (getpeername(childfd, (struct sockaddr *)&clientaddr, &clientlen) == -1) {
+		memccpy(host_address, "<address unknown>", '\0', HOST_INFO_LENGTH);
+		return;
+	}
+
+	format_address(&clientaddr, host_address);
+}
+
+// Put printable address of client 'clientaddr' into 'host_address'
+static void format_address(struct sockaddr_storage *clientaddr, char *host_address)
+{
+	int family = clientaddr->ss_family;
+
+	// Local clients have no address worth showing
+	if (family == AF_UNIX) {
+		memccpy(host_address, "local socket", '\0', HOST_INFO_LENGTH);
+		return;
+	}
+
+	const void *addr = &((struct sockaddr_in *)clientaddr)->sin_addr;
+
+	if (family == AF_INET6) {
+		const struct in6_addr *addr6 = &((struct sockaddr_in6 *)clientaddr)->sin6_addr;
+
+		// IPv4 clients of a dual-stack socket are shown in the usual dotted-decimal form
+		if (IN6_IS_ADDR_V4MAPPED(addr6)) {
+			family = AF_INET;
+			addr = &addr6->s6_addr[12];
+		} else {
+			addr = addr6;
+		}
+	}
+
+	// Convert client's address from network byte order to a printable form
+	const char *address = inet_ntop(family, addr, host_address, HOST_INFO_LENGTH);
+	if (address == NULL) {
+		PRINT_SYSTEM_ERROR("inet_ntop", "Failed converting host's address to printable form.");
+		memccpy(host_address, "<address unknown>", '\0', HOST_INFO_LENGTH);
+	}
+}
+
+void print_end_of_stream(const struct Stats *stats, const struct Attribs *attrib)
+{
+	if (!LOG_ERROR)
+		return;
+
+	if (LOG_INFO)
+		PRINT_LOCATION(stdout);
+
+	printf("End of stream, received %zu byte(s) in %d chunk(s)", stats->sum, stats->chunks);
+
+	if (stats->size_limit_active) {
+		printf(", %zu byte(s) %s", stats->discarded,
+		       (attrib->copris_flags & MUST_CUTOFF) ? "cut off" : "discarded");
+	} else if (stats->timed_out != TIMEOUT_NONE && stats->discarded) {
+		printf(", %zu byte(s) discarded after a timeout", stats->discarded);
+	} else if (stats->timed_out != TIMEOUT_NONE) {
+		printf(", client timed out");
+	}
+
+	printf(".\n");
+}
+
+size_t byte_limit(const struct Stats *stats, const struct Attribs *attrib)
+{
+	if (stats->announced && (!attrib->limitnum || stats->announced < attrib->limitnum))
+		return stats->announced;
+
+	return attrib->limitnum;
+}
+
+size_t read_size(const struct Stats *stats, const struct Attribs *attrib)
+{
+	// Read at most a byte over the limit, just enough to tell that it's been crossed
+	size_t limit = byte_limit(stats, attrib);
+	if (limit && limit - stats->sum < attrib->bufsize)
+		return limit - stats->sum + 1;
+
+	return attrib->bufsize;
+}
+
+int check_length_header(UT_string *copris_text, int childfd, bool *header_checked,
+                        struct Stats *stats, struct Attribs *attrib)
+{
+	// Without a limit, the header would serve no purpose, so it's left in the text
+	if (!attrib->limitnum) {
+		*header_checked = true;
+		return 0;
+	}
+
+	const char header[] = LENGTH_HEADER;
+	const size_t header_length = sizeof(header) - 1;
+	char *text = utstring_body(copris_text);
+	size_t text_length = utstring_len(copris_text);
+
+	// Wait for more text, if what has arrived could still turn out to be the header
+	size_t compared = (text_length < header_length) ? text_length : header_length;
+	if (memcmp(text, header, compared) != 0) {
+		*header_checked = true;
+		return 0;
+	}
+
+	char *line_end = memchr(text, '\n', text_length);
+	if (line_end == NULL) {
+		// Too long for a header, so it's just text
+		if (text_length >= LENGTH_HEADER_MAX)
+			*header_checked = true;
+
+		return 0;
+	}
+
+	*header_checked = true;
+
+	char *parse_error;
+	unsigned long long announced = strtoull(text + header_length, &parse_error, 10);
+	if (parse_error == text + header_length || (*parse_error != '\n' && *parse_error != '\r')) {
+		if (LOG_DEBUG)
+			PRINT_MSG("Malformed length header, treating it as text.");
+
+		return 0;
+	}
+
+	// Header isn't part of the text
+	size_t line_length = line_end - text + 1;
+	memmove(text, line_end + 1, text_length - line_length);
+	utstring_cut(copris_text, text_length - line_length);
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Client announced %llu byte(s) of text.", announced);
+
+	// Text, longer than announced, is cut off or discarded like one over the limit
+	if (announced + line_length <= attrib->limitnum) {
+		stats->announced = announced + line_length;
+		return 0;
+	}
+
+	const char limit_message[] = "Your text is too long. Terminating connection.\n";
+	send_to_socket(childfd, limit_message);
+
+	stats->size_limit_active = true;
+	stats->discarded = stats->sum;
+	utstring_clear(copris_text);
 
 	if (LOG_ERROR) {
 		if (LOG_INFO)
 			PRINT_LOCATION(stdout);
 
-		printf("End of stream, received %zu byte(s) in %d chunk(s)",
-		       stats.sum, stats.chunks);
+		printf("Client announced text over send size limit (%llu B/%zu B), refusing it "
+		       "and terminating connection.\n", announced, attrib->limitnum);
+	}
 
-		if (stats.size_limit_active) {
-			printf(", %zu byte(s) %s.\n", stats.discarded,
-			       (attrib->copris_flags & MUST_CUTOFF) ? "cut off" : "discarded");
-		} else {
-			printf(".\n");
+	return 1;
+}
+
+long long monotonic_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int time_to_deadline(long long connected, long long last_read,
+                     const struct Attribs *attrib, timeout_t *deadline)
+{
+	long long nearest = -1;
+	*deadline = TIMEOUT_NONE;
+
+	// Waiting for the first chunk, or for the next one
+	if (last_read == 0 && attrib->timeout_first) {
+		nearest = connected + attrib->timeout_first * 1000LL;
+		*deadline = TIMEOUT_FIRST;
+	} else if (last_read != 0 && attrib->timeout_idle) {
+		nearest = last_read + attrib->timeout_idle * 1000LL;
+		*deadline = TIMEOUT_IDLE;
+	}
+
+	if (attrib->timeout_total) {
+		long long total = connected + attrib->timeout_total * 1000LL;
+
+		if (nearest == -1 || total < nearest) {
+			nearest = total;
+			*deadline = TIMEOUT_TOTAL;
 		}
 	}
 
-	if (LOG_INFO)
-		PRINT_MSG("Connection from %s (%s) closed.", host_info, host_address);
+	if (nearest == -1)
+		return -1;
 
-	return 0;
+	long long remaining = nearest - monotonic_ms();
+	if (remaining <= 0)
+		return 0;
+
+	return (remaining < INT_MAX) ? (int)remaining : INT_MAX;
+}
+
+void apply_timeout(UT_string *copris_text, int childfd, timeout_t deadline,
+                   struct Stats *stats, const struct Attribs *attrib)
+{
+	const char timeout_message[] = "You have been sending text too slowly. "
+	                               "Terminating connection.\n";
+	send_to_socket(childfd, timeout_message);
+
+	stats->timed_out = deadline;
+
+	// An unfinished text isn't printed (only the part, already streamed, has been)
+	if (copris_text != NULL) {
+		stats->discarded = utstring_len(copris_text);
+		utstring_clear(copris_text);
+	}
+
+	if (LOG_ERROR) {
+		if (LOG_INFO)
+			PRINT_LOCATION(stdout);
+
+		if (deadline == TIMEOUT_FIRST)
+			printf("Client sent no text in %d s", attrib->timeout_first);
+		else if (deadline == TIMEOUT_IDLE)
+			printf("Client sent no more text in %d s", attrib->timeout_idle);
+		else
+			printf("Client didn't finish its text in %d s", attrib->timeout_total);
+
+		if (copris_text != NULL)
+			puts(", discarding received text and terminating connection.");
+		else
+			puts(", terminating connection.");
+	}
 }
 
 int close_socket(int fd, const char *socket_type)
@@ -212,31 +721,81 @@ int send_to_socket(int childfd, const char *message)
 	return buffer_length;
 }
 
-static int read_from_socket(UT_string *copris_text, int childfd,
+static int read_from_socket(UT_string *copris_text, int childfd, const char *host_address,
                             struct Stats *stats, struct Attribs *attrib)
 {
-	char buffer[BUFSIZE];  // Inbound message buffer
 	ssize_t buffer_length; // Return value of a socket operation - number of
 	                       // read bytes if successful
+	long long connected = monotonic_ms(); // For client's deadlines
+	long long last_read = 0;
+	bool header_checked = false;
+
+	for (;;) {
+		// Read straight into the end of text, growing it as needed. read() returns
+		// number of read bytes, or -1 on error (and sets errno), and puts _no_
+		// termination at the end of the buffer - utstring_extend() adds it.
+		// Don't wait for the client past any of its deadlines
+		timeout_t deadline;
+		int wait_time = time_to_deadline(connected, last_read, attrib, &deadline);
+		if (wait_time == 0) {
+			apply_timeout(copris_text, childfd, deadline, stats, attrib);
+			buffer_length = 0;
+			break;
+		}
+
+		if (wait_time > 0) {
+			struct pollfd client = { .fd = childfd, .events = POLLIN };
+			int ready = poll(&client, 1, wait_time);
+			if (ready == 0 || (ready == -1 && errno == EINTR))
+				continue;
+
+			if (ready == -1) {
+				PRINT_SYSTEM_ERROR("poll", "Error waiting for socket.");
+				return -1;
+			}
+		}
+
+		// Client, sending too fast, must wait for its allowance; that isn't its idling,
+		// but it doesn't wait past its deadlines either
+		int rate_wait;
+		size_t length = ratelimit_allowance(host_address, read_size(stats, attrib), &rate_wait);
+		if (length == 0) {
+			wait_time = time_to_deadline(connected, last_read, attrib, &deadline);
+			poll(NULL, 0, (wait_time != -1 && wait_time < rate_wait) ? wait_time : rate_wait);
+			if (last_read)
+				last_read = monotonic_ms();
+
+			continue;
+		}
 
-	// read() returns number of read bytes, or -1 on error (and sets errno), and puts
-	// _no_ termination at the end of the buffer.
-	while ((buffer_length = read(childfd, buffer, BUFSIZE)) > 0) {
-		//buffer[buffer_length] = '\0';
+		utstring_reserve_tail(copris_text, length);
+		buffer_length = read(childfd, utstring_tail(copris_text), length);
+		if (buffer_length <= 0)
+			break;
 
-		// Note that the ending null byte is omitted from the count. This isn't
-		// a problem, since utstring_bincpy() terminates its internal string
-		// after appending to it.
-		utstring_bincpy(copris_text, buffer, buffer_length);
+		utstring_extend(copris_text, buffer_length);
+		last_read = monotonic_ms();
+		ratelimit_consume(host_address, buffer_length);
 
 		stats->chunks++;
 		stats->sum += buffer_length;
 
+		// A job, announced to be over the limit, is refused before reading any of it
+		if (!header_checked &&
+		    check_length_header(copris_text, childfd, &header_checked, stats, attrib) != 0)
+			break;
+
 		// Check if length of received text went over the limit (if limit is active)
-		if (attrib->limitnum && stats->sum > attrib->limitnum) {
+		size_t limit = byte_limit(stats, attrib);
+		if (limit && stats->sum > limit) {
 			apply_byte_limit(copris_text, childfd, stats, attrib);
 			break;
 		}
+
+		// Convert and print what can be, the rest stays in 'copris_text'
+		if (attrib->copris_flags & STREAM_TEXT && header_checked &&
+		    stream_text(copris_text) != 0)
+			return -1;
 	}
 
 	if (buffer_length == -1) {
@@ -247,14 +806,19 @@ static int read_from_socket(UT_string *copris_text, int childfd,
 	return 0;
 }
 
-static void apply_byte_limit(UT_string *copris_text, int childfd,
-                             struct Stats *stats, struct Attribs *attrib)
+void apply_byte_limit(UT_string *copris_text, int childfd,
+                      struct Stats *stats, struct Attribs *attrib)
 {
 	const char limit_message[] = "You have sent too much text. Terminating connection.\n";
 	send_to_socket(childfd, limit_message);
 
 	stats->size_limit_active = true;
 
+	// Client may have announced less text than the limit allows
+	size_t limit = byte_limit(stats, attrib);
+	const char *exceeded = (limit < attrib->limitnum) ?
+	                       "announced length" : "send size limit";
+
 	if (!(attrib->copris_flags & MUST_CUTOFF)) {
 		// Discard whole chunk of text, if over the limit
 		stats->discarded = stats->sum;
@@ -264,8 +828,8 @@ static void apply_byte_limit(UT_string *copris_text, int childfd,
 			if (LOG_INFO)
 				PRINT_LOCATION(stdout);
 
-			printf("Client exceeded send size limit (%zu B/%zu B), discarding remaining "
-			       "text and terminating connection.\n", stats->sum, attrib->limitnum);
+			printf("Client exceeded %s (%zu B/%zu B), discarding remaining "
+			       "text and terminating connection.\n", exceeded, stats->sum, limit);
 		}
 
 	} else {
@@ -273,9 +837,13 @@ static void apply_byte_limit(UT_string *copris_text, int childfd,
 		// possibly split at the limit
 		char *text = utstring_body(copris_text);
 
-		stats->discarded = stats->sum - attrib->limitnum;
-		utstring_cut(copris_text, attrib->limitnum);
-		assert(strlen(text) == attrib->limitnum);
+		// With streaming, part of the text may already have been printed, so only
+		// what remains in the buffer is cut off
+		stats->discarded = stats->sum - limit;
+		size_t kept_length = utstring_len(copris_text) - stats->discarded;
+
+		utstring_cut(copris_text, kept_length);
+		assert(strlen(text) == kept_length);
 
 		int terminated = utf8_terminate_incomplete_buffer(text, utstring_len(copris_text));
 
@@ -283,8 +851,8 @@ static void apply_byte_limit(UT_string *copris_text, int childfd,
 			if (LOG_INFO)
 				PRINT_LOCATION(stdout);
 
-			printf("Client exceeded send size limit (%zu B/%zu B), cutting off text and "
-			       "terminating connection.\n", stats->sum, attrib->limitnum);
+			printf("Client exceeded %s (%zu B/%zu B), cutting off text and "
+			       "terminating connection.\n", exceeded, stats->sum, limit);
 		}
 
 		if (terminated && LOG_DEBUG)
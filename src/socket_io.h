@@ -1,9 +1,36 @@
+#include <sys/socket.h> /* struct sockaddr_storage */
+
+// Size of buffers holding client's host name and address
+#define HOST_INFO_LENGTH 256
+
+/*
+ * Check whether a listening socket was passed by the service manager (using the
+ * LISTEN_PID and LISTEN_FDS environment variables), and clear the variables.
+ * Return its file descriptor, or -1 if there's none.
+ */
+int copris_socket_inherited(void);
+
 /*
- * Create a system socket on port number 'portno' and set a file descriptor,
- * passed by 'parentfd'.
+ * Create a system socket on port number or Unix domain socket path, and with a backlog
+ * of pending connections, specified in 'attrib', and set a file descriptor, passed by
+ * 'parentfd'. If 'attrib' holds a socket, passed by the service manager, use it instead.
  * Return 0 on success.
  */
-int copris_socket_listen(int *parentfd, unsigned int portno);
+int copris_socket_listen(int *parentfd, struct Attribs *attrib);
+
+/*
+ * Remove the Unix domain socket file from 'attrib', if it was created by this process.
+ */
+void remove_socket_file(const struct Attribs *attrib);
+
+/*
+ * Start additional listener processes, up to the number in 'attrib', each with its own
+ * listening socket on the same port, which replaces 'parentfd' in the child. The kernel
+ * then spreads incoming connections among them. A Unix domain socket, or one passed by
+ * the service manager, is shared by all listeners instead.
+ * Return index of the listener (0 in the original process), or -1 on error.
+ */
+int copris_spawn_listeners(int *parentfd, struct Attribs *attrib);
 
 /*
  * Accept incoming connections from a socket, whose endpoint is passed by a file
@@ -14,6 +41,78 @@ int copris_socket_listen(int *parentfd, unsigned int portno);
 int copris_handle_socket(UT_string *copris_text, int *parentfd, int *childfd,
                          struct Attribs *attrib);
 
+/*
+ * Put printable address and host name of client 'clientaddr' (of length 'clientlen')
+ * into 'host_address' and 'host_info', both HOST_INFO_LENGTH bytes long, and report
+ * the inbound connection.
+ * Host name is taken from cache, and may only be a placeholder until it's resolved.
+ */
+void get_client_info(struct sockaddr_storage *clientaddr, socklen_t clientlen,
+                     char *host_info, char *host_address);
+
+/*
+ * Put printable address of the client, connected on 'childfd', into 'host_address',
+ * HOST_INFO_LENGTH bytes long.
+ */
+void get_client_address(int childfd, char *host_address);
+
+/*
+ * Report number of bytes and chunks, received from a client, from 'stats'.
+ */
+void print_end_of_stream(const struct Stats *stats, const struct Attribs *attrib);
+
+/*
+ * Notify client on 'childfd' that it has exceeded its byte limit (see byte_limit()),
+ * then either discard or cut off 'copris_text' and note that in 'stats'.
+ */
+void apply_byte_limit(UT_string *copris_text, int childfd,
+                      struct Stats *stats, struct Attribs *attrib);
+
+/*
+ * Return the byte limit of a client with 'stats': the limit from 'attrib' or the length,
+ * announced by the client, whichever is lower. Return 0 if there's no limit.
+ */
+size_t byte_limit(const struct Stats *stats, const struct Attribs *attrib);
+
+/*
+ * Return number of bytes to read next from a client with 'stats', so that text doesn't
+ * grow past its byte limit (by more than a byte, to tell it's crossed).
+ */
+size_t read_size(const struct Stats *stats, const struct Attribs *attrib);
+
+/*
+ * Look for a length header (LENGTH_HEADER followed by number of bytes and a newline)
+ * at the beginning of 'copris_text' and remove it, if a byte limit is set in 'attrib'.
+ * Set 'header_checked' once it's been found, or there can't be one. Note the announced
+ * length in 'stats', or if it exceeds the limit, notify client on 'childfd', discard
+ * 'copris_text' and note that in 'stats' instead.
+ * Return 1 if text has been refused, 0 otherwise.
+ */
+int check_length_header(UT_string *copris_text, int childfd, bool *header_checked,
+                        struct Stats *stats, struct Attribs *attrib);
+
+/*
+ * Return current time of a monotonic clock in milliseconds.
+ */
+long long monotonic_ms(void);
+
+/*
+ * Find the nearest deadline from 'attrib' of a client, which connected at 'connected'
+ * and last sent text at 'last_read' (0 if not yet), both from monotonic_ms(), and put
+ * its kind into 'deadline'.
+ * Return number of milliseconds left until it, 0 if it has passed, or -1 if the client
+ * has no deadlines.
+ */
+int time_to_deadline(long long connected, long long last_read,
+                     const struct Attribs *attrib, timeout_t *deadline);
+
+/*
+ * Notify client on 'childfd' that it has missed 'deadline', then discard 'copris_text'
+ * (if not NULL) and note that in 'stats'.
+ */
+void apply_timeout(UT_string *copris_text, int childfd, timeout_t deadline,
+                   struct Stats *stats, const struct Attribs *attrib);
+
 /*
  * Close socket with descriptor 'fd'. Pass type, either "parent" or "child",
  * to 'socket_type'.
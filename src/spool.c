@@ -0,0 +1,937 @@
+/*
+ * Writer thread with a bounded spool of texts, waiting to be printed
+ *
+ * In daemon mode, converted texts are written to the output destination (stage 4) by
+ * a separate thread, so a slow printer doesn't hold up receiving the next texts. The
+ * spool holds a limited number of texts and bytes; once it's full, the event loop
+ * waits for the writer, and new clients wait in the listening socket's backlog
+ * instead of in COPRIS' memory.
+ *
+ * The spool may be kept in a directory instead of memory. Each text is written there
+ * once, as file '<sequence>-<priority>.tmp', and mapped into memory by the writer
+ * thread. Once the event loop runs out of finished texts, all new files are synced to
+ * disk at once and renamed to '<sequence>-<priority>.job', so a batch of small jobs
+ * costs a single sync. Files are removed once printed, and '.job' files, left over from
+ * a previous run, are queued again on startup, with the priority they were sent with.
+ *
+ * The writer doesn't take jobs in order of arrival. Jobs of higher priority are always
+ * printed first. Among jobs of the same priority, clients (by address) take turns with
+ * deficit round-robin: in each turn, a client may have up to SPOOL_QUANTUM bytes
+ * printed, plus whatever it didn't use in previous turns. A client, sending big jobs,
+ * thus waits for a few turns, while others' short jobs get printed meanwhile.
+ *
+ * Several output files (a pool of identical printers) may be written at once, each by
+ * its own writer thread. A writer takes the next job as soon as its printer is free, so
+ * jobs go to the printer with the least queued text; with round-robin balancing, the
+ * writers take jobs in turn instead. A printer whose write fails (or stalls past the
+ * output timeout) sits out for POOL_RETRY seconds, and its job is printed again, as a
+ * whole, by another printer.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'syncfs'
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <uthash.h>   /* uthash library - hash table      */
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "socket_io.h"
+#include "spool.h"
+#include "writer.h"
+
+struct SpoolJob {
+	UT_string *text;            /* Converted text (NULL - it's in a job file)  */
+	unsigned long long seq;     /* Sequence number, naming the job file        */
+	bool committed;             /* Job file has been synced and renamed        */
+	size_t length;              /* Length of text, counted against the limit   */
+	priority_t priority;        /* Priority class of the job                   */
+	long long spooled;          /* Time of submitting the job (monotonic_ms)   */
+	struct SpoolJob *next;      /* Next job in order of arrival                */
+	struct SpoolJob *prev;      /* Previous job in order of arrival            */
+	struct SpoolJob *next_own;  /* Next waiting job of the same client         */
+};
+
+struct Client {
+	char address[HOST_INFO_LENGTH];   /* Client's address (hash key)                 */
+	struct SpoolJob *head;            /* Client's waiting jobs, oldest first         */
+	struct SpoolJob *tail;
+	size_t deficit;                   /* Bytes client may still have printed         */
+	bool in_turn;                     /* Client's turn has begun                     */
+	struct Client *next_turn;         /* Next client in round-robin order            */
+	UT_hash_handle hh;
+};
+
+struct Printer {
+	const char *file;                 /* Output file (NULL - standard output)        */
+	int index;                        /* Position in the pool                        */
+	pthread_t thread;                 /* Its writer thread                           */
+	bool running;                     /* Writer thread has been started              */
+	bool healthy;                     /* Printer may take jobs                       */
+	long long retry_at;               /* When a failed printer may take jobs again   */
+	unsigned long printed_jobs;       /* Number of printed jobs                      */
+	size_t printed_bytes;             /* Their total length                          */
+	long long busy_time;              /* Time spent writing them (ms)                */
+	unsigned long failures;           /* Number of failed jobs                       */
+};
+
+struct JobFile {
+	unsigned long long seq;           /* Sequence number of a left-over job file     */
+	priority_t priority;              /* Priority, the job was sent with             */
+};
+
+struct PriorityClass {
+	struct Client *clients;           /* Clients with waiting jobs (hash table)      */
+	struct Client *turn_head;         /* Same clients, in round-robin order          */
+	struct Client *turn_tail;
+	unsigned long printed;            /* Number of printed jobs                      */
+	long long total_wait;             /* Sum of their waiting times (ms)             */
+	long long max_wait;               /* Longest waiting time (ms)                   */
+};
+
+static const char *priority_names[PRIORITY_COUNT] = { "high", "normal", "low" };
+
+// Sequence numbers are zero-padded, so file names sort in order of arrival. The
+// priority (its index in 'priority_t') follows, so it survives a restart.
+#define JOB_FILE_NAME_LENGTH 32
+#define JOB_FILE_FORMAT      "%020llu-%d.%s"
+
+static void *writer_thread(void *);
+static bool spool_full(size_t length);
+static void append_job(struct SpoolJob *job, const char *client_address);
+static struct SpoolJob *schedule_job(void);
+static bool printer_available(const struct Printer *printer);
+static bool may_take_job(struct Printer *printer);
+static void next_turn(void);
+static void fail_printer(struct Printer *printer, struct SpoolJob *job);
+static void report_wait_times(void);
+static void report_printers(void);
+static int replay_jobs(void);
+static int store_job(UT_string *copris_text, unsigned long long seq, priority_t priority);
+static int print_job(struct Printer *printer, struct SpoolJob *job);
+static int write_job(struct Printer *printer, UT_string *text);
+static void remove_job_file(struct SpoolJob *job);
+static int compare_job_files(const void *a, const void *b);
+
+static struct Printer printers[MAX_OUTPUTS];
+static int printer_count = 0;
+static int next_printer = 0;               // Printer, taking the next job (round-robin)
+
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t room_available = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+static bool writer_failed = false;
+
+static struct SpoolJob *spool_head = NULL; // All jobs (being written and waiting),
+static struct SpoolJob *spool_tail = NULL; // in order of arrival
+static int spooled_jobs = 0;
+static size_t spooled_bytes = 0;
+static int waiting_jobs = 0;               // Jobs, not yet taken by the writer
+static struct SpoolJob *retry_head = NULL; // Jobs, taken back from failed printers
+static struct SpoolJob *retry_tail = NULL;
+
+static struct PriorityClass classes[PRIORITY_COUNT];
+
+static int spool_max_jobs;
+static size_t spool_max_bytes;
+static struct Attribs *spool_attrib; // Output settings, read-only
+
+static int spool_dirfd = -1;               // Spool directory (-1 - spool in memory)
+static unsigned long long next_seq = 1;    // Sequence number of the next job file
+static int uncommitted = 0;                // Job files, not yet synced to disk
+
+int spool_start(int max_jobs, size_t max_bytes, const char *spool_dir,
+                struct Attribs *attrib)
+{
+	spool_max_jobs  = max_jobs;
+	spool_max_bytes = max_bytes;
+	spool_attrib    = attrib;
+
+	if (spool_dir != NULL) {
+		spool_dirfd = open(spool_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (spool_dirfd == -1) {
+			PRINT_SYSTEM_ERROR("open", "Failed to open spool directory.");
+			return -1;
+		}
+
+		// Two servers would print each other's jobs
+		if (flock(spool_dirfd, LOCK_EX | LOCK_NB) == -1) {
+			PRINT_ERROR_MSG("Spool directory '%s' is already used by another "
+			                "COPRIS process.", spool_dir);
+			return -1;
+		}
+
+		int error = replay_jobs();
+		if (error)
+			return -1;
+	}
+
+	// Without an output file, there's a single printer on the standard output
+	printer_count = (attrib->copris_flags & HAS_OUTPUT_FILE) ? attrib->output_count : 1;
+
+	for (int i = 0; i < printer_count; i++) {
+		struct Printer *printer = &printers[i];
+
+		printer->file    = (attrib->copris_flags & HAS_OUTPUT_FILE) ?
+		                   attrib->output_files[i] : NULL;
+		printer->index   = i;
+		printer->healthy = true;
+
+		int tmperr = pthread_create(&printer->thread, NULL, writer_thread, printer);
+		if (tmperr != 0) {
+			PRINT_ERROR_MSG("Failed to start writer thread (error %d).", tmperr);
+			spool_stop();
+			return -1;
+		}
+
+		printer->running = true;
+	}
+
+	if (LOG_DEBUG) {
+		PRINT_LOCATION(stdout);
+		printf("Started %d writer thread(s), spooling up to %d job(s)", printer_count,
+		       max_jobs);
+		if (max_bytes)
+			printf(" and %zu bytes", max_bytes);
+		if (spool_dir != NULL)
+			printf(" in '%s'", spool_dir);
+		printf(".\n");
+	}
+
+	return 0;
+}
+
+int spool_submit(UT_string **copris_text, priority_t priority, const char *client_address)
+{
+	size_t length = utstring_len(*copris_text);
+
+	pthread_mutex_lock(&spool_lock);
+
+	// Hold everything up until the writer catches up
+	if (spool_full(length) && !writer_failed) {
+		if (LOG_INFO)
+			PRINT_MSG("Spool is full (%d job(s), %zu B), holding back clients.",
+			          spooled_jobs, spooled_bytes);
+
+		long long waiting = monotonic_ms();
+
+		while (spool_full(length) && !writer_failed)
+			pthread_cond_wait(&room_available, &spool_lock);
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Waited %lld ms for room in spool.", monotonic_ms() - waiting);
+	}
+
+	bool failed = writer_failed;
+	pthread_mutex_unlock(&spool_lock);
+
+	if (failed)
+		return -1;
+
+	struct SpoolJob *job = malloc(sizeof *job);
+	CHECK_MALLOC(job);
+
+	job->text      = NULL;
+	job->seq       = 0;
+	job->committed = false;
+	job->length    = length;
+	job->priority  = priority;
+	job->spooled   = monotonic_ms();
+
+	// A text that can't be stored is still printed, only not as safely
+	if (spool_dirfd != -1 && store_job(*copris_text, next_seq, priority) == 0) {
+		job->seq = next_seq++;
+		uncommitted++;
+
+		// The caller may keep using the string, as the text is in the file now
+		utstring_clear(*copris_text);
+	} else {
+		job->text = *copris_text;
+		utstring_new(*copris_text);
+	}
+
+	pthread_mutex_lock(&spool_lock);
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Spooling %zu B from %s with %s priority, behind %d job(s) (%zu B).",
+		          length, client_address, priority_names[priority],
+		          spooled_jobs, spooled_bytes);
+
+	append_job(job, client_address);
+
+	pthread_cond_broadcast(&job_available);
+	pthread_mutex_unlock(&spool_lock);
+
+	return 0;
+}
+
+void spool_commit(void)
+{
+	if (!uncommitted)
+		return;
+
+	// Jobs, already printed by the writer, need no syncing
+	bool pending = false;
+
+	pthread_mutex_lock(&spool_lock);
+	for (struct SpoolJob *job = spool_head; job != NULL && !pending; job = job->next)
+		pending = (job->text == NULL && !job->committed);
+	pthread_mutex_unlock(&spool_lock);
+
+	if (!pending) {
+		uncommitted = 0;
+		return;
+	}
+
+	// Sync all job files with a single call, instead of one per file
+	if (syncfs(spool_dirfd) == -1) {
+		PRINT_SYSTEM_ERROR("syncfs", "Failed to sync spool directory.");
+		return;
+	}
+
+	int committed = 0;
+	char tmp_name[JOB_FILE_NAME_LENGTH];
+	char job_name[JOB_FILE_NAME_LENGTH];
+
+	// Files are renamed while the writer can't remove them
+	pthread_mutex_lock(&spool_lock);
+
+	for (struct SpoolJob *job = spool_head; job != NULL; job = job->next) {
+		if (job->text != NULL || job->committed)
+			continue;
+
+		snprintf(tmp_name, sizeof tmp_name, JOB_FILE_FORMAT, job->seq, job->priority, "tmp");
+		snprintf(job_name, sizeof job_name, JOB_FILE_FORMAT, job->seq, job->priority, "job");
+
+		if (renameat(spool_dirfd, tmp_name, spool_dirfd, job_name) == -1) {
+			PRINT_SYSTEM_ERROR("renameat", "Failed to commit job file.");
+			continue;
+		}
+
+		job->committed = true;
+		committed++;
+	}
+
+	pthread_mutex_unlock(&spool_lock);
+
+	// Make the new names durable as well
+	if (fsync(spool_dirfd) == -1)
+		PRINT_SYSTEM_ERROR("fsync", "Failed to sync spool directory.");
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Committed %d of %d new job(s) to spool directory.", committed, uncommitted);
+
+	uncommitted = 0;
+}
+
+int spool_stop(void)
+{
+	if (printer_count == 0 || !printers[0].running)
+		return 0;
+
+	pthread_mutex_lock(&spool_lock);
+	stopping = true;
+	pthread_cond_broadcast(&job_available);
+	pthread_mutex_unlock(&spool_lock);
+
+	// Writers write all spooled jobs before they quit
+	for (int i = 0; i < printer_count && printers[i].running; i++) {
+		pthread_join(printers[i].thread, NULL);
+		printers[i].running = false;
+	}
+
+	// Only left over if the writer has failed. Committed job files stay in the spool
+	// directory, to be printed on the next run.
+	while (spool_head != NULL) {
+		struct SpoolJob *job = spool_head;
+		spool_head = job->next;
+
+		if (job->text != NULL)
+			utstring_free(job->text);
+
+		free(job);
+	}
+
+	spool_tail = NULL;
+	retry_head = NULL;
+	retry_tail = NULL;
+	spooled_jobs = 0;
+	spooled_bytes = 0;
+	waiting_jobs = 0;
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		struct Client *client;
+		struct Client *tmp;
+
+		HASH_ITER(hh, classes[i].clients, client, tmp) {
+			HASH_DEL(classes[i].clients, client);
+			free(client);
+		}
+
+		classes[i].turn_head = NULL;
+		classes[i].turn_tail = NULL;
+	}
+
+	report_wait_times();
+	report_printers();
+
+	if (spool_dirfd != -1) {
+		close(spool_dirfd);
+		spool_dirfd = -1;
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Stopped writer thread(s).");
+
+	int error = writer_failed ? -1 : 0;
+
+	// Leave the spool ready to be started again
+	memset(printers, 0, sizeof printers);
+	memset(classes, 0, sizeof classes);
+	printer_count = 0;
+	next_printer  = 0;
+	next_seq      = 1;
+	uncommitted   = 0;
+	stopping      = false;
+	writer_failed = false;
+
+	return error;
+}
+
+// A job always fits into an empty spool, however big it is
+static bool spool_full(size_t length)
+{
+	if (spooled_jobs == 0)
+		return false;
+
+	if (spooled_jobs >= spool_max_jobs)
+		return true;
+
+	return spool_max_bytes && spooled_bytes + length > spool_max_bytes;
+}
+
+// Queue 'job' of client 'client_address'. Must be called with 'spool_lock' held (or
+// before the writer is started).
+static void append_job(struct SpoolJob *job, const char *client_address)
+{
+	job->next     = NULL;
+	job->prev     = spool_tail;
+	job->next_own = NULL;
+
+	if (spool_tail == NULL)
+		spool_head = job;
+	else
+		spool_tail->next = job;
+
+	spool_tail = job;
+	spooled_jobs++;
+	spooled_bytes += job->length;
+	waiting_jobs++;
+
+	struct PriorityClass *class = &classes[job->priority];
+	struct Client *client;
+	HASH_FIND_STR(class->clients, client_address, client);
+
+	// A client without waiting jobs joins the end of the round
+	if (client == NULL) {
+		client = calloc(1, sizeof *client);
+		CHECK_MALLOC(client);
+
+		memccpy(client->address, client_address, '\0', HOST_INFO_LENGTH);
+		client->address[HOST_INFO_LENGTH - 1] = '\0';
+		HASH_ADD_STR(class->clients, address, client);
+
+		if (class->turn_tail == NULL)
+			class->turn_head = client;
+		else
+			class->turn_tail->next_turn = client;
+
+		class->turn_tail = client;
+	}
+
+	if (client->tail == NULL)
+		client->head = job;
+	else
+		client->tail->next_own = job;
+
+	client->tail = job;
+}
+
+// Take the next job to print from the highest priority class with waiting jobs, by
+// deficit round-robin among its clients. Must be called with 'spool_lock' held.
+static struct SpoolJob *schedule_job(void)
+{
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		struct PriorityClass *class = &classes[i];
+
+		while (class->turn_head != NULL) {
+			struct Client *client = class->turn_head;
+
+			if (!client->in_turn) {
+				client->deficit += SPOOL_QUANTUM;
+				client->in_turn = true;
+			}
+
+			struct SpoolJob *job = client->head;
+
+			if (job->length <= client->deficit) {
+				client->deficit -= job->length;
+				client->head = job->next_own;
+
+				// A client, left without jobs, leaves the round (and its deficit)
+				if (client->head == NULL) {
+					class->turn_head = client->next_turn;
+					if (class->turn_head == NULL)
+						class->turn_tail = NULL;
+
+					HASH_DEL(class->clients, client);
+					free(client);
+				}
+
+				waiting_jobs--;
+				return job;
+			}
+
+			// Job doesn't fit into this turn; it's the next client's turn
+			client->in_turn = false;
+
+			if (client->next_turn != NULL) {
+				class->turn_head = client->next_turn;
+				client->next_turn = NULL;
+				class->turn_tail->next_turn = client;
+				class->turn_tail = client;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// A failed printer is available again once it has sat out
+static bool printer_available(const struct Printer *printer)
+{
+	return printer->healthy || monotonic_ms() >= printer->retry_at;
+}
+
+// See if 'printer' may take a waiting job now. A failed printer may take jobs again once
+// it has sat out. Must be called with 'spool_lock' held.
+static bool may_take_job(struct Printer *printer)
+{
+	if (!printer->healthy && printer_available(printer)) {
+		printer->healthy = true;
+
+		if (LOG_INFO)
+			PRINT_MSG("Trying printer '%s' again.", printer->file);
+	}
+
+	if (!printer->healthy || waiting_jobs == 0 || writer_failed)
+		return false;
+
+	return spool_attrib->balance != BALANCE_ROUND_ROBIN || next_printer == printer->index;
+}
+
+// Pass the round-robin turn to the next available printer (staying with the current
+// one, if there's no other). Must be called with 'spool_lock' held.
+static void next_turn(void)
+{
+	for (int i = 1; i <= printer_count; i++) {
+		int index = (next_printer + i) % printer_count;
+
+		if (printer_available(&printers[index])) {
+			next_printer = index;
+			break;
+		}
+	}
+}
+
+// Take 'printer' out of the pool for a while, and give 'job', which it failed to print,
+// to another printer. Once no printer is left, the spool fails as a whole. Must be called
+// with 'spool_lock' held.
+static void fail_printer(struct Printer *printer, struct SpoolJob *job)
+{
+	printer->failures++;
+	printer->healthy  = false;
+	printer->retry_at = monotonic_ms() + POOL_RETRY * 1000LL;
+
+	bool any_healthy = false;
+	for (int i = 0; i < printer_count; i++)
+		any_healthy |= printer_available(&printers[i]);
+
+	// Jobs that can't be written are of no use; the event loop quits on next submit.
+	// An unprinted job file is kept for the next run.
+	if (!any_healthy) {
+		if (printer_count > 1)
+			PRINT_ERROR_MSG("No printer of the pool is left to print to.");
+
+		writer_failed = true;
+		pthread_cond_broadcast(&room_available);
+		pthread_cond_broadcast(&job_available);
+		return;
+	}
+
+	PRINT_ERROR_MSG("Taking printer '%s' out of the pool for %d s, its job goes to "
+	                "another printer.", printer->file, POOL_RETRY);
+
+	job->next_own = NULL;
+
+	if (retry_tail == NULL)
+		retry_head = job;
+	else
+		retry_tail->next_own = job;
+
+	retry_tail = job;
+	waiting_jobs++;
+
+	if (next_printer == printer->index)
+		next_turn();
+
+	pthread_cond_broadcast(&job_available);
+}
+
+// Show how long jobs of each priority class have waited to be printed
+static void report_wait_times(void)
+{
+	if (!LOG_INFO)
+		return;
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		const struct PriorityClass *class = &classes[i];
+
+		if (class->printed)
+			PRINT_MSG("Printed %lu job(s) with %s priority, waiting %lld ms on average "
+			          "and %lld ms at most.", class->printed, priority_names[i],
+			          class->total_wait / (long long)class->printed, class->max_wait);
+	}
+}
+
+// Show how many jobs, and how fast, each printer of the pool has printed
+static void report_printers(void)
+{
+	if (!LOG_INFO || printer_count < 2)
+		return;
+
+	for (int i = 0; i < printer_count; i++) {
+		const struct Printer *printer = &printers[i];
+
+		PRINT_LOCATION(stdout);
+		printf("Printer '%s' printed %lu job(s) (%zu B", printer->file,
+		       printer->printed_jobs, printer->printed_bytes);
+
+		// Jobs, written in no time (e.g. to a regular file), tell nothing about speed
+		if (printer->busy_time > 0)
+			printf(", %.0f B/s while busy",
+			       printer->printed_bytes / (printer->busy_time / 1000.0));
+
+		printf("), failed %lu time(s)%s.\n", printer->failures,
+		       printer->healthy ? "" : ", out of the pool");
+	}
+}
+
+// Queue committed job files, left over from a previous run, and discard uncommitted ones
+static int replay_jobs(void)
+{
+	int dupfd = dup(spool_dirfd);
+	DIR *dir = (dupfd != -1) ? fdopendir(dupfd) : NULL;
+	if (dir == NULL) {
+		PRINT_SYSTEM_ERROR("fdopendir", "Failed to read spool directory.");
+		if (dupfd != -1)
+			close(dupfd);
+
+		return -1;
+	}
+
+	struct JobFile *files = NULL;
+	size_t file_count = 0;
+	size_t file_capacity = 0;
+	struct dirent *entry;
+
+	while ((entry = readdir(dir)) != NULL) {
+		unsigned long long seq;
+		int priority;
+		char suffix[4];
+		int length;
+
+		if (sscanf(entry->d_name, "%llu-%d.%3s%n", &seq, &priority, suffix, &length) != 3 ||
+		    entry->d_name[length] != '\0' || priority < 0 || priority >= PRIORITY_COUNT)
+			continue;
+
+		if (strcmp(suffix, "tmp") == 0) {
+			// Its client got no promise the text would survive
+			unlinkat(spool_dirfd, entry->d_name, 0);
+			continue;
+		}
+
+		if (strcmp(suffix, "job") != 0)
+			continue;
+
+		if (file_count == file_capacity) {
+			file_capacity = file_capacity ? file_capacity * 2 : 16;
+			files = realloc(files, file_capacity * sizeof *files);
+			CHECK_MALLOC(files);
+		}
+
+		files[file_count++] = (struct JobFile){ seq, (priority_t)priority };
+	}
+
+	closedir(dir);
+
+	qsort(files, file_count, sizeof *files, compare_job_files);
+
+	char job_name[JOB_FILE_NAME_LENGTH];
+
+	for (size_t i = 0; i < file_count; i++) {
+		struct stat job_stat;
+
+		snprintf(job_name, sizeof job_name, JOB_FILE_FORMAT, files[i].seq,
+		         files[i].priority, "job");
+		if (fstatat(spool_dirfd, job_name, &job_stat, 0) == -1)
+			continue;
+
+		struct SpoolJob *job = malloc(sizeof *job);
+		CHECK_MALLOC(job);
+
+		job->text      = NULL;
+		job->seq       = files[i].seq;
+		job->committed = true;
+		job->length    = (size_t)job_stat.st_size;
+		job->priority  = files[i].priority;
+		job->spooled   = monotonic_ms();
+
+		append_job(job, "spool directory");
+		next_seq = files[i].seq + 1;
+	}
+
+	free(files);
+
+	if (file_count && LOG_INFO)
+		PRINT_MSG("Printing %d unprinted job(s) (%zu B) from the spool directory.",
+		          spooled_jobs, spooled_bytes);
+
+	return 0;
+}
+
+// Write text from 'copris_text' to a new, uncommitted job file number 'seq'
+static int store_job(UT_string *copris_text, unsigned long long seq, priority_t priority)
+{
+	char tmp_name[JOB_FILE_NAME_LENGTH];
+	snprintf(tmp_name, sizeof tmp_name, JOB_FILE_FORMAT, seq, priority, "tmp");
+
+	int fd = openat(spool_dirfd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		PRINT_SYSTEM_ERROR("openat", "Failed to create job file, keeping text in memory.");
+		return -1;
+	}
+
+	const char *text = utstring_body(copris_text);
+	size_t remaining = utstring_len(copris_text);
+
+	while (remaining > 0) {
+		ssize_t written = write(fd, text, remaining);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+
+			PRINT_SYSTEM_ERROR("write", "Failed to write job file, keeping text in memory.");
+			close(fd);
+			unlinkat(spool_dirfd, tmp_name, 0);
+			return -1;
+		}
+
+		text += written;
+		remaining -= written;
+	}
+
+	close(fd);
+	return 0;
+}
+
+// Write text of 'job' to the output destination, mapping it from its file if needed
+static int print_job(struct Printer *printer, struct SpoolJob *job)
+{
+	if (job->text != NULL)
+		return write_job(printer, job->text);
+
+	// An empty file can't be mapped, and there's nothing to print anyway
+	if (job->length == 0)
+		return 0;
+
+	char job_name[JOB_FILE_NAME_LENGTH];
+
+	pthread_mutex_lock(&spool_lock);
+	snprintf(job_name, sizeof job_name, JOB_FILE_FORMAT, job->seq, job->priority,
+	         job->committed ? "job" : "tmp");
+
+	// Opened under lock, so the file isn't renamed meanwhile
+	int fd = openat(spool_dirfd, job_name, O_RDONLY | O_CLOEXEC);
+	pthread_mutex_unlock(&spool_lock);
+
+	if (fd == -1) {
+		PRINT_SYSTEM_ERROR("openat", "Failed to open job file.");
+		return -1;
+	}
+
+	char *mapping = mmap(NULL, job->length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		PRINT_SYSTEM_ERROR("mmap", "Failed to map job file.");
+		return -1;
+	}
+
+	madvise(mapping, job->length, MADV_SEQUENTIAL);
+
+	// Present the mapped file as a (read-only) string to the usual writing path
+	UT_string mapped_text = { .d = mapping, .n = job->length, .i = job->length };
+	int error = write_job(printer, &mapped_text);
+
+	munmap(mapping, job->length);
+	return error;
+}
+
+static int write_job(struct Printer *printer, UT_string *text)
+{
+	if (printer->file == NULL)
+		return copris_write_stdout(text);
+
+	return copris_write_file(printer->file, text);
+}
+
+// Must be called with 'spool_lock' held, so the file isn't renamed meanwhile
+static void remove_job_file(struct SpoolJob *job)
+{
+	char job_name[JOB_FILE_NAME_LENGTH];
+	snprintf(job_name, sizeof job_name, JOB_FILE_FORMAT, job->seq, job->priority,
+	         job->committed ? "job" : "tmp");
+
+	if (unlinkat(spool_dirfd, job_name, 0) == -1)
+		PRINT_SYSTEM_ERROR("unlinkat", "Failed to remove printed job file.");
+}
+
+static int compare_job_files(const void *a, const void *b)
+{
+	unsigned long long seq_a = ((const struct JobFile *)a)->seq;
+	unsigned long long seq_b = ((const struct JobFile *)b)->seq;
+
+	return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct Printer *printer = arg;
+
+	pthread_mutex_lock(&spool_lock);
+
+	for (;;) {
+		// Another printer may still fail, and leave its job to this one
+		while (!may_take_job(printer) && !writer_failed && !(stopping && spooled_jobs == 0))
+			pthread_cond_wait(&job_available, &spool_lock);
+
+		if (!may_take_job(printer))
+			break; /* Stopping and no more work, or no printer left */
+
+		// Jobs, taken back from a failed printer, have waited longest
+		struct SpoolJob *job;
+		if (retry_head != NULL) {
+			job = retry_head;
+			retry_head = job->next_own;
+			if (retry_head == NULL)
+				retry_tail = NULL;
+
+			waiting_jobs--;
+		} else {
+			job = schedule_job();
+		}
+
+		if (spool_attrib->balance == BALANCE_ROUND_ROBIN) {
+			next_turn();
+			pthread_cond_broadcast(&job_available);
+		}
+
+		long long started = monotonic_ms();
+		long long waited = started - job->spooled;
+
+		// Write without holding the lock, so more jobs can be spooled meanwhile. The job
+		// stays in the spool until written, as its text takes up memory until then.
+		pthread_mutex_unlock(&spool_lock);
+
+		int error = print_job(printer, job);
+
+		pthread_mutex_lock(&spool_lock);
+
+		if (error) {
+			fail_printer(printer, job);
+			continue;
+		}
+
+		printer->printed_jobs++;
+		printer->printed_bytes += job->length;
+		printer->busy_time += monotonic_ms() - started;
+
+		struct PriorityClass *class = &classes[job->priority];
+		class->printed++;
+		class->total_wait += waited;
+		if (waited > class->max_wait)
+			class->max_wait = waited;
+
+		if (job->prev == NULL)
+			spool_head = job->next;
+		else
+			job->prev->next = job->next;
+
+		if (job->next == NULL)
+			spool_tail = job->prev;
+		else
+			job->next->prev = job->prev;
+
+		spooled_jobs--;
+		spooled_bytes -= job->length;
+
+		if (LOG_DEBUG)
+			PRINT_MSG("Job with %s priority waited %lld ms in spool, %d job(s) (%zu B) "
+			          "remain.", priority_names[job->priority], waited,
+			          spooled_jobs, spooled_bytes);
+
+		if (job->text != NULL)
+			utstring_free(job->text);
+		else
+			remove_job_file(job);
+
+		free(job);
+
+		// Once a burst of jobs is printed, show how long each class of them waited, and
+		// how each printer has kept up
+		if (spooled_jobs == 0 && LOG_DEBUG) {
+			report_wait_times();
+			report_printers();
+		}
+
+		// Let other writers quit as well
+		if (spooled_jobs == 0 && stopping)
+			pthread_cond_broadcast(&job_available);
+
+		pthread_cond_signal(&room_available);
+	}
+
+	pthread_mutex_unlock(&spool_lock);
+
+	return NULL;
+}
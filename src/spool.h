@@ -0,0 +1,32 @@
+/*
+ * Start a writer thread for each output destination from 'attrib' (the printer pool),
+ * which writes spooled texts to it, spreading them as 'attrib' balances. At most
+ * 'max_jobs' texts, together taking up to 'max_bytes' bytes (0 - no limit), may wait
+ * in the spool. If 'spool_dir' isn't NULL, texts are kept in files in that directory,
+ * and any left over from a previous run are queued first, with their priority.
+ * Return 0 on success.
+ */
+int spool_start(int max_jobs, size_t max_bytes, const char *spool_dir,
+                struct Attribs *attrib);
+
+/*
+ * Hand 'copris_text', received from client 'client_address', over to the writer thread
+ * to be printed with 'priority', and leave an empty string in its place. If the spool
+ * is full, wait until the writer makes room.
+ * Return 0 on success, nonzero if no printer is left to write texts to.
+ */
+int spool_submit(UT_string **copris_text, priority_t priority, const char *client_address);
+
+/*
+ * Sync texts, submitted since the last call, to the spool directory, so they survive
+ * a crash or restart. Meant to be called once no more texts are about to be submitted.
+ * Until then, a text may be lost, so its client shouldn't be let go before.
+ */
+void spool_commit(void);
+
+/*
+ * Let the writer threads write all spooled texts, then stop them. The spool may be
+ * started again afterwards.
+ * Return 0 on success, nonzero if some texts were left unwritten.
+ */
+int spool_stop(void);
@@ -16,10 +16,12 @@
 #include "Copris.h"
 #include "debug.h"
 #include "stream_io.h"
+#include "streaming.h"
+#include "utstring_cut.h"
 
-static size_t read_from_stdin(UT_string *, struct Stats *);
+static size_t read_from_stdin(UT_string *, struct Stats *, struct Attribs *);
 
-int copris_handle_stdin(UT_string *copris_text)
+int copris_handle_stdin(UT_string *copris_text, struct Attribs *attrib)
 {
 	if (LOG_INFO)
 		PRINT_MSG("Trying to read from stdin...");
@@ -40,7 +42,7 @@ int copris_handle_stdin(UT_string *copris_text)
 
 	// Read text from standard input, print a note if only EOF has been received
 	struct Stats stats = STATS_INIT;
-	size_t text_length = read_from_stdin(copris_text, &stats);
+	size_t text_length = read_from_stdin(copris_text, &stats, attrib);
 
 	if (text_length == 0)
 		PRINT_NOTE("No text has been read!");
@@ -52,13 +54,14 @@ int copris_handle_stdin(UT_string *copris_text)
 	return (text_length) ? 0 : -1;
 }
 
-static size_t read_from_stdin(UT_string *copris_text, struct Stats *stats)
+static size_t read_from_stdin(UT_string *copris_text, struct Stats *stats,
+                              struct Attribs *attrib)
 {
-	char buffer[BUFSIZE];
-
 	for (;;) {
-		// Read (binary) data byte by byte from standard input until exhaustion or error
-		size_t buffer_length = fread(buffer, 1, BUFSIZE, stdin);
+		// Read (binary) data byte by byte from standard input until exhaustion or error,
+		// straight into the end of text
+		utstring_reserve_tail(copris_text, attrib->bufsize);
+		size_t buffer_length = fread(utstring_tail(copris_text), 1, attrib->bufsize, stdin);
 
 		if (ferror(stdin)) {
 			PRINT_SYSTEM_ERROR("fread", "Error reading from standard input");
@@ -69,9 +72,13 @@ static size_t read_from_stdin(UT_string *copris_text, struct Stats *stats)
 			break;
 
 		// Append data, count statistics
-		utstring_bincpy(copris_text, buffer, buffer_length);
+		utstring_extend(copris_text, buffer_length);
 		stats->chunks++;
 		stats->sum += buffer_length; // TODO - possible overflow?
+
+		// Convert and print what can be, stop reading if output can't be written
+		if (attrib->copris_flags & STREAM_TEXT && stream_text(copris_text) != 0)
+			break;
 	}
 
 	return stats->sum;
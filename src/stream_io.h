@@ -1,6 +1,7 @@
 /*
- * Read text from standard input, put it into 'copris_text'.
+ * Read text from standard input, put it into 'copris_text'. If streaming is enabled
+ * in 'attrib', convert and print the text as it's being read.
  * Return 0 on success.
  */
-int copris_handle_stdin(UT_string *copris_text);
+int copris_handle_stdin(UT_string *copris_text, struct Attribs *attrib);
 
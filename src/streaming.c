@@ -0,0 +1,333 @@
+/*
+ * Streaming conversion of received text
+ *
+ * Instead of waiting for the whole text to arrive, each received chunk is converted and
+ * written out right away. Only the parts that can't be converted yet are kept for the
+ * next chunk: an unfinished line (variables and Markdown work on whole lines), a new
+ * line that may begin a horizontal rule, and an incomplete multibyte character. A line,
+ * longer than MAX_STREAM_LINE bytes, is converted in parts instead of being held back.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+// For 'memrchr'
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "streaming.h"
+#include "recode.h"
+#include "feature.h"
+#include "markdown.h"
+#include "parse_vars.h"
+#include "writer.h"
+#include "utf8.h"
+#include "utstring_cut.h"
+
+static int convert_chunk(UT_string *copris_text, bool last);
+static size_t cut_long_line(const char *line, size_t line_len, bool parse_vars);
+static int write_converted(void);
+static int flush_output(void);
+
+static struct Attribs *stream_attrib;
+static struct Inifile **stream_encoding;
+static struct Inifile **stream_features;
+
+static bool text_started;       // Any text has been received
+static bool modeline_parsed;    // First line has been checked for a modeline
+static modeline_t modeline;
+static int variables_state;     // Parser state of parse_variables_chunk()
+static struct Markdown_state markdown;
+static int missing_characters;  // Return value of recode_buffer()
+
+static UT_string *segment;        // Received text, taken out of 'copris_text'
+static UT_string *converted_text; // Text, ready to be written
+static UT_string *markdown_rest;  // Text, not yet parsed by the Markdown parser
+static UT_string *recode_rest;    // Incomplete multibyte character, not yet recoded
+
+static FILE *output = NULL;
+static size_t written_text_length;
+
+void stream_begin(struct Attribs *attrib, struct Inifile **encoding,
+                  struct Inifile **features)
+{
+	stream_attrib   = attrib;
+	stream_encoding = encoding;
+	stream_features = features;
+
+	text_started       = false;
+	modeline_parsed    = false;
+	modeline           = NO_MODELINE;
+	variables_state    = 0;
+	missing_characters = 0;
+
+	markdown_init(&markdown);
+
+	utstring_new(segment);
+	utstring_new(converted_text);
+	utstring_new(markdown_rest);
+	utstring_new(recode_rest);
+
+	written_text_length = 0;
+}
+
+int stream_text(UT_string *copris_text)
+{
+	return convert_chunk(copris_text, false);
+}
+
+int stream_end(UT_string *copris_text)
+{
+	int error = convert_chunk(copris_text, true);
+	utstring_clear(copris_text);
+
+	if (output != NULL) {
+		const char *output_file = (stream_attrib->copris_flags & HAS_OUTPUT_FILE) ?
+		                          stream_attrib->output_file : NULL;
+
+		int tmperr = copris_close_output(output, output_file);
+		if (tmperr)
+			error = -1;
+		else if (LOG_INFO)
+			PRINT_MSG("Streamed %zu byte(s) to %s.", written_text_length,
+			          output_file ? output_file : "stdout");
+
+		output = NULL;
+	}
+
+	utstring_free(segment);
+	utstring_free(converted_text);
+	utstring_free(markdown_rest);
+	utstring_free(recode_rest);
+
+	if (error)
+		return -1;
+
+	// Report an error only if user hasn't forced recoding
+	if (missing_characters && !(stream_attrib->copris_flags & ENCODING_NO_STOP))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Convert as much of 'copris_text' as possible and write it out, leaving the rest
+ * in 'copris_text'. If this is the 'last' chunk, convert and write everything.
+ * Return 0 on success, -1 on write failure.
+ */
+static int convert_chunk(UT_string *copris_text, bool last)
+{
+	if (utstring_len(copris_text) > 0)
+		text_started = true;
+
+	// Don't print anything (session commands included) for an empty text
+	if (!text_started)
+		return 0;
+
+	bool has_features = (stream_attrib->copris_flags & HAS_FEATURES);
+
+	// Check for the modeline once the first line is complete
+	if (has_features && !modeline_parsed) {
+		const char *text = utstring_body(copris_text);
+		size_t text_len = utstring_len(copris_text);
+		const char *newline = memchr(text, '\n', text_len);
+
+		// A first line, too long to be held back, is no modeline
+		bool line_too_long = (newline == NULL && !last && text_len >= MAX_STREAM_LINE);
+
+		if (newline == NULL && !last && !line_too_long &&
+		    (text_len < 6 || strncasecmp(text, "COPRIS", 6) == 0))
+			return 0;
+
+		if (line_too_long) {
+			modeline = NO_MODELINE;
+		} else {
+			UT_string *first_line;
+			utstring_new(first_line);
+			utstring_bincpy(first_line, text,
+			                newline ? (size_t)(newline - text) + 1 : text_len);
+
+			modeline = parse_modeline(first_line);
+			utstring_free(first_line);
+		}
+
+		apply_modeline(copris_text, modeline);
+		modeline_parsed = true;
+
+		// Begin with the session command
+		apply_session_commands(converted_text, stream_features, SESSION_BEFORE_TEXT);
+	}
+
+	bool parse_vars = has_features && (modeline & ML_ENABLE_VAR);
+	bool parse_md   = has_features && !(modeline & ML_DISABLE_MD);
+
+	// Variables and Markdown are parsed a whole line at a time, unless the unfinished
+	// line has grown too long to be held back any longer
+	const char *text = utstring_body(copris_text);
+	size_t text_len = utstring_len(copris_text);
+	bool line_cut = false;
+
+	if (!last && (parse_vars || parse_md)) {
+		const char *newline = memrchr(text, '\n', text_len);
+		size_t lines_len = newline ? (size_t)(newline - text) + 1 : 0;
+
+		if (text_len - lines_len >= MAX_STREAM_LINE) {
+			text_len = lines_len + cut_long_line(&text[lines_len], text_len - lines_len,
+			                                     parse_vars);
+			line_cut = true;
+
+			if (LOG_DEBUG)
+				PRINT_MSG("Converting a line, longer than %d bytes, in parts.",
+				          MAX_STREAM_LINE);
+		} else {
+			text_len = lines_len;
+		}
+	}
+
+	utstring_clear(segment);
+	utstring_bincpy(segment, text, text_len);
+	utstring_shift(copris_text, text_len);
+
+	// Stage 2: Handle variables, session commands and Markdown with a printer feature file
+	if (parse_vars)
+		parse_variables_chunk(segment, stream_features, &variables_state);
+
+	if (parse_md) {
+		utstring_concat(markdown_rest, segment);
+
+		// A comment variable also removes its new line, so search for the last one again
+		const char *md_text = utstring_body(markdown_rest);
+		size_t md_len = utstring_len(markdown_rest);
+
+		if (!last && !line_cut) {
+			const char *newline = memrchr(md_text, '\n', md_len);
+			md_len = newline ? (size_t)(newline - md_text) + 1 : 0;
+		}
+
+		size_t parsed_len = parse_markdown_chunk(&markdown, md_text, md_len, last,
+		                                         converted_text, stream_features);
+		utstring_shift(markdown_rest, parsed_len);
+
+		if (last)
+			markdown_finish(&markdown, converted_text, stream_features);
+	} else {
+		utstring_concat(converted_text, segment);
+	}
+
+	if (has_features && last)
+		apply_session_commands(converted_text, stream_features, SESSION_AFTER_TEXT);
+
+	// Stage 3: Recode text with an encoding file, except for an incomplete character
+	if (stream_attrib->copris_flags & HAS_ENCODING) {
+		utstring_concat(recode_rest, converted_text);
+		utstring_clear(converted_text);
+
+		size_t complete_len = utstring_len(recode_rest);
+		if (!last)
+			complete_len -= utf8_incomplete_length(utstring_body(recode_rest), complete_len);
+
+		missing_characters |= recode_buffer(converted_text, utstring_body(recode_rest),
+		                                    complete_len, stream_encoding);
+		utstring_shift(recode_rest, complete_len);
+	}
+
+	// Stage 4: Write text to the output destination
+	return write_converted();
+}
+
+/*
+ * Find where to cut 'line' of length 'line_len', which is too long to be held back: after
+ * its last space, so that words and Markdown around them stay whole, but before a variable
+ * (if 'parse_vars'), as it reaches to the end of the line. Return length of the first part.
+ */
+static size_t cut_long_line(const char *line, size_t line_len, bool parse_vars)
+{
+	size_t search_len = line_len;
+
+	if (parse_vars) {
+		const char *variable = memchr(line, VAR_SYMBOL, line_len);
+		if (variable != NULL)
+			search_len = (size_t)(variable - line);
+	}
+
+	const char *space = memrchr(line, ' ', search_len);
+
+	// Without a space, the line is cut as a whole
+	return space ? (size_t)(space - line) + 1 : line_len;
+}
+
+static int write_converted(void)
+{
+	const char *text = utstring_body(converted_text);
+	size_t text_len = utstring_len(converted_text);
+
+	if (text_len == 0)
+		return 0;
+
+	// Output is opened only once there's something to write
+	if (output == NULL) {
+		output = copris_open_output((stream_attrib->copris_flags & HAS_OUTPUT_FILE) ?
+		                            stream_attrib->output_file : NULL);
+		if (output == NULL)
+			return -1;
+	}
+
+	int error = 0;
+
+	switch (stream_attrib->flush) {
+	case FLUSH_LINE: {
+		// Flush each line as soon as it's complete
+		const char *newline;
+		while ((newline = memchr(text, '\n', text_len)) != NULL) {
+			size_t line_len = (size_t)(newline - text) + 1;
+
+			error = copris_write_chunk(output, text, line_len) || flush_output();
+			if (error)
+				break;
+
+			text += line_len;
+			text_len -= line_len;
+		}
+
+		if (!error && text_len > 0)
+			error = copris_write_chunk(output, text, text_len);
+
+		break;
+	}
+	case FLUSH_CHUNK:
+		error = copris_write_chunk(output, text, text_len) || flush_output();
+		break;
+	case FLUSH_END:
+		error = copris_write_chunk(output, text, text_len);
+		break;
+	}
+
+	written_text_length += utstring_len(converted_text);
+	utstring_clear(converted_text);
+
+	return (error) ? -1 : 0;
+}
+
+static int flush_output(void)
+{
+	int tmperr = fflush(output);
+	if (tmperr != 0) {
+		PRINT_SYSTEM_ERROR("fflush", "Failed to flush output.");
+		return -1;
+	}
+
+	return 0;
+}
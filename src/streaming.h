@@ -0,0 +1,21 @@
+/*
+ * Prepare for streaming a new text. It will be converted according to user-specified
+ * arguments in 'attrib', with 'encoding' and 'features', and written to the output
+ * destination from 'attrib' as it is being received.
+ */
+void stream_begin(struct Attribs *attrib, struct Inifile **encoding,
+                  struct Inifile **features);
+
+/*
+ * Run stages 2 to 4 on all received text in 'copris_text' that can already be converted,
+ * and remove it from 'copris_text'. The remaining text is kept for the next call.
+ * Return 0 on success, -1 if writing to the output destination failed.
+ */
+int stream_text(UT_string *copris_text);
+
+/*
+ * Convert and write the remaining text in 'copris_text', and close the output destination.
+ * Return 0 on success, -1 if writing failed, or 1 if text contained characters, not present
+ * in the encoding, and the user hasn't forced recoding.
+ */
+int stream_end(UT_string *copris_text);
@@ -38,7 +38,96 @@ size_t utf8_codepoint_length(const char s)
 	return 1;
 }
 
-int utf8_terminate_incomplete_buffer(char *str, size_t len)
+// Check the character at the beginning of 'u', which holds 'len' (at least 1) bytes.
+// Allowed ranges of its second byte rule out overlong encodings, surrogates and values
+// past U+10FFFF (table 3-7 of the Unicode standard).
+// Return byte length of the character, or 0 if it isn't valid.
+static inline size_t check_character(const unsigned char *u, size_t len)
+{
+	size_t length;
+	unsigned char low = 0x80, high = 0xBF;
+
+	if (u[0] < 0x80) {
+		return 1;
+	} else if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+		length = 2;
+	} else if (u[0] >= 0xE0 && u[0] <= 0xEF) {
+		length = 3;
+		if (u[0] == 0xE0)
+			low = 0xA0;
+		else if (u[0] == 0xED)
+			high = 0x9F;
+	} else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+		length = 4;
+		if (u[0] == 0xF0)
+			low = 0x90;
+		else if (u[0] == 0xF4)
+			high = 0x8F;
+	} else {
+		// A stray continuation byte, or a byte that never occurs in UTF-8
+		return 0;
+	}
+
+	if (length > len || u[1] < low || u[1] > high ||
+	    (length > 2 && !UTF8_IS_CONTINUATION(u[2])) ||
+	    (length > 3 && !UTF8_IS_CONTINUATION(u[3])))
+		return 0;
+
+	return length;
+}
+
+// Decode the character at the beginning of 'u', already known to be valid.
+// Return byte length of the character.
+static inline size_t decode_character(const unsigned char *u, uint32_t *codepoint)
+{
+	if (u[0] < 0x80) {
+		*codepoint = u[0];
+		return 1;
+	} else if (u[0] < 0xE0) {
+		*codepoint = ((u[0] & 0x1F) << 6) | (u[1] & 0x3F);
+		return 2;
+	} else if (u[0] < 0xF0) {
+		*codepoint = ((u[0] & 0x0F) << 12) | ((u[1] & 0x3F) << 6) | (u[2] & 0x3F);
+		return 3;
+	}
+
+	*codepoint = ((uint32_t)(u[0] & 0x07) << 18) | ((u[1] & 0x3F) << 12) |
+	             ((u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+	return 4;
+}
+
+size_t utf8_decode(const char *s, size_t len, uint32_t *codepoint)
+{
+	const unsigned char *u = (const unsigned char *)s;
+
+	if (check_character(u, len) == 0) {
+		*codepoint = u[0];
+		return 0;
+	}
+
+	return decode_character(u, codepoint);
+}
+
+size_t utf8_encode(uint32_t codepoint, char *s)
+{
+	if (codepoint < 0x80) {
+		s[0] = (char)codepoint;
+		return 1;
+	}
+
+	size_t length = (codepoint < 0x800) ? 2 : (codepoint < 0x10000) ? 3 : 4;
+
+	// Continuation bytes are filled from the last one backwards
+	for (size_t i = length - 1; i > 0; i--) {
+		s[i] = (char)(0x80 | (codepoint & 0x3F));
+		codepoint >>= 6;
+	}
+
+	s[0] = (char)((0xF00 >> length) | codepoint);
+	return length;
+}
+
+size_t utf8_incomplete_length(const char *str, size_t len)
 {
 	size_t check_start = 0;
 
@@ -48,10 +137,20 @@ int utf8_terminate_incomplete_buffer(char *str, size_t len)
 	for (size_t i = check_start; i < len; i++) {
 		size_t needed_bytes = utf8_codepoint_length(str[i]);
 
-		if (i + needed_bytes > len) {
-			str[i] = '\0';
-			return -1;
-		}
+		if (i + needed_bytes > len)
+			return len - i;
+	}
+
+	return 0;
+}
+
+int utf8_terminate_incomplete_buffer(char *str, size_t len)
+{
+	size_t incomplete = utf8_incomplete_length(str, len);
+
+	if (incomplete) {
+		str[len - incomplete] = '\0';
+		return -1;
 	}
 
 	return 0;
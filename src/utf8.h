@@ -34,6 +34,27 @@ size_t utf8_count_codepoints(const char *s, size_t n);
  */
 size_t utf8_codepoint_length(const char s);
 
+/*
+ * Decode the (multibyte) character at the beginning of 's', which holds 'len' bytes, and
+ * put its code point into 'codepoint'. Overlong encodings, values past U+10FFFF,
+ * surrogates and characters, cut off by the end of 's', are invalid.
+ * Return byte length of the character, or 0 if it isn't valid.
+ */
+size_t utf8_decode(const char *s, size_t len, uint32_t *codepoint);
+
+/*
+ * Encode 'codepoint' (up to U+10FFFF) into 's', which must have room for UTF8_MAX_LENGTH
+ * bytes. The result isn't NUL-terminated.
+ * Return byte length of the character.
+ */
+size_t utf8_encode(uint32_t codepoint, char *s);
+
+/*
+ * Check if string 's' of length 'len' ends with an incomplete multibyte character.
+ * Return number of bytes it consists of so far, or 0 if there's none.
+ */
+size_t utf8_incomplete_length(const char *s, size_t len);
+
 /*
  * Check for incomplete multibyte characters in input string 'str' of length 'len'. If
  * any found, terminate the string before letting them (and any following text) through.
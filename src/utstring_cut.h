@@ -4,3 +4,57 @@
         (s)->i=(n);        \
         (s)->d[(n)]='\0';  \
     } while (0)
+
+// Remove the first n bytes of the string, moving the rest to its beginning (meant for
+// short remainders; a whole text is better skipped by an offset)
+#define utstring_shift(s,n)                                  \
+    do {                                                     \
+        memmove((s)->d, (s)->d + (n), (s)->i - (n) + 1);     \
+        (s)->i -= (n);                                       \
+    } while (0)
+
+// Make room for at least amt more bytes (and the terminating null byte) past the end
+// of the string. Unlike utstring_reserve, capacity at least doubles, so appending
+// many chunks needs only a few reallocations.
+#define utstring_reserve_tail(s,amt)                          \
+    do {                                                      \
+        if (((s)->n - (s)->i) < (size_t)(amt) + 1) {          \
+            size_t _new_n = (s)->n * 2;                       \
+            if (_new_n < (s)->i + (size_t)(amt) + 1)          \
+                _new_n = (s)->i + (size_t)(amt) + 1;          \
+            char *_tmp = (char *)realloc((s)->d, _new_n);     \
+            if (!_tmp) {                                      \
+                utstring_oom();                               \
+            }                                                 \
+            (s)->d = _tmp;                                    \
+            (s)->n = _new_n;                                  \
+        }                                                     \
+    } while (0)
+
+// Pointer past the end of the string, where reserved space begins
+#define utstring_tail(s) ((s)->d + (s)->i)
+
+// Count n bytes, written directly into reserved space, as part of the string
+#define utstring_extend(s,n)      \
+    do {                          \
+        (s)->i += (n);            \
+        (s)->d[(s)->i] = '\0';    \
+    } while (0)
+
+// Insert n bytes from p at the beginning of the string, moving its text in place (meant
+// for short strings; a converted text is better begun with them)
+#define utstring_unshift(s,p,n)                              \
+    do {                                                     \
+        utstring_reserve_tail(s, n);                         \
+        memmove((s)->d + (n), (s)->d, (s)->i + 1);           \
+        memcpy((s)->d, (p), (n));                            \
+        (s)->i += (n);                                       \
+    } while (0)
+
+// Exchange texts (and buffers) of two strings, instead of copying one into the other
+#define utstring_swap(a,b)        \
+    do {                          \
+        UT_string _tmp = *(a);    \
+        *(a) = *(b);              \
+        *(b) = _tmp;              \
+    } while (0)
@@ -0,0 +1,204 @@
+/*
+ * Worker threads for converting received texts in parallel
+ *
+ * In daemon mode, each received text becomes a job, which is converted (stages 2 and 3)
+ * by the first available worker thread. Jobs are kept in a single queue in order of
+ * arrival, and are handed back to the caller for writing in that same order, so output
+ * of different clients never gets reordered or interleaved.
+ *
+ * Copyright (C) 2026 Nejc Bertoncelj <bertronika at mailo.com>
+ *
+ * This file is part of COPRIS, a converting printer server, licensed under the
+ * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <utstring.h> /* uthash library - dynamic strings */
+
+#include "Copris.h"
+#include "debug.h"
+#include "convert.h"
+#include "workers.h"
+
+struct Job {
+	UT_string *text;       /* Received text, converted in place            */
+	int childfd;           /* Socket of the client that sent the text      */
+	priority_t priority;   /* Priority of printing the text                */
+	int status;            /* Return value of convert_text()               */
+	bool converted;        /* True once a worker has finished with the job */
+	struct Job *next;      /* Next job in order of arrival                 */
+};
+
+static void *worker_thread(void *);
+
+static pthread_t threads[MAX_WORKERS];
+static int thread_count = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_available = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+
+static struct Job *queue_head = NULL;   // Ordered queue of all jobs, in order of arrival
+static struct Job *queue_tail = NULL;
+static struct Job *next_pending = NULL; // First job in queue not yet taken by a worker
+
+static int notifyfd = -1; // Signalled each time a job is converted
+
+// Conversion settings, shared (read-only) by all workers
+static struct Attribs *job_attrib;
+static struct Inifile **job_encoding;
+static struct Inifile **job_features;
+
+int workers_start(int count, int *wakefd, struct Attribs *attrib,
+                  struct Inifile **encoding, struct Inifile **features)
+{
+	assert(count > 0 && count <= MAX_WORKERS);
+
+	notifyfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (notifyfd == -1) {
+		PRINT_SYSTEM_ERROR("eventfd", "Failed to create worker notification descriptor.");
+		return -1;
+	}
+
+	job_attrib   = attrib;
+	job_encoding = encoding;
+	job_features = features;
+
+	for (thread_count = 0; thread_count < count; thread_count++) {
+		int tmperr = pthread_create(&threads[thread_count], NULL, worker_thread, NULL);
+		if (tmperr != 0) {
+			errno = tmperr;
+			PRINT_SYSTEM_ERROR("pthread_create", "Failed to start worker thread.");
+			workers_stop();
+			return -1;
+		}
+	}
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Started %d worker thread(s).", thread_count);
+
+	*wakefd = notifyfd;
+	return 0;
+}
+
+void workers_submit(UT_string *copris_text, int childfd, priority_t priority)
+{
+	struct Job *job = malloc(sizeof *job);
+	CHECK_MALLOC(job);
+
+	job->text      = copris_text;
+	job->childfd   = childfd;
+	job->priority  = priority;
+	job->status    = 0;
+	job->converted = false;
+	job->next      = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+
+	if (queue_tail == NULL)
+		queue_head = job;
+	else
+		queue_tail->next = job;
+
+	queue_tail = job;
+
+	if (next_pending == NULL)
+		next_pending = job;
+
+	pthread_cond_signal(&job_available);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+bool workers_collect(UT_string **copris_text, int *childfd, priority_t *priority,
+                     int *status)
+{
+	pthread_mutex_lock(&queue_lock);
+
+	struct Job *job = queue_head;
+
+	// Only the oldest job may be written, even if younger ones are already converted
+	if (job == NULL || !job->converted) {
+		pthread_mutex_unlock(&queue_lock);
+		return false;
+	}
+
+	queue_head = job->next;
+	if (queue_head == NULL)
+		queue_tail = NULL;
+
+	pthread_mutex_unlock(&queue_lock);
+
+	*copris_text = job->text;
+	*childfd     = job->childfd;
+	*priority    = job->priority;
+	*status      = job->status;
+	free(job);
+
+	return true;
+}
+
+void workers_stop(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	stopping = true;
+	pthread_cond_broadcast(&job_available);
+	pthread_mutex_unlock(&queue_lock);
+
+	// Workers convert all pending jobs before they quit
+	for (int i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Stopped %d worker thread(s).", thread_count);
+
+	thread_count = 0;
+
+	if (notifyfd != -1) {
+		close(notifyfd);
+		notifyfd = -1;
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&queue_lock);
+
+	for (;;) {
+		while (next_pending == NULL && !stopping)
+			pthread_cond_wait(&job_available, &queue_lock);
+
+		if (next_pending == NULL)
+			break; /* Stopping and no more work */
+
+		struct Job *job = next_pending;
+		next_pending = job->next;
+
+		// Convert without holding the lock, so other workers can proceed
+		pthread_mutex_unlock(&queue_lock);
+		int status = convert_text(job->text, job_attrib, job_encoding, job_features);
+		pthread_mutex_lock(&queue_lock);
+
+		job->status    = status;
+		job->converted = true;
+
+		// Wake up the event loop, so it can write the job (if it's next in line)
+		uint64_t one = 1;
+		if (write(notifyfd, &one, sizeof one) == -1 && errno != EAGAIN)
+			PRINT_SYSTEM_ERROR("write", "Failed to notify about a converted text.");
+	}
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return NULL;
+}
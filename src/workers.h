@@ -0,0 +1,31 @@
+/*
+ * Start 'count' worker threads, which convert submitted texts according to 'attrib',
+ * 'encoding' and 'features'. Put a descriptor into 'wakefd', which becomes readable
+ * each time a worker finishes converting a text.
+ * Return 0 on success.
+ */
+int workers_start(int count, int *wakefd, struct Attribs *attrib,
+                  struct Inifile **encoding, struct Inifile **features);
+
+/*
+ * Queue 'copris_text', received from client on socket 'childfd' and to be printed with
+ * 'priority', for conversion. The string is owned by the worker threads until it is
+ * collected.
+ */
+void workers_submit(UT_string *copris_text, int childfd, priority_t priority);
+
+/*
+ * Take the oldest submitted text from the queue, if it has already been converted.
+ * Put it into 'copris_text' (which the caller must free), its client's socket into
+ * 'childfd', its priority into 'priority' and the return value of convert_text()
+ * into 'status'.
+ * Return true if a text was collected, false if the oldest one is not ready yet.
+ */
+bool workers_collect(UT_string **copris_text, int *childfd, priority_t *priority,
+                     int *status);
+
+/*
+ * Let worker threads convert all remaining texts, then stop them. Converted texts
+ * can still be collected afterwards.
+ */
+void workers_stop(void);
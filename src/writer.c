@@ -1,14 +1,32 @@
 /*
  * Output writing interfaces
  *
+ * The output file is opened once and kept open between jobs, since opening and closing
+ * a printer device may be slow, or even reset the printer. Regular files are only ever
+ * appended to, so earlier output is kept. The file is reopened after an error,
+ * or once SIGHUP is received. Several output files (a pool of printers) may be kept
+ * open at once, each written by its own thread.
+ *
  * Copyright (C) 2020 Nejc Bertoncelj <nejc at bertoncelj.eu.org>
  *
  * This file is part of COPRIS, a converting printer server, licensed under the
  * GNU GPLv3 or later. See files 'main.c' and 'COPYING' for more details.
  */
 
+// For 'sigaction' in ISO C
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <errno.h>
 
 #include <utstring.h> /* uthash library - dynamic strings */
@@ -17,40 +35,111 @@
 #include "debug.h"
 #include "writer.h"
 
-int copris_write_file(const char *output_file, UT_string *copris_text)
+struct Output {
+	const char *file;          /* Name of output file (NULL - unused slot)  */
+	int fd;                    /* Descriptor, kept open between jobs        */
+	pid_t owner;               /* Process which opened it                   */
+	int flags;                 /* Its file status flags                     */
+	bool append_cleared;       /* O_APPEND is off for the current job       */
+	sig_atomic_t hangups_seen; /* Hangups, already handled by reopening     */
+};
+
+static struct Output *find_output(const char *output_file);
+static int acquire_output(struct Output *output, bool splice_ready);
+static void release_output(struct Output *output);
+static int open_output(struct Output *output);
+static void close_output(struct Output *output);
+static int write_all(struct Output *output, const char *text, size_t length,
+                     size_t *written);
+static void hangup_handler(int signum);
+static double elapsed_ms(const struct timespec *since);
+
+static struct Output outputs[MAX_OUTPUTS];     // Output files, kept open between jobs
+static volatile sig_atomic_t hangups = 0;      // Number of received SIGHUPs
+static int write_timeout = 0;                  // Milliseconds (0 - wait forever)
+
+void copris_output_timeout(int seconds)
 {
-	FILE *file_ptr = fopen(output_file, "w");
-	if (file_ptr == NULL) {
-		PRINT_SYSTEM_ERROR("fopen", "Failed to open output file '%s'.", output_file);
+	write_timeout = seconds * 1000;
+}
+
+void copris_output_watch_hangup(void)
+{
+	struct sigaction action = { .sa_handler = hangup_handler, .sa_flags = SA_RESTART };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGHUP, &action, NULL);
+}
+
+int copris_output_open(const char *output_file)
+{
+	struct Output *output = find_output(output_file);
+	if (output == NULL)
 		return -1;
+
+	return open_output(output);
+}
+
+int copris_output_acquire(const char *output_file)
+{
+	struct Output *output = find_output(output_file);
+	if (output == NULL)
+		return -1;
+
+	return acquire_output(output, true);
+}
+
+void copris_output_release(const char *output_file)
+{
+	struct Output *output = find_output(output_file);
+	if (output != NULL)
+		release_output(output);
+}
+
+void copris_output_close(void)
+{
+	for (int i = 0; i < MAX_OUTPUTS; i++) {
+		if (outputs[i].file != NULL && outputs[i].fd != -1 && outputs[i].owner == getpid())
+			close_output(&outputs[i]);
 	}
-		
-	if (LOG_DEBUG)
-		PRINT_MSG("Output file '%s' opened.", output_file);
+}
+
+int copris_write_file(const char *output_file, UT_string *copris_text)
+{
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	struct Output *output = find_output(output_file);
+	if (output == NULL)
+		return -1;
 
-	int error = 0;
 	size_t text_length = utstring_len(copris_text);
-	size_t written_text_length = fwrite(utstring_body(copris_text), 1, text_length, file_ptr);
+	size_t written_text_length = 0;
+	int error = 0;
 
-	if (written_text_length < text_length) {
-		PRINT_ERROR_MSG("fwrite: Failure while appending to output file; "
-		                "not enough bytes transferred.");
-		error = -1;
-	} else if (LOG_INFO) {
-		PRINT_MSG("Written %zu byte(s) to %s.", written_text_length, output_file);
+	// A descriptor may go stale (e.g. if the printer was unplugged), so it's reopened
+	// once, as long as none of the text has been written yet
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (acquire_output(output, false) == -1)
+			return -1;
+
+		error = write_all(output, utstring_body(copris_text), text_length,
+		                  &written_text_length);
+		release_output(output);
+
+		if (!error || written_text_length > 0)
+			break;
 	}
 
-	// Flush streams to file and close it
-	int tmperr = fclose(file_ptr);
-	if (tmperr != 0) {
-		PRINT_SYSTEM_ERROR("fclose", "Failed to close output file '%s'.", output_file);
+	if (error)
 		return -1;
-	}
+
+	if (LOG_INFO)
+		PRINT_MSG("Written %zu byte(s) to %s.", written_text_length, output_file);
 
 	if (LOG_DEBUG)
-		PRINT_MSG("Output file '%s' closed.", output_file);
-	
-	return error;
+		PRINT_MSG("Job written in %.2f ms.", elapsed_ms(&started));
+
+	return 0;
 }
 
 int copris_write_stdout(UT_string *copris_text)
@@ -76,3 +165,277 @@ int copris_write_stdout(UT_string *copris_text)
 
 	return error;
 }
+
+FILE *copris_open_output(const char *output_file)
+{
+	if (output_file == NULL) {
+		if (LOG_ERROR)
+			puts("; BST"); // Begin-Stream-Transcript
+
+		return stdout;
+	}
+
+	struct Output *output = find_output(output_file);
+	if (output == NULL)
+		return NULL;
+
+	int fd = acquire_output(output, false);
+	if (fd == -1)
+		return NULL;
+
+	// Stream gets a descriptor of its own, so closing it keeps the output open
+	FILE *file_ptr = NULL;
+	int stream_fd = dup(fd);
+	if (stream_fd != -1)
+		file_ptr = fdopen(stream_fd, "a");
+
+	if (file_ptr == NULL) {
+		PRINT_SYSTEM_ERROR("fdopen", "Failed to open output file '%s' as a stream.",
+		                   output_file);
+		if (stream_fd != -1)
+			close(stream_fd);
+
+		release_output(output);
+		return NULL;
+	}
+
+	return file_ptr;
+}
+
+int copris_write_chunk(FILE *output, const char *text, size_t length)
+{
+	size_t written_text_length = fwrite(text, 1, length, output);
+
+	if (written_text_length < length) {
+		PRINT_ERROR_MSG("fwrite: Failure while writing to output; "
+		                "not enough bytes transferred.");
+		return -1;
+	}
+
+	return 0;
+}
+
+int copris_close_output(FILE *output, const char *output_file)
+{
+	if (output_file == NULL) {
+		if (LOG_ERROR)
+			puts("; EST"); // End-Stream-Transcript
+
+		fflush(stdout);
+		return 0;
+	}
+
+	// Flush the stream, then let other listener processes write
+	struct Output *kept_output = find_output(output_file);
+	int tmperr = fclose(output);
+
+	if (kept_output != NULL)
+		release_output(kept_output);
+
+	if (tmperr != 0) {
+		PRINT_SYSTEM_ERROR("fclose", "Failed to flush output file '%s'.", output_file);
+
+		// Start afresh with the next job
+		if (kept_output != NULL)
+			close_output(kept_output);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// Find the slot of output file 'output_file', or take a free one for it.
+// Return the slot, or NULL if all are taken.
+static struct Output *find_output(const char *output_file)
+{
+	for (int i = 0; i < MAX_OUTPUTS; i++) {
+		if (outputs[i].file != NULL && strcmp(outputs[i].file, output_file) == 0)
+			return &outputs[i];
+	}
+
+	for (int i = 0; i < MAX_OUTPUTS; i++) {
+		if (outputs[i].file == NULL) {
+			outputs[i].file = output_file;
+			outputs[i].fd   = -1;
+			return &outputs[i];
+		}
+	}
+
+	PRINT_ERROR_MSG("Can't keep more than %d output files open.", MAX_OUTPUTS);
+	return NULL;
+}
+
+// Get the output file descriptor, opening it if needed, and lock it for a single job.
+// If 'splice_ready', make sure splice(2) can write to it.
+// Return the descriptor, or -1 on failure.
+static int acquire_output(struct Output *output, bool splice_ready)
+{
+	sig_atomic_t hangups_now = hangups;
+
+	// Reopen the file if asked to, or if the descriptor was inherited from the parent
+	// process (sharing it would also share the lock)
+	if (output->fd != -1 && (output->hangups_seen != hangups_now ||
+	                         output->owner != getpid())) {
+		if (output->hangups_seen != hangups_now && LOG_INFO)
+			PRINT_MSG("Hangup received, reopening output file '%s'.", output->file);
+
+		if (output->owner == getpid())
+			close_output(output);
+		else
+			close(output->fd);
+
+		output->fd = -1;
+	}
+
+	output->hangups_seen = hangups_now;
+
+	if (output->fd == -1 && open_output(output) == -1)
+		return -1;
+
+	// Listener processes write one job at a time
+	struct timespec locking;
+	clock_gettime(CLOCK_MONOTONIC, &locking);
+
+	int tmperr;
+	do {
+		tmperr = flock(output->fd, LOCK_EX);
+	} while (tmperr != 0 && errno == EINTR);
+
+	if (tmperr != 0) {
+		PRINT_SYSTEM_ERROR("flock", "Failed to lock output file '%s'.", output->file);
+		close_output(output);
+		return -1;
+	}
+
+	if (LOG_DEBUG && elapsed_ms(&locking) >= 1.0)
+		PRINT_MSG("Waited %.2f ms for output file '%s'.", elapsed_ms(&locking), output->file);
+
+	// splice(2) refuses files in append mode. As the lock is held by this process, the
+	// end of file can be found manually instead.
+	if (splice_ready && (output->flags & O_APPEND)) {
+		fcntl(output->fd, F_SETFL, output->flags & ~O_APPEND);
+		lseek(output->fd, 0, SEEK_END);
+		output->append_cleared = true;
+	}
+
+	return output->fd;
+}
+
+static void release_output(struct Output *output)
+{
+	if (output->fd == -1)
+		return;
+
+	if (output->append_cleared) {
+		fcntl(output->fd, F_SETFL, output->flags);
+		output->append_cleared = false;
+	}
+
+	flock(output->fd, LOCK_UN);
+}
+
+static int open_output(struct Output *output)
+{
+	struct timespec opening;
+	clock_gettime(CLOCK_MONOTONIC, &opening);
+
+	// Regular files are appended to from the start, so earlier jobs (and session
+	// commands), as well as output of another COPRIS, are kept
+	output->fd = open(output->file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (output->fd == -1) {
+		PRINT_SYSTEM_ERROR("open", "Failed to open output file '%s'.", output->file);
+		return -1;
+	}
+
+	output->owner = getpid();
+
+	struct stat file_info;
+	output->flags = fcntl(output->fd, F_GETFL);
+	if (fstat(output->fd, &file_info) != 0 || !S_ISREG(file_info.st_mode)) {
+		// Devices have no end to append to
+		output->flags &= ~O_APPEND;
+
+		// A device, which stops accepting text, mustn't block the writer indefinitely
+		if (write_timeout)
+			output->flags |= O_NONBLOCK;
+	}
+
+	fcntl(output->fd, F_SETFL, output->flags);
+
+	if (LOG_DEBUG)
+		PRINT_MSG("Output file '%s' opened in %.2f ms.", output->file, elapsed_ms(&opening));
+
+	return 0;
+}
+
+static void close_output(struct Output *output)
+{
+	if (output->fd == -1)
+		return;
+
+	struct timespec closing;
+	clock_gettime(CLOCK_MONOTONIC, &closing);
+
+	int tmperr = close(output->fd);
+	output->fd = -1;
+
+	if (tmperr != 0)
+		PRINT_SYSTEM_ERROR("close", "Failed to close output file '%s'.", output->file);
+	else if (LOG_DEBUG)
+		PRINT_MSG("Output file '%s' closed in %.2f ms.", output->file, elapsed_ms(&closing));
+}
+
+// Write 'length' bytes of 'text' to the output file and count them in 'written'.
+// On failure, or if the output accepts nothing for the write timeout, close the
+// output, so it is reopened for the next job.
+static int write_all(struct Output *output, const char *text, size_t length,
+                     size_t *written)
+{
+	while (*written < length) {
+		ssize_t written_now = write(output->fd, text + *written, length - *written);
+		if (written_now == -1) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN) {
+				struct pollfd device = { .fd = output->fd, .events = POLLOUT };
+				int ready = poll(&device, 1, write_timeout);
+				if (ready == 1 || (ready == -1 && errno == EINTR))
+					continue;
+
+				if (ready == 0)
+					PRINT_ERROR_MSG("Output file '%s' accepted no text for %d s.",
+					                output->file, write_timeout / 1000);
+				else
+					PRINT_SYSTEM_ERROR("poll", "Error waiting for output file '%s'.",
+					                   output->file);
+
+				close_output(output);
+				return -1;
+			}
+
+			PRINT_SYSTEM_ERROR("write", "Error writing to output file '%s'.", output->file);
+			close_output(output);
+			return -1;
+		}
+
+		*written += written_now;
+	}
+
+	return 0;
+}
+
+static void hangup_handler(int signum)
+{
+	(void)signum;
+	hangups++;
+}
+
+static double elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
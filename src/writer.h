@@ -1,5 +1,42 @@
 /*
- * Write text from 'copris_text' to output file 'output_file'.
+ * Open output file 'output_file' (appending to it, if it's a regular file) and keep it
+ * open for all following jobs.
+ * Return 0 on success.
+ */
+int copris_output_open(const char *output_file);
+
+/*
+ * Reopen the output file on the next job, once SIGHUP is received.
+ */
+void copris_output_watch_hangup(void);
+
+/*
+ * Give up writing a job to an output device (not a regular file) that accepts no
+ * text for 'seconds' (0 - wait indefinitely). Applies to output files opened later on.
+ */
+void copris_output_timeout(int seconds);
+
+/*
+ * Get the descriptor of output file 'output_file' (opening it, if it isn't yet), locked
+ * against other listener processes, for writing a job with splice(2). Release it with
+ * copris_output_release(); don't close it.
+ * Return the file descriptor, or -1 on failure.
+ */
+int copris_output_acquire(const char *output_file);
+
+/*
+ * Release output file 'output_file', acquired by copris_output_acquire().
+ */
+void copris_output_release(const char *output_file);
+
+/*
+ * Close all output files, kept open between jobs.
+ */
+void copris_output_close(void);
+
+/*
+ * Write text from 'copris_text' to output file 'output_file', which is kept open for
+ * the following jobs.
  * Return zero on success, nonzero on failure.
  */
 int copris_write_file(const char *output_file, UT_string *copris_text);
@@ -9,3 +46,23 @@ int copris_write_file(const char *output_file, UT_string *copris_text);
  * Return zero on success, nonzero on failure.
  */
 int copris_write_stdout(UT_string *copris_text);
+
+/*
+ * Open output file 'output_file' for writing a text in multiple chunks. If it is NULL,
+ * write to the standard output instead.
+ * Return the opened stream, or NULL on failure.
+ */
+FILE *copris_open_output(const char *output_file);
+
+/*
+ * Write 'length' bytes of 'text' to 'output', opened by copris_open_output().
+ * Return zero on success, nonzero on failure.
+ */
+int copris_write_chunk(FILE *output, const char *text, size_t length);
+
+/*
+ * Close 'output', opened by copris_open_output() with 'output_file'. The output file
+ * itself is kept open.
+ * Return zero on success, nonzero on failure.
+ */
+int copris_close_output(FILE *output, const char *output_file);
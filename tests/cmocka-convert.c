@@ -0,0 +1,179 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uthash.h>
+#include <utstring.h>
+
+#include "../src/Copris.h"
+#include "../src/convert.h"
+#include "../src/feature.h"
+#include "../src/recode.h"
+
+int verbosity = 0;
+
+struct Inifile *encoding = NULL;
+struct Inifile *features = NULL;
+
+// Commands, reached by their ID; names are too long for MAX_INIFILE_ELEMENT_LENGTH
+static struct Inifile commands[NUM_OF_COMMANDS];
+static struct Inifile variable = { .in = "C_X", .out = "\x1B" "X", .out_len = 2 };
+
+// Pieces of text, put together at random. Some commands and pieces are parts of
+// multi-byte characters, and end up next to each other.
+static const char *pieces[] = {
+	"plain text ", "\n", "**bold** ", "*italic* ", "***both*** ", "_under_ ", "`code` ",
+	"```\nblock\n```\n", "# Heading\n", "## H2\n", "#### H4\n", "> quote\n", "<link> ",
+	"\\*escaped\\* ", "\n---\n", "\n***\n", "čž ", "€", "漢", "\xC4", "\x8D", "\xE2\x82",
+	"\xFF", "\xF0\x9F", "$C_X\n", "$0x41 66\n", "$# comment\n", "$ alone\n", "$$C_X\n",
+	"A", "    indented\n", "\r\n"
+};
+
+static const char *modelines[] = {
+	"", "COPRIS ENABLE-VARS\n", "COPRIS DISABLE-MD\n", "copris enable-vars disable-md\n",
+	"COPRIS\n", "COPRIS unknown\n", "COPRIS ENABLE-VARS"
+};
+
+static int setup(void **state)
+{
+	(void)state;
+
+	char path[] = "/tmp/cmocka-convert-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+		return -1;
+
+	const char definitions[] = "č = 0x63\nž = 0x7A\n€ = 0x45\nA = 0x61\n";
+	ssize_t written = write(fd, definitions, sizeof definitions - 1);
+	close(fd);
+
+	int error = (written != sizeof definitions - 1) || load_encoding_file(path, &encoding);
+	unlink(path);
+
+	// Each command has its own code, except for a few empty ones
+	for (int i = 0; i < NUM_OF_COMMANDS; i++) {
+		commands[i].in[0] = 'S';
+		commands[i].out[0] = 0x1B;
+		commands[i].out[1] = (char)('a' + i);
+		commands[i].out_len = (i % 7 == 3) ? 0 : 2;
+		command_table[i] = &commands[i];
+	}
+
+	commands[CMD_F_BOLD_ON].out[1]     = '\xC4';
+	commands[CMD_F_BOLD_OFF].out[0]    = '\x8D';
+	commands[CMD_S_BEFORE_TEXT].out[1] = '\xE2';
+	commands[CMD_S_AFTER_TEXT].out[0]  = '\x82';
+
+	HASH_ADD_STR(features, in, &variable);
+
+	return error;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	HASH_DEL(features, &variable);
+	unload_encoding_definitions(&encoding);
+
+	return 0;
+}
+
+// Convert 'text' both block by block and stage by stage, and compare the results
+static void convert_both(const char *text, size_t text_len, int copris_flags)
+{
+	struct Attribs attrib = { .copris_flags = copris_flags };
+
+	UT_string *blocks, *stages;
+	utstring_new(blocks);
+	utstring_new(stages);
+	utstring_bincpy(blocks, text, text_len);
+	utstring_bincpy(stages, text, text_len);
+
+	int blocks_error = convert_text(blocks, &attrib, &encoding, &features);
+	int stages_error = convert_text_staged(stages, &attrib, &encoding, &features);
+
+	assert_int_equal(blocks_error, stages_error);
+	assert_int_equal(utstring_len(blocks), utstring_len(stages));
+	assert_memory_equal(utstring_body(blocks), utstring_body(stages), utstring_len(stages));
+
+	utstring_free(blocks);
+	utstring_free(stages);
+}
+
+// Blocks are CONVERT_BLOCK bytes long (set low for tests), so texts span many of them
+static void fused_matches_staged(void **state)
+{
+	(void)state;
+
+	const int flags[] = {
+		HAS_FEATURES,
+		HAS_FEATURES | HAS_ENCODING,
+		HAS_FEATURES | HAS_ENCODING | ENCODING_NO_STOP
+	};
+
+	convert_both("", 0, HAS_FEATURES | HAS_ENCODING);
+	convert_both("COPRIS ENABLE-VARS\n", 19, HAS_FEATURES | HAS_ENCODING);
+
+	srand(1);
+	UT_string *text;
+	utstring_new(text);
+
+	for (int n = 0; n < 3000; n++) {
+		utstring_clear(text);
+		utstring_printf(text, "%s", modelines[rand() % (sizeof modelines / sizeof *modelines)]);
+
+		int count = rand() % 40;
+		for (int i = 0; i < count; i++)
+			utstring_printf(text, "%s", pieces[rand() % (sizeof pieces / sizeof *pieces)]);
+
+		convert_both(utstring_body(text), utstring_len(text), flags[n % 3]);
+	}
+
+	utstring_free(text);
+}
+
+// Texts over two RECODE_PART_MIN are recoded in parts, once the other stages are done
+static void parts_match_staged(void **state)
+{
+	(void)state;
+
+	recode_set_threads(4);
+
+	srand(2);
+	UT_string *text;
+	utstring_new(text);
+
+	for (int n = 0; n < 3; n++) {
+		utstring_clear(text);
+		utstring_printf(text, "%s", modelines[n + 1]);
+
+		while (utstring_len(text) < 2 * RECODE_PART_MIN + 1)
+			utstring_printf(text, "%s", pieces[rand() % (sizeof pieces / sizeof *pieces)]);
+
+		convert_both(utstring_body(text), utstring_len(text),
+		             HAS_FEATURES | HAS_ENCODING | ENCODING_NO_STOP);
+	}
+
+	utstring_free(text);
+	recode_set_threads(1);
+}
+
+int main(int argc, char **argv)
+{
+	// Number of (arbitrary) arguments sets the verbosity level
+	verbosity = argc - 1;
+	(void)argv;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(fused_matches_staged),
+		cmocka_unit_test(parts_match_staged),
+	};
+
+	return cmocka_run_group_tests_name((__FILE__) + 7, tests, setup, teardown);
+}
@@ -38,6 +38,49 @@ static void duplicate_printer_commands(void **state)
 	}
 }
 
+static void printer_command_ids(void **state)
+{
+	(void)state;
+
+	static const struct {
+		command_t id;
+		const char *name;
+	} commands[] = {
+		{ CMD_F_BOLD_ON, "F_BOLD_ON" },
+		{ CMD_F_BOLD_OFF, "F_BOLD_OFF" },
+		{ CMD_F_ITALIC_ON, "F_ITALIC_ON" },
+		{ CMD_F_ITALIC_OFF, "F_ITALIC_OFF" },
+		{ CMD_F_H1_ON, "F_H1_ON" },
+		{ CMD_F_H1_OFF, "F_H1_OFF" },
+		{ CMD_F_H2_ON, "F_H2_ON" },
+		{ CMD_F_H2_OFF, "F_H2_OFF" },
+		{ CMD_F_H3_ON, "F_H3_ON" },
+		{ CMD_F_H3_OFF, "F_H3_OFF" },
+		{ CMD_F_H4_ON, "F_H4_ON" },
+		{ CMD_F_H4_OFF, "F_H4_OFF" },
+		{ CMD_F_BLOCKQUOTE_ON, "F_BLOCKQUOTE_ON" },
+		{ CMD_F_BLOCKQUOTE_OFF, "F_BLOCKQUOTE_OFF" },
+		{ CMD_F_INLINE_CODE_ON, "F_INLINE_CODE_ON" },
+		{ CMD_F_INLINE_CODE_OFF, "F_INLINE_CODE_OFF" },
+		{ CMD_F_CODE_BLOCK_ON, "F_CODE_BLOCK_ON" },
+		{ CMD_F_CODE_BLOCK_OFF, "F_CODE_BLOCK_OFF" },
+		{ CMD_F_ANGLE_BRACKET_ON, "F_ANGLE_BRACKET_ON" },
+		{ CMD_F_ANGLE_BRACKET_OFF, "F_ANGLE_BRACKET_OFF" },
+		{ CMD_S_BEFORE_TEXT, "S_BEFORE_TEXT" },
+		{ CMD_S_AFTER_TEXT, "S_AFTER_TEXT" },
+		{ CMD_S_AT_STARTUP, "S_AT_STARTUP" },
+		{ CMD_S_AT_SHUTDOWN, "S_AT_SHUTDOWN" },
+	};
+
+	size_t count = sizeof commands / sizeof *commands;
+	assert_int_equal(count, NUM_OF_COMMANDS);
+	assert_null(printer_commands[NUM_OF_COMMANDS]);
+
+	for (size_t i = 0; i < count; i++)
+		assert_string_equal(printer_commands[commands[i].id], commands[i].name);
+
+}
+
 int main(int argc, char **argv)
 {
 	// Number of (arbitrary) arguments sets the verbosity level
@@ -46,6 +89,7 @@ int main(int argc, char **argv)
 
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(duplicate_printer_commands),
+		cmocka_unit_test(printer_command_ids),
 	};
 
 	return cmocka_run_group_tests_name((__FILE__) + 7, tests, NULL, NULL);
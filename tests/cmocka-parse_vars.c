@@ -34,6 +34,8 @@ static void check_parse_modeline(void **state)
 	MODELINE_TEST("copris disable-md", ML_UNKNOWN | ML_DISABLE_MD);
 	MODELINE_TEST("COPRIS disable-md ENABLE-VARIABLES", ML_UNKNOWN | ML_DISABLE_MD | ML_ENABLE_VAR);
 	MODELINE_TEST("Copris Enable-Vars Disable-Markdown", ML_UNKNOWN | ML_ENABLE_VAR | ML_DISABLE_MD);
+	MODELINE_TEST("copris priority-high", ML_UNKNOWN | ML_PRIORITY_HIGH);
+	MODELINE_TEST("COPRIS DISABLE-MD PRIORITY-LOW", ML_UNKNOWN | ML_DISABLE_MD | ML_PRIORITY_LOW);
 
 	utstring_free(text);
 }
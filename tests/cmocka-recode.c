@@ -3,6 +3,11 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <uthash.h>
 #include <utstring.h>
 
@@ -43,6 +48,189 @@ static void recode(void **state)
 	utstring_free(text);
 }
 
+// Undefined multi-byte characters, and bytes that aren't characters, are kept as they are
+static void recode_undefined(void **state)
+{
+	(void)state;
+	UT_string *text;
+	utstring_new(text);
+	utstring_printf(text, "ač\xFF漢 9,49 €č");
+
+	int error = recode_text(text, &encoding);
+	assert_true(error);
+
+	assert_string_equal(utstring_body(text), "ac\xFF漢 9,49 €c");
+
+	utstring_free(text);
+}
+
+// Statistics file counts recoded bytes, and lists characters without a definition
+static void recode_stats(void **state)
+{
+	(void)state;
+	char path[] = "/tmp/cmocka-recode-stats-XXXXXX";
+	int fd = mkstemp(path);
+	assert_int_not_equal(fd, -1);
+	close(fd);
+
+	UT_string *text;
+	utstring_new(text);
+	utstring_printf(text, "č€漢€A");
+
+	// Counted from the first recoded text on
+	recode_set_stats_file(path);
+	recode_text(text, &encoding);
+	recode_set_stats_file(NULL);
+
+	FILE *file = fopen(path, "r");
+	assert_non_null(file);
+
+	// Read with getc(), as read() and fread() are mocked
+	char contents[1024];
+	size_t length = 0;
+	int c;
+	while (length < sizeof contents - 1 && (c = getc(file)) != EOF)
+		contents[length++] = (char)c;
+
+	contents[length] = '\0';
+	fclose(file);
+	unlink(path);
+
+	const char expected[] =
+	        "; Recoding statistics of all texts so far\n"
+	        "; Bytes before recoding: 12\n"
+	        "; Bytes after recoding: 11\n"
+	        "; Characters, replaced by their definitions: 1\n"
+	        "; Characters without a definition: 3 (2 different)\n"
+	        ";\n"
+	        "; Characters without a definition, the most frequent first.\n"
+	        "; Uncomment them and fill in their definitions.\n"
+	        "\n"
+	        "; U+20AC, found 2 time(s)\n"
+	        ";€ = \n"
+	        "\n"
+	        "; U+6F22, found 1 time(s)\n"
+	        ";漢 = \n";
+	assert_string_equal(contents, expected);
+
+	utstring_free(text);
+}
+
+// Definitions, mapped from the cache file, recode the same as loaded ones
+static void recode_cached(void **state)
+{
+	(void)state;
+	char cache_dir[] = "/tmp/cmocka-recode-XXXXXX";
+	assert_non_null(mkdtemp(cache_dir));
+
+	char *filenames[] = { "cmocka-recode.ini" };
+
+	for (int run = 0; run < 2; run++) {
+		// The first run stores the cache file, the second one uses it
+		struct Inifile *cached = NULL;
+		int error = load_encoding_files(filenames, 1, cache_dir, &cached);
+		assert_false(error);
+		assert_int_equal(HASH_COUNT(cached), (run == 0) ? 3 : 0);
+
+		UT_string *text;
+		utstring_new(text);
+		utstring_printf(text, "ač\xFF漢 9,49 €č");
+
+		error = recode_text(text, &cached);
+		assert_true(error);
+		assert_string_equal(utstring_body(text), "ac\xFF漢 9,49 €c");
+
+		utstring_free(text);
+		unload_encoding_definitions(&cached);
+	}
+
+	DIR *dir = opendir(cache_dir);
+	assert_non_null(dir);
+
+	struct dirent *entry;
+	int file_count = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		char path[sizeof cache_dir + 256];
+		snprintf(path, sizeof path, "%s/%s", cache_dir, entry->d_name);
+		unlink(path);
+		file_count++;
+	}
+
+	closedir(dir);
+	rmdir(cache_dir);
+
+	assert_int_equal(file_count, 1);
+}
+
+// A built-in encoding recodes on its own, and along with encoding files
+static void recode_builtin(void **state)
+{
+	(void)state;
+	char *filenames[] = { "builtin:cp852", "cmocka-recode.ini" };
+
+	for (int count = 1; count <= 2; count++) {
+		struct Inifile *builtin = NULL;
+		int error = load_encoding_files(filenames, count, NULL, &builtin);
+		assert_false(error);
+
+		UT_string *text;
+		utstring_new(text);
+		utstring_printf(text, "ačBš");
+
+		error = recode_text(text, &builtin);
+		assert_false(error);
+
+		// Definitions from the file replace built-in ones
+		assert_string_equal(utstring_body(text), (count == 1) ? "a\x9F" "B\xE7" : "acBs");
+
+		utstring_free(text);
+		unload_encoding_definitions(&builtin);
+	}
+
+	struct Inifile *missing = NULL;
+	char *missing_name[] = { "builtin:none" };
+	assert_true(load_encoding_files(missing_name, 1, NULL, &missing));
+}
+
+// Text, recoded in parts, is the same as if recoded as a whole, even if it isn't valid
+// UTF-8
+static void recode_parallel(void **state)
+{
+	(void)state;
+	const char *pieces[] = { "č", "ž", "A", "\n", "漢", "\xE2\x82", "\xF0", "\x80", "š€" };
+	const size_t piece_count = sizeof pieces / sizeof *pieces;
+
+	UT_string *serial;
+	utstring_new(serial);
+
+	srand(1);
+	while (utstring_len(serial) < 3 * RECODE_PART_MIN + 7) {
+		const char *piece = pieces[rand() % piece_count];
+		utstring_bincpy(serial, piece, strlen(piece));
+	}
+
+	UT_string *parallel;
+	utstring_new(parallel);
+	utstring_concat(parallel, serial);
+
+	recode_set_threads(1);
+	int serial_error = recode_text(serial, &encoding);
+
+	recode_set_threads(4);
+	int parallel_error = recode_text(parallel, &encoding);
+	recode_set_threads(1);
+
+	assert_int_equal(serial_error, parallel_error);
+	assert_int_equal(utstring_len(serial), utstring_len(parallel));
+	assert_memory_equal(utstring_body(serial), utstring_body(parallel), utstring_len(serial));
+
+	utstring_free(serial);
+	utstring_free(parallel);
+}
+
 int main(int argc, char **argv)
 {
 	// Number of (arbitrary) arguments sets the verbosity level
@@ -51,8 +239,13 @@ int main(int argc, char **argv)
 
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(load_definitions),
+		cmocka_unit_test(recode_stats),
 		cmocka_unit_test(recode),
+		cmocka_unit_test(recode_undefined),
+		cmocka_unit_test(recode_parallel),
 		cmocka_unit_test(unload_definitions),
+		cmocka_unit_test(recode_cached),
+		cmocka_unit_test(recode_builtin),
 	};
 
 	return cmocka_run_group_tests_name((__FILE__) + 7, tests, NULL, NULL);
@@ -0,0 +1,57 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../src/scan.h"
+
+int verbosity = 0;
+
+// Check if scanning stops at bytes in the set, also past the first vector's width
+static void scan_test_bytes(void **state)
+{
+	(void)state;
+	struct Scan_set set;
+	scan_set_init(&set, "*\n", 2, false);
+
+	const char short_text[] = "abc*def";
+	const char long_text[]  = "The quick brown fox jumps over the lazy dog\nagain";
+	const char plain_text[] = "The quick brown fox jumps over the lazy dog, čšž";
+
+	assert_int_equal(scan_span(&set, short_text, strlen(short_text)), 3);
+	assert_int_equal(scan_span(&set, long_text, strlen(long_text)), 43);
+	assert_int_equal(scan_span(&set, plain_text, strlen(plain_text)), strlen(plain_text));
+	assert_int_equal(scan_span(&set, "", 0), 0);
+}
+
+// Check if scanning stops at non-ASCII bytes, and at bytes of sets too big for vectors
+static void scan_test_high_bit(void **state)
+{
+	(void)state;
+	struct Scan_set set;
+	const char many_bytes[] = "0123456789";
+	scan_set_init(&set, many_bytes, 10, true);
+
+	const char text[] = "The quick brown fox jumps over the lazy dog, čšž";
+	const char digits[] = "The quick brown fox jumps over the lazy dog 5 times";
+
+	assert_int_equal(scan_span(&set, text, strlen(text)), 45);
+	assert_int_equal(scan_span(&set, digits, strlen(digits)), 44);
+}
+
+int main(int argc, char **argv)
+{
+	// Number of (arbitrary) arguments sets the verbosity level
+	verbosity = argc - 1;
+	(void)argv;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(scan_test_bytes),
+		cmocka_unit_test(scan_test_high_bit)
+	};
+
+	return cmocka_run_group_tests_name((__FILE__) + 7, tests, NULL, NULL);
+}
@@ -12,7 +12,7 @@ int verbosity = 0;
 
 int parentfd = 0;
 int childfd  = 0;
-struct Attribs attrib;
+struct Attribs attrib = { .bufsize = BUFSIZE };
 
 static void expected_stats(size_t sizeof_bytes, int chunks)
 {
@@ -106,11 +106,12 @@ static void read_with_null_value(void **state)
 
 #define MUST_DISCARD 0x00
 
-// Check if text gets discarded properly
+// Check if text gets discarded properly. Nothing more than a byte over the limit
+// should be read.
 static void byte_limit_discard(void **state)
 {
 	UT_string *copris_text = *state;
-	INPUT ("aaaBBBccc");
+	INPUT ("aaaBB");
 	RESULT("");
 
 	attrib.copris_flags = MUST_DISCARD;
@@ -135,7 +136,7 @@ static void byte_limit_discard_not(void **state)
 static void byte_limit_cutoff(void **state)
 {
 	UT_string *copris_text = *state;
-	INPUT ("aaaBBBccc");
+	INPUT ("aaaBBB");
 	RESULT("aaaBB");
 
 	attrib.copris_flags = MUST_CUTOFF;
@@ -181,6 +182,118 @@ static void byte_limit_cutoff_multibyte2(void **state)
 	VERIFY;
 }
 
+// Check if text, announced to be over the limit, gets refused before it's read
+static void length_header_refused(void **state)
+{
+	UT_string *copris_text = *state;
+	INPUT ("COPRIS LEN");
+	INPUT ("GTH 40\n");
+	RESULT("");
+
+	attrib.copris_flags = MUST_CUTOFF;
+	attrib.limitnum     = 30;
+
+	VERIFY;
+}
+
+// Check if the length header gets removed from text within the limit
+static void length_header_accepted(void **state)
+{
+	UT_string *copris_text = *state;
+	INPUT ("COPRIS LEN");
+	INPUT ("GTH 3\naaa");
+	RESULT("aaa");
+
+	attrib.copris_flags = MUST_CUTOFF;
+	attrib.limitnum     = 30;
+
+	VERIFY;
+}
+
+// Check if text, sent past the announced length, gets cut off there
+static void length_header_overrun_cutoff(void **state)
+{
+	UT_string *copris_text = *state;
+	INPUT ("COPRIS LEN");
+	INPUT ("GTH 3\naaa");
+	INPUT ("B");
+	RESULT("aaa");
+
+	attrib.copris_flags = MUST_CUTOFF;
+	attrib.limitnum     = 30;
+
+	VERIFY;
+}
+
+static void length_header_overrun_discard(void **state)
+{
+	UT_string *copris_text = *state;
+	INPUT ("COPRIS LEN");
+	INPUT ("GTH 3\naaa");
+	INPUT ("B");
+	RESULT("");
+
+	attrib.copris_flags = MUST_DISCARD;
+	attrib.limitnum     = 30;
+
+	VERIFY;
+}
+
+// Check if the length header is left in text when there's no limit
+static void length_header_no_limit(void **state)
+{
+	UT_string *copris_text = *state;
+	INPUT ("COPRIS LEN");
+	INPUT ("GTH 3\naaaB");
+	RESULT("COPRIS LENGTH 3\naaaB");
+
+	attrib.copris_flags = MUST_CUTOFF;
+	attrib.limitnum     = 0;
+
+	VERIFY;
+}
+
+// Check if the nearest of client's deadlines is found
+static void deadline_nearest(void **state)
+{
+	(void)state;
+	struct Attribs deadlines = { .timeout_first = 5, .timeout_idle = 2, .timeout_total = 30 };
+	timeout_t deadline;
+	long long now = monotonic_ms();
+
+	// Waiting for the first chunk
+	int wait_time = time_to_deadline(now, 0, &deadlines, &deadline);
+	assert_int_equal(deadline, TIMEOUT_FIRST);
+	assert_in_range(wait_time, 4900, 5000);
+
+	// Waiting for the next one
+	wait_time = time_to_deadline(now, now, &deadlines, &deadline);
+	assert_int_equal(deadline, TIMEOUT_IDLE);
+	assert_in_range(wait_time, 1900, 2000);
+
+	// Whole text is due sooner than the next chunk
+	wait_time = time_to_deadline(now - 29000, now, &deadlines, &deadline);
+	assert_int_equal(deadline, TIMEOUT_TOTAL);
+	assert_in_range(wait_time, 900, 1000);
+}
+
+// Check if a passed deadline leaves no time, and no deadlines leave unlimited time
+static void deadline_passed_or_none(void **state)
+{
+	(void)state;
+	struct Attribs deadlines = { .timeout_idle = 2 };
+	timeout_t deadline;
+	long long now = monotonic_ms();
+
+	// Idle timeout doesn't apply before the first chunk
+	int wait_time = time_to_deadline(now, 0, &deadlines, &deadline);
+	assert_int_equal(deadline, TIMEOUT_NONE);
+	assert_int_equal(wait_time, -1);
+
+	wait_time = time_to_deadline(now - 5000, now - 3000, &deadlines, &deadline);
+	assert_int_equal(deadline, TIMEOUT_IDLE);
+	assert_int_equal(wait_time, 0);
+}
 
 static int setup_utstring(void **state)
 {
@@ -218,18 +331,25 @@ int main(int argc, char **argv)
 	attrib.copris_flags = 0x00;
 
 	const struct CMUnitTest tests[] = {
-		cmocka_unit_test_teardown(read_two_chunks,              clear_utstring),
-		cmocka_unit_test_teardown(read_2byte_char,              clear_utstring),
-		cmocka_unit_test_teardown(read_3byte_char1,             clear_utstring),
-		cmocka_unit_test_teardown(read_3byte_char2,             clear_utstring),
-		cmocka_unit_test_teardown(read_4byte_char,              clear_utstring),
-		cmocka_unit_test_teardown(read_with_null_value,         clear_utstring),
-		cmocka_unit_test_teardown(byte_limit_discard,           clear_utstring),
-		cmocka_unit_test_teardown(byte_limit_discard_not,       clear_utstring),
-		cmocka_unit_test_teardown(byte_limit_cutoff,            clear_utstring),
-		cmocka_unit_test_teardown(byte_limit_cutoff_not,        clear_utstring),
-		cmocka_unit_test_teardown(byte_limit_cutoff_multibyte1, clear_utstring),
-		cmocka_unit_test(         byte_limit_cutoff_multibyte2)
+		cmocka_unit_test_teardown(read_two_chunks,               clear_utstring),
+		cmocka_unit_test_teardown(read_2byte_char,               clear_utstring),
+		cmocka_unit_test_teardown(read_3byte_char1,              clear_utstring),
+		cmocka_unit_test_teardown(read_3byte_char2,              clear_utstring),
+		cmocka_unit_test_teardown(read_4byte_char,               clear_utstring),
+		cmocka_unit_test_teardown(read_with_null_value,          clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_discard,            clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_discard_not,        clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_cutoff,             clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_cutoff_not,         clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_cutoff_multibyte1,  clear_utstring),
+		cmocka_unit_test_teardown(byte_limit_cutoff_multibyte2,  clear_utstring),
+		cmocka_unit_test_teardown(length_header_refused,         clear_utstring),
+		cmocka_unit_test_teardown(length_header_accepted,        clear_utstring),
+		cmocka_unit_test_teardown(length_header_overrun_cutoff,  clear_utstring),
+		cmocka_unit_test_teardown(length_header_overrun_discard, clear_utstring),
+		cmocka_unit_test_teardown(length_header_no_limit,        clear_utstring),
+		cmocka_unit_test(         deadline_nearest),
+		cmocka_unit_test(         deadline_passed_or_none)
 	};
 
 	return cmocka_run_group_tests_name((__FILE__) + 7, tests, setup_utstring, teardown_utstring);
@@ -0,0 +1,349 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utstring.h>
+
+#include "../src/Copris.h"
+#include "../src/spool.h"
+#include "../src/writer.h"
+
+int verbosity = 0;
+
+static struct Attribs attrib;
+
+// Each test gets a directory of its own, with output files and a spool directory
+static char test_dir[64];
+static char output_path[2][80];
+static char spool_path[80];
+static char missing_path[2][96]; // Output files in a directory that doesn't exist
+
+// Use the first 'count' output files as the printer pool
+static void use_printers(int count, balance_t balance)
+{
+	attrib.copris_flags = HAS_OUTPUT_FILE;
+	attrib.output_count = count;
+	attrib.balance      = balance;
+
+	for (int i = 0; i < count; i++)
+		attrib.output_files[i] = output_path[i];
+}
+
+// Hand 'text' from 'client' over to the spool
+static void submit(const char *text, priority_t priority, const char *client)
+{
+	UT_string *copris_text;
+	utstring_new(copris_text);
+	utstring_bincpy(copris_text, text, strlen(text));
+
+	int error = spool_submit(&copris_text, priority, client);
+	assert_false(error);
+
+	// Spool leaves an empty string in place of the text
+	assert_int_equal(utstring_len(copris_text), 0);
+	utstring_free(copris_text);
+}
+
+// Put 'text' into file 'name' in directory 'dir'
+static void put_file(const char *dir, const char *name, const char *text)
+{
+	char path[128];
+	snprintf(path, sizeof path, "%s/%s", dir, name);
+
+	FILE *file = fopen(path, "w");
+	assert_non_null(file);
+	assert_true(fputs(text, file) != EOF);
+	assert_false(fclose(file));
+}
+
+// Read up to 'size' - 1 bytes of file 'path' into 'contents' with getc(), as read()
+// and fread() are mocked. File may be a pipe, so stop after 'size' - 1 bytes.
+static size_t get_file(const char *path, char *contents, size_t size)
+{
+	FILE *file = fopen(path, "r");
+	assert_non_null(file);
+
+	size_t length = 0;
+	int c;
+	while (length < size - 1 && (c = getc(file)) != EOF)
+		contents[length++] = (char)c;
+
+	contents[length] = '\0';
+	fclose(file);
+
+	return length;
+}
+
+// Check if file 'name' exists in directory 'dir'
+static bool has_file(const char *dir, const char *name)
+{
+	char path[128];
+	snprintf(path, sizeof path, "%s/%s", dir, name);
+
+	return access(path, F_OK) == 0;
+}
+
+// Remove directory 'path' with all files in it
+static void remove_dir(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		char entry_path[PATH_MAX];
+		snprintf(entry_path, sizeof entry_path, "%s/%s", path, entry->d_name);
+
+		if (unlink(entry_path) != 0)
+			remove_dir(entry_path);
+	}
+
+	closedir(dir);
+	rmdir(path);
+}
+
+// Check if texts of a client are printed in order of arrival, even if they have to
+// wait for room in the spool
+static void print_in_order(void **state)
+{
+	(void)state;
+
+	use_printers(1, BALANCE_FREE);
+
+	int error = spool_start(2, 0, NULL, &attrib);
+	assert_false(error);
+
+	submit("one ", PRIORITY_NORMAL, "client");
+	submit("two ", PRIORITY_NORMAL, "client");
+	submit("three ", PRIORITY_NORMAL, "client");
+	submit("four ", PRIORITY_NORMAL, "client");
+	submit("five", PRIORITY_NORMAL, "client");
+
+	error = spool_stop();
+	assert_false(error);
+
+	char contents[64];
+	get_file(output_path[0], contents, sizeof contents);
+	assert_string_equal(contents, "one two three four five");
+}
+
+// Check if committed job files, left over from a previous run, are printed first, in
+// order of their sequence numbers and with their priority, and uncommitted ones are
+// discarded
+static void replay_job_files(void **state)
+{
+	(void)state;
+
+	put_file(spool_path, "00000000000000000015-2.job", "later ");
+	put_file(spool_path, "00000000000000000012-1.job", "second ");
+	put_file(spool_path, "00000000000000000011-1.tmp", "lost ");
+	put_file(spool_path, "00000000000000000014-0.job", "urgent ");
+	put_file(spool_path, "00000000000000000009-1.job", "first ");
+	put_file(spool_path, "notes.txt", "not a job");
+
+	use_printers(1, BALANCE_FREE);
+
+	int error = spool_start(4, 0, spool_path, &attrib);
+	assert_false(error);
+
+	// Leftovers are gone from the spool directory before anything new is stored
+	assert_false(has_file(spool_path, "00000000000000000011-1.tmp"));
+
+	// Among jobs of low priority, the left-over one is first in turn
+	submit("third", PRIORITY_LOW, "client");
+	spool_commit();
+
+	error = spool_stop();
+	assert_false(error);
+
+	char contents[64];
+	get_file(output_path[0], contents, sizeof contents);
+	assert_string_equal(contents, "urgent first second later third");
+
+	// Printed jobs, including the new one, are removed; other files are kept
+	assert_false(has_file(spool_path, "00000000000000000009-1.job"));
+	assert_false(has_file(spool_path, "00000000000000000014-0.job"));
+	assert_false(has_file(spool_path, "00000000000000000015-2.job"));
+	assert_false(has_file(spool_path, "00000000000000000016-2.tmp"));
+	assert_false(has_file(spool_path, "00000000000000000016-2.job"));
+	assert_true(has_file(spool_path, "notes.txt"));
+}
+
+// Append 'count' copies of 'c' to 'text' and return its end
+static char *fill(char *text, char c, size_t count)
+{
+	memset(text, c, count);
+	text[count] = '\0';
+
+	return text + count;
+}
+
+// Check if jobs of higher priority are printed first, and clients of the same priority
+// take turns, each having up to SPOOL_QUANTUM bytes printed in its turn
+static void schedule_by_priority_and_turns(void **state)
+{
+	(void)state;
+
+	// Writer can't open the pipe until it's opened for reading, so all jobs are in the
+	// spool before it decides which one to print after the first one
+	assert_false(mkfifo(output_path[0], 0600));
+	use_printers(1, BALANCE_FREE);
+
+	int error = spool_start(16, 0, NULL, &attrib);
+	assert_false(error);
+
+	char *job = malloc(SPOOL_QUANTUM + 1);
+	assert_non_null(job);
+
+	submit("X", PRIORITY_HIGH, "first");
+
+	fill(job, 'L', 10);
+	submit(job, PRIORITY_LOW, "late");
+
+	fill(job, 'A', SPOOL_QUANTUM);
+	submit(job, PRIORITY_NORMAL, "busy");
+	fill(job, 'B', SPOOL_QUANTUM);
+	submit(job, PRIORITY_NORMAL, "busy");
+	fill(job, 'C', SPOOL_QUANTUM);
+	submit(job, PRIORITY_NORMAL, "busy");
+
+	fill(job, 'd', 10);
+	submit(job, PRIORITY_NORMAL, "quiet");
+
+	fill(job, 'H', 10);
+	submit(job, PRIORITY_HIGH, "urgent");
+
+	free(job);
+
+	// The quiet client doesn't wait for all of the busy one's jobs
+	size_t length = 3 * SPOOL_QUANTUM + 31;
+	char *expected = malloc(length + 1);
+	char *contents = malloc(length + 2);
+	assert_non_null(expected);
+	assert_non_null(contents);
+
+	char *end = fill(expected, 'X', 1);
+	end = fill(end, 'H', 10);
+	end = fill(end, 'A', SPOOL_QUANTUM);
+	end = fill(end, 'd', 10);
+	end = fill(end, 'B', SPOOL_QUANTUM);
+	end = fill(end, 'C', SPOOL_QUANTUM);
+	fill(end, 'L', 10);
+
+	// Output file stays open, so read just as much as has been printed
+	assert_int_equal(get_file(output_path[0], contents, length + 1), length);
+	assert_memory_equal(contents, expected, length);
+
+	error = spool_stop();
+	assert_false(error);
+
+	free(expected);
+	free(contents);
+}
+
+// Check if a job, which a failed printer couldn't print, goes to the next printer in the
+// pool before the jobs that are still waiting
+static void fail_over_to_next_printer(void **state)
+{
+	(void)state;
+
+	put_file(spool_path, "00000000000000000001-1.job", "aaa");
+	put_file(spool_path, "00000000000000000002-1.job", "bbb");
+	put_file(spool_path, "00000000000000000003-1.job", "ccc");
+
+	use_printers(2, BALANCE_ROUND_ROBIN);
+	attrib.output_files[0] = missing_path[0];
+
+	int error = spool_start(4, 0, spool_path, &attrib);
+	assert_false(error);
+
+	error = spool_stop();
+	assert_false(error);
+
+	// The second printer may print its own job before the one it took over
+	char contents[64];
+	get_file(output_path[1], contents, sizeof contents);
+	assert_true(strcmp(contents, "aaabbbccc") == 0 || strcmp(contents, "bbbaaaccc") == 0);
+
+	assert_false(has_file(spool_path, "00000000000000000001-1.job"));
+	assert_false(has_file(test_dir, "missing"));
+}
+
+// Check if the spool fails once no printer of the pool is left, and keeps the job file
+// for the next run
+static void fail_without_printers(void **state)
+{
+	(void)state;
+
+	put_file(spool_path, "00000000000000000001-1.job", "aaa");
+
+	use_printers(2, BALANCE_FREE);
+	attrib.output_files[0] = missing_path[0];
+	attrib.output_files[1] = missing_path[1];
+
+	int error = spool_start(4, 0, spool_path, &attrib);
+	assert_false(error);
+
+	error = spool_stop();
+	assert_true(error);
+
+	assert_true(has_file(spool_path, "00000000000000000001-1.job"));
+}
+
+static int setup_dir(void **state)
+{
+	(void)state;
+
+	snprintf(test_dir, sizeof test_dir, "/tmp/cmocka-spool-XXXXXX");
+	if (mkdtemp(test_dir) == NULL)
+		return -1;
+
+	snprintf(output_path[0], sizeof output_path[0], "%s/printer-1", test_dir);
+	snprintf(output_path[1], sizeof output_path[1], "%s/printer-2", test_dir);
+	snprintf(spool_path, sizeof spool_path, "%s/spool", test_dir);
+	snprintf(missing_path[0], sizeof missing_path[0], "%s/missing/printer-1", test_dir);
+	snprintf(missing_path[1], sizeof missing_path[1], "%s/missing/printer-2", test_dir);
+
+	attrib = (struct Attribs){ 0 };
+
+	return mkdir(spool_path, 0700);
+}
+
+static int teardown_dir(void **state)
+{
+	(void)state;
+
+	// Output files are found by name, and the names are reused by the next test
+	copris_output_close();
+	remove_dir(test_dir);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	// Number of (arbitrary) arguments sets the verbosity level
+	verbosity = argc - 1;
+	(void)argv;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(print_in_order,                 setup_dir, teardown_dir),
+		cmocka_unit_test_setup_teardown(replay_job_files,               setup_dir, teardown_dir),
+		cmocka_unit_test_setup_teardown(schedule_by_priority_and_turns, setup_dir, teardown_dir),
+		cmocka_unit_test_setup_teardown(fail_over_to_next_printer,      setup_dir, teardown_dir),
+		cmocka_unit_test_setup_teardown(fail_without_printers,          setup_dir, teardown_dir)
+	};
+
+	return cmocka_run_group_tests_name((__FILE__) + 7, tests, NULL, NULL);
+}
@@ -10,6 +10,9 @@
 
 int verbosity = 0;
 
+// Default settings - text isn't streamed
+static struct Attribs attrib = { .bufsize = BUFSIZE };
+
 static void expected_stats(size_t sizeof_bytes, int chunks)
 {
 	if (verbosity)
@@ -24,7 +27,7 @@ static void stdin_read_no_text(void **state)
 
 	will_return(__wrap_fread, NULL); /* Signal an EOF */
 
-	int no_text_read = copris_handle_stdin(copris_text);
+	int no_text_read = copris_handle_stdin(copris_text, &attrib);
 	expected_stats(1, 0);
 
 	assert_true(no_text_read);
@@ -38,7 +41,7 @@ static void stdin_read_no_text(void **state)
         will_return(__wrap_fread, NULL);  \
         const char result[] = str
 #define VERIFY                            \
-        int error = copris_handle_stdin(copris_text); \
+        int error = copris_handle_stdin(copris_text, &attrib); \
         expected_stats(sizeof result, 2); \
                                           \
         assert_false(error);              \
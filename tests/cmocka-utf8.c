@@ -3,6 +3,7 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <utstring.h>
 
 #include "../src/Copris.h"
@@ -70,6 +71,74 @@ static void utf8_test_incomplete_buffer(void **state)
 	assert_true(was_terminated);
 }
 
+// Check how many bytes of an incomplete character are left at the end of a chunk
+static void utf8_test_incomplete_length(void **state)
+{
+	(void)state;
+	const char complete[] = "50\xE2\x82\xAC";   // "50€"
+	const char missing1[] = "hro\xC5\xA1\xC4";   // "hrošč", last byte missing
+	const char missing2[] = "50\xE2";             // "50€", last two bytes missing
+
+	assert_int_equal(utf8_incomplete_length(complete, (sizeof complete) - 1), 0);
+	assert_int_equal(utf8_incomplete_length(missing1, (sizeof missing1) - 1), 1);
+	assert_int_equal(utf8_incomplete_length(missing2, (sizeof missing2) - 1), 1);
+	assert_int_equal(utf8_incomplete_length("abc", 3), 0);
+	assert_int_equal(utf8_incomplete_length("", 0), 0);
+}
+
+// Check if characters are decoded into code points, and invalid ones refused
+static void utf8_test_decode(void **state)
+{
+	(void)state;
+	uint32_t codepoint;
+
+	assert_int_equal(utf8_decode("A", 1, &codepoint), 1);
+	assert_int_equal(codepoint, 0x41);
+
+	assert_int_equal(utf8_decode("č", 2, &codepoint), 2);
+	assert_int_equal(codepoint, 0x10D);
+
+	assert_int_equal(utf8_decode("€", 3, &codepoint), 3);
+	assert_int_equal(codepoint, 0x20AC);
+
+	assert_int_equal(utf8_decode("🄌", 4, &codepoint), 4);
+	assert_int_equal(codepoint, 0x1F10C);
+
+	assert_int_equal(utf8_decode("\xE2\x82", 2, &codepoint), 0); /* Cut off         */
+	assert_int_equal(utf8_decode("\xC4" "A", 2, &codepoint), 0);  /* No continuation */
+	assert_int_equal(utf8_decode("\xC0\x81", 2, &codepoint), 0); /* Overlong 'A'    */
+	assert_int_equal(utf8_decode("\x80", 1, &codepoint), 0);     /* Stray byte      */
+	assert_int_equal(utf8_decode("\xF4\x90\x80\x80", 4, &codepoint), 0); /* > U+10FFFF */
+	assert_int_equal(utf8_decode("\xED\xA0\x80", 3, &codepoint), 0); /* Surrogate      */
+	assert_int_equal(utf8_decode("\xE0\x9F\xBF", 3, &codepoint), 0); /* Overlong U+7FF */
+	assert_int_equal(utf8_decode("\xF0\x8F\xBF\xBF", 4, &codepoint), 0); /* Overlong  */
+	assert_int_equal(utf8_decode("\xE2\x82" "A", 3, &codepoint), 0); /* Not continued  */
+
+	// Characters at the edges of allowed ranges
+	assert_int_equal(utf8_decode("\xED\x9F\xBF", 3, &codepoint), 3);
+	assert_int_equal(codepoint, 0xD7FF);
+	assert_int_equal(utf8_decode("\xF4\x8F\xBF\xBF", 4, &codepoint), 4);
+	assert_int_equal(codepoint, 0x10FFFF);
+}
+
+static void utf8_test_encode(void **state)
+{
+	(void)state;
+	char s[UTF8_MAX_LENGTH];
+
+	assert_int_equal(utf8_encode(0x41, s), 1);
+	assert_memory_equal(s, "A", 1);
+
+	assert_int_equal(utf8_encode(0x10D, s), 2);
+	assert_memory_equal(s, "č", 2);
+
+	assert_int_equal(utf8_encode(0x20AC, s), 3);
+	assert_memory_equal(s, "€", 3);
+
+	assert_int_equal(utf8_encode(0x1F10C, s), 4);
+	assert_memory_equal(s, "🄌", 4);
+}
+
 int main(int argc, char **argv)
 {
 	// Number of (arbitrary) arguments sets the verbosity level
@@ -79,7 +148,10 @@ int main(int argc, char **argv)
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(utf8_test_multibyte_string_length),
 		cmocka_unit_test(utf8_test_codepoint_length),
-		cmocka_unit_test(utf8_test_incomplete_buffer)
+		cmocka_unit_test(utf8_test_incomplete_buffer),
+		cmocka_unit_test(utf8_test_incomplete_length),
+		cmocka_unit_test(utf8_test_decode),
+		cmocka_unit_test(utf8_test_encode)
 	};
 
 	return cmocka_run_group_tests_name((__FILE__) + 7, tests, NULL, NULL);
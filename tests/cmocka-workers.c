@@ -0,0 +1,163 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <uthash.h>
+#include <utstring.h>
+
+#include "../src/Copris.h"
+#include "../src/recode.h"
+#include "../src/workers.h"
+
+int verbosity = 0;
+
+// Texts are only recoded, so it's easy to tell a converted one
+static struct Attribs attrib = { .copris_flags = HAS_ENCODING | ENCODING_NO_STOP };
+static struct Inifile *encoding = NULL;
+static struct Inifile *features = NULL;
+
+static int setup(void **state)
+{
+	(void)state;
+
+	// Written with stdio, as write() is mocked
+	char path[] = "/tmp/cmocka-workers-XXXXXX";
+	int fd = mkstemp(path);
+	FILE *file = (fd != -1) ? fdopen(fd, "w") : NULL;
+	if (file == NULL)
+		return -1;
+
+	int error = (fputs("č = 0x63\n", file) == EOF);
+	error |= (fclose(file) != 0);
+	error = error || load_encoding_file(path, &encoding);
+	unlink(path);
+
+	return error;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+
+	unload_encoding_definitions(&encoding);
+
+	return 0;
+}
+
+#define JOB_COUNT 200
+
+// Check if texts are collected in order of submission, although workers may finish
+// younger, shorter ones first
+static void collect_in_order(void **state)
+{
+	(void)state;
+
+	int wakefd;
+	int error = workers_start(4, &wakefd, &attrib, &encoding, &features);
+	assert_false(error);
+
+	UT_string *text;
+	int childfd;
+	priority_t priority;
+	int status;
+
+	// There's nothing to collect yet
+	assert_false(workers_collect(&text, &childfd, &priority, &status));
+
+	// The first text takes longest to convert; all are ready before any is submitted
+	UT_string *job_texts[JOB_COUNT];
+	for (int i = 0; i < JOB_COUNT; i++) {
+		utstring_new(job_texts[i]);
+
+		int repeats = (i == 0) ? 200000 : JOB_COUNT - i;
+		for (int j = 0; j < repeats; j++)
+			utstring_printf(job_texts[i], "č%d,", i);
+	}
+
+	for (int i = 0; i < JOB_COUNT; i++)
+		workers_submit(job_texts[i], i, i % PRIORITY_COUNT);
+
+	// Workers' notifications are written to a mocked descriptor, so look for converted
+	// texts every millisecond instead
+	int collected = 0;
+	for (int tries = 0; collected < JOB_COUNT && tries < 10000; tries++) {
+		while (workers_collect(&text, &childfd, &priority, &status)) {
+			char first[16];
+			snprintf(first, sizeof first, "c%d,", collected);
+
+			int repeats = (collected == 0) ? 200000 : JOB_COUNT - collected;
+
+			assert_int_equal(childfd, collected);
+			assert_int_equal(priority, collected % PRIORITY_COUNT);
+			assert_int_equal(status, 0);
+			assert_int_equal(utstring_len(text), repeats * strlen(first));
+			assert_memory_equal(utstring_body(text), first, strlen(first));
+
+			utstring_free(text);
+			collected++;
+		}
+
+		poll(NULL, 0, 1);
+	}
+
+	assert_int_equal(collected, JOB_COUNT);
+
+	workers_stop();
+}
+
+// Check if texts, converted before workers have stopped, can still be collected
+static void collect_after_stop(void **state)
+{
+	(void)state;
+
+	int wakefd;
+	int error = workers_start(2, &wakefd, &attrib, &encoding, &features);
+	assert_false(error);
+
+	for (int i = 0; i < 3; i++) {
+		UT_string *job_text;
+		utstring_new(job_text);
+		utstring_printf(job_text, "čtext %d", i);
+
+		workers_submit(job_text, i, PRIORITY_NORMAL);
+	}
+
+	workers_stop();
+
+	UT_string *text;
+	int childfd;
+	priority_t priority;
+	int status;
+
+	for (int i = 0; i < 3; i++) {
+		char expected[16];
+		snprintf(expected, sizeof expected, "ctext %d", i);
+
+		assert_true(workers_collect(&text, &childfd, &priority, &status));
+		assert_int_equal(childfd, i);
+		assert_string_equal(utstring_body(text), expected);
+
+		utstring_free(text);
+	}
+
+	assert_false(workers_collect(&text, &childfd, &priority, &status));
+}
+
+int main(int argc, char **argv)
+{
+	// Number of (arbitrary) arguments sets the verbosity level
+	verbosity = argc - 1;
+	(void)argv;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(collect_in_order),
+		cmocka_unit_test(collect_after_stop)
+	};
+
+	return cmocka_run_group_tests_name((__FILE__) + 7, tests, setup, teardown);
+}
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "../src/config.h"
 
@@ -155,23 +156,27 @@ int __wrap_getnameinfo(const struct sockaddr addr, socklen_t addrlen,
 	return 0;
 }
 
-static char inet_buffer[18]; /* copied straight from glibc/inet/inet_ntoa.c */
-
-char *__real_inet_ntoa(void);
-char *__wrap_inet_ntoa(void)
+const char *__real_inet_ntop(int af, const void *src, char *dst, socklen_t size);
+const char *__wrap_inet_ntop(int af, const void *src, char *dst, socklen_t size)
 {
-	memccpy(inet_buffer, "127.0.0.1", '\0', 18);
+	(void)af;
+	(void)src;
+
+	memccpy(dst, "127.0.0.1", '\0', size);
 
-	return inet_buffer;
+	return dst;
 }
 
 ssize_t __real_write(int fd, const void *buf, size_t count);
 ssize_t __wrap_write(int fd, const void *buf, size_t count)
 {
-	(void)fd;
-	(void)buf;
+	// Files and pipes, opened by tests (e.g. output and job files), are written to
+	struct stat file_info;
+	if (fstat(fd, &file_info) == 0 &&
+	    (S_ISREG(file_info.st_mode) || S_ISFIFO(file_info.st_mode)))
+		return __real_write(fd, buf, count);
 
-	// Pretend everything has been written successfully
+	// Pretend everything else has been written successfully
 	return count;
 }
 